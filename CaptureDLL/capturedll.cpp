@@ -155,6 +155,18 @@ void glRotatef(GLfloat angle, GLfloat x, GLfloat y, GLfloat z)
 	rgl_interface->glRotatef(angle, x, y, z);
 }
 
+//10: glScalef - multiply the current matrix by a general scaling matrix
+void glScalef(GLfloat x, GLfloat y, GLfloat z)
+{
+	rgl_interface->glScalef(x, y, z);
+}
+
+//21: glLoadMatrixf - replace the current matrix with the specified matrix
+void glLoadMatrixf(const GLfloat *m)
+{
+	rgl_interface->glLoadMatrixf(m);
+}
+
 void glAccum (GLenum op, GLfloat value)
 {
 
@@ -408,7 +420,6 @@ void  glLineStipple (GLint factor, GLushort pattern){}
 void  glLineWidth (GLfloat width){}
 void  glListBase (GLuint base){}
 void  glLoadMatrixd (const GLdouble *m){}
-void  glLoadMatrixf (const GLfloat *m){}
 void  glLoadName (GLuint name){}
 void  glLogicOp (GLenum opcode){}
 void  glMap1d (GLenum target, GLdouble u1, GLdouble u2, GLint stride, GLint order, const GLdouble *points){}
@@ -503,7 +514,6 @@ GLint  glRenderMode (GLenum mode)
 
 void  glRotated (GLdouble angle, GLdouble x, GLdouble y, GLdouble z){}
 void  glScaled (GLdouble x, GLdouble y, GLdouble z){}
-void  glScalef (GLfloat x, GLfloat y, GLfloat z){}
 void  glScissor (GLint x, GLint y, GLsizei width, GLsizei height){}
 void  glSelectBuffer (GLsizei size, GLuint *buffer){}
 void  glShadeModel (GLenum mode){}
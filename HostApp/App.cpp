@@ -11,6 +11,9 @@
 App::App()
 {
 	configFile = NULL;
+	benchmark_mode = false;
+	transport_mode = false;
+	copies = 1;
 }
 
 //Destructor
@@ -32,15 +35,36 @@ int App::run(int argc, char **argv)
 			//Visualization wall address
 			i++;
 			address = argv[i];
+		} else if(argv[i][0] == '-' && argv[i][1] == 'b') {
+			//Benchmark the encodings
+			benchmark_mode = true;
+		} else if(argv[i][0] == '-' && argv[i][1] == 't') {
+			//Benchmark the transports
+			transport_mode = true;
+		} else if(argv[i][0] == '-' && argv[i][1] == 'n') {
+			//Number of copies of the shape to draw
+			i++;
+			sscanf(argv[i], "%u", &copies);
 		}
 	}
 
+	//The transports are compared without a config or the wall
+	if(transport_mode)
+		return benchmarkTransport();
+
 	//Set up the remote OpenGL interface given the config file
 	if(!configFile)
 		return -1;
 
 	rgl_interface = new RGLInterface(configFile);
 
+	//The benchmark doesn't need the wall
+	if(benchmark_mode) {
+		benchmark();
+		delete rgl_interface;
+		return 0;
+	}
+
 	//Connect to all nodes
 	if(rgl_interface->initialize(address) < 0)
 		return -1;
@@ -63,50 +87,397 @@ int App::run(int argc, char **argv)
 int App::mainLoop()
 {
 	float rtri = 0.0f;
+	unsigned int frame = 0;
 	rgl_interface->glClearColor(0.0f, 0.0f, 0.3f, 0.5f);
 
 	//Main render loop
 	for(;;) {
-		//Clear the color and depth buffer
-		rgl_interface->glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		
+		drawScene(rtri);
+
+		//Frame rendering done, send sync packet
+		FramePacing pacing = rgl_interface->sendSync();
+
+		//Periodically report how the frames are being sent
+		if(++frame % STATS_INTERVAL == 0) {
+			printf("Frame %u:\n", frame);
+			rgl_interface->printStats();
+		}
+
+		//Rotate the shape by the time the frame took, so it turns at the same
+		//speed however fast the wall takes frames
+		if(pacing.interval)
+			rtri += 0.2f * (float)pacing.interval / (float)NOMINAL_FRAME_TIME;
+		else
+			rtri += 0.2f;
+	}
+
+	return 0;
+}
+
+//Draws one frame of the scene
+void App::drawScene(float rtri)
+{
+	//Clear the color and depth buffer
+	rgl_interface->glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	if(copies <= 1) {
 		//Set up model transform matrix
 		rgl_interface->glLoadIdentity();
 		rgl_interface->glTranslatef(0.0f, 0.0f, -7.0f);
 		rgl_interface->glRotatef(rtri, 0.0f, 1.0f, 0.0f);
 		rgl_interface->glScalef(3.0f, 3.0f, 3.0f);
 
-		//Draw the shape
-		rgl_interface->glBegin(GL_TRIANGLES);
-			rgl_interface->glColor3f(1.0f,0.0f,0.0f);
-			rgl_interface->glVertex3f( 0.0f, 1.0f, 0.0f);
-			rgl_interface->glColor3f(0.0f,1.0f,0.0f);
-			rgl_interface->glVertex3f(-1.0f,-1.0f, 1.0f);
-			rgl_interface->glColor3f(0.0f,0.0f,1.0f);
-			rgl_interface->glVertex3f( 1.0f,-1.0f, 0.0f);
-
-			rgl_interface->glColor3f(1.0f,0.0f,0.0f);
-			rgl_interface->glVertex3f( 0.0f, 1.0f, 0.0f);
-			rgl_interface->glColor3f(0.0f,1.0f,0.0f);
-			rgl_interface->glVertex3f( 1.0f,-1.0f, 0.0f);
-			rgl_interface->glColor3f(0.0f,0.0f,1.0f);
-			rgl_interface->glVertex3f(-1.0f,-1.0f, -1.0f);
+		drawShape();
+		return;
+	}
+
+	//Lay the copies out in a square grid, each turning in place
+	unsigned int side = 1;
+	while(side * side < copies)
+		side++;
+	float spacing = 2.0f * COPIES_HALF_SIZE / side;
+
+	for(unsigned int i = 0; i < copies; i++) {
+		rgl_interface->glLoadIdentity();
+		rgl_interface->glTranslatef(-COPIES_HALF_SIZE + spacing * (i % side + 0.5f),
+			-COPIES_HALF_SIZE + spacing * (i / side + 0.5f), COPIES_DEPTH);
+		rgl_interface->glRotatef(rtri, 0.0f, 1.0f, 0.0f);
+		rgl_interface->glScalef(0.4f * spacing, 0.4f * spacing, 0.4f * spacing);
+
+		drawShape();
+	}
+}
+
+//Draws the shape under the current matrix
+void App::drawShape()
+{
+	rgl_interface->glBegin(GL_TRIANGLES);
+		rgl_interface->glColor3f(1.0f,0.0f,0.0f);
+		rgl_interface->glVertex3f( 0.0f, 1.0f, 0.0f);
+		rgl_interface->glColor3f(0.0f,1.0f,0.0f);
+		rgl_interface->glVertex3f(-1.0f,-1.0f, 1.0f);
+		rgl_interface->glColor3f(0.0f,0.0f,1.0f);
+		rgl_interface->glVertex3f( 1.0f,-1.0f, 0.0f);
+
+		rgl_interface->glColor3f(1.0f,0.0f,0.0f);
+		rgl_interface->glVertex3f( 0.0f, 1.0f, 0.0f);
+		rgl_interface->glColor3f(0.0f,1.0f,0.0f);
+		rgl_interface->glVertex3f( 1.0f,-1.0f, 0.0f);
+		rgl_interface->glColor3f(0.0f,0.0f,1.0f);
+		rgl_interface->glVertex3f(-1.0f,-1.0f, -1.0f);
    
-			rgl_interface->glColor3f(1.0f,0.0f,0.0f);
-			rgl_interface->glVertex3f( 0.0f, 1.0f, 0.0f);
-			rgl_interface->glColor3f(0.0f,0.0f,1.0f);
-			rgl_interface->glVertex3f(-1.0f,-1.0f,-1.0f);
-			rgl_interface->glColor3f(0.0f,1.0f,0.0f);
-			rgl_interface->glVertex3f(-1.0f,-1.0f, 1.0f);
-		rgl_interface->glEnd();
+		rgl_interface->glColor3f(1.0f,0.0f,0.0f);
+		rgl_interface->glVertex3f( 0.0f, 1.0f, 0.0f);
+		rgl_interface->glColor3f(0.0f,0.0f,1.0f);
+		rgl_interface->glVertex3f(-1.0f,-1.0f,-1.0f);
+		rgl_interface->glColor3f(0.0f,1.0f,0.0f);
+		rgl_interface->glVertex3f(-1.0f,-1.0f, 1.0f);
+	rgl_interface->glEnd();
+}
 
-		//Frame rendering done, send sync packet
-		rgl_interface->sendSync();
+//Reads commands back out of an encoded stream the way a node would
+struct StreamReader
+{
+	const char *data;
+	unsigned int pointer;
+	unsigned int revision;
+
+	//Reads a command id
+	int command()
+	{
+		int id;
+		if(revision >= PROTOCOL_REVISION_2)
+			return (unsigned char)data[pointer++];
+		memcpy(&id, &data[pointer], sizeof(int));
+		pointer += sizeof(int);
+		return id;
+	}
+
+	//Reads an enum or unsigned integer
+	unsigned int integer()
+	{
+		unsigned int value;
+		if(revision >= PROTOCOL_REVISION_2) {
+			pointer += decodeVarint(&data[pointer], &value);
+			return value;
+		}
+		memcpy(&value, &data[pointer], sizeof(unsigned int));
+		pointer += sizeof(unsigned int);
+		return value;
+	}
+
+	//Reads a clear mask
+	unsigned int bitfield()
+	{
+		if(revision >= PROTOCOL_REVISION_2) {
+			unsigned char packed = (unsigned char)data[pointer++];
+			return packed == CLEAR_MASK_RAW ? integer() : unpackClearMask(packed);
+		}
+		return integer();
+	}
+
+	//Reads a float
+	float real()
+	{
+		float value;
+		memcpy(&value, &data[pointer], sizeof(float));
+		pointer += sizeof(float);
+		return value;
+	}
+};
+
+//Decodes every argument of an encoded stream, returns a sum of them so the
+//work can't be skipped
+static float decodeStream(const char *data, unsigned int length, unsigned int revision)
+{
+	StreamReader reader;
+	float sum = 0.0f;
+	unsigned int fixed[3];
+
+	reader.data = data;
+	reader.pointer = 0;
+	reader.revision = revision;
+
+	while(reader.pointer < length) {
+		int id = reader.command();
+		if((unsigned int)id >= OPCODE_COUNT) {
+			printf("Unknown command in benchmark stream\n");
+			return sum;
+		}
+
+		//Fixed arguments are described by the command table
+		const GLCommandInfo *info = &gl_commands[id];
+		for(int i = 0; i < info->masks; i++)
+			sum += (float)reader.bitfield();
+		for(int i = 0; i < info->integers; i++) {
+			fixed[i] = reader.integer();
+			sum += (float)fixed[i];
+		}
+		for(int i = 0; i < info->floats; i++)
+			sum += reader.real();
+
+		//Vertex blocks carry data after them, sized by their count and flags
+		if(id == PACKED_VERTICES) {
+			for(unsigned int i = 0; i < fixed[1] * packedVertexFloats(fixed[2]); i++)
+				sum += reader.real();
+		} else if(id == COMPACT_VERTICES) {
+			reader.pointer += compactDataSize(fixed[1], fixed[2]);
+		} else if(id == OPCODE_DrawInstances) {
+			//The matrices come before the draw, which is read as a command
+			for(unsigned int i = 0; i < fixed[0] * instanceMatrixFloats(fixed[1]); i++)
+				sum += reader.real();
+		}
+	}
+
+	return sum;
+}
+
+//Encodes the scene with each protocol revision and reports the bytes per
+//frame and the time to decode them
+int App::benchmark()
+{
+	LARGE_INTEGER frequency, start, end;
+	QueryPerformanceFrequency(&frequency);
+
+	for(unsigned int revision = PROTOCOL_REVISION_1; revision <= PROTOCOL_REVISION; revision++) {
+		GLFrame *capture = new GLFrame(BENCHMARK_FRAMES * 1024, NULL);
+		float rtri = 0.0f;
+		float sum = 0.0f;
+
+		//Encode the same frames the main loop sends
+		rgl_interface->initializeCapture(revision, capture);
+		rgl_interface->glClearColor(0.0f, 0.0f, 0.3f, 0.5f);
+		for(int i = 0; i < BENCHMARK_FRAMES; i++) {
+			drawScene(rtri);
+			rgl_interface->sendSync();
+			rtri += 0.2f;
+		}
+
+		QueryPerformanceCounter(&start);
+		for(int i = 0; i < BENCHMARK_PASSES; i++)
+			sum += decodeStream(capture->data, capture->length, revision);
+		QueryPerformanceCounter(&end);
+
+		double seconds = (double)(end.QuadPart - start.QuadPart) / (double)frequency.QuadPart;
+		printf("Protocol revision %u: %.1f bytes per frame, %.1f ns to decode a frame (%g)\n", revision,
+			(double)capture->length / BENCHMARK_FRAMES,
+			seconds * 1e9 / ((double)BENCHMARK_FRAMES * BENCHMARK_PASSES), sum);
+
+		capture->release();
+	}
+
+	return 0;
+}
+
+//One side of a transport being benchmarked, either a shared memory ring each
+//way or a loopback socket
+struct TransportEnd
+{
+	GLSharedRing *out;
+	GLSharedRing *in;
+	SOCKET sock;
+};
+
+//Sends a whole buffer through a transport
+static bool transportSend(TransportEnd *end, char *data, unsigned int length)
+{
+	if(end->out)
+		return end->out->write(data, length);
+
+	while(length > 0) {
+		int sent = send(end->sock, data, length, 0);
+		if(sent <= 0)
+			return false;
+		data += sent;
+		length -= sent;
+	}
+
+	return true;
+}
+
+//Receives a whole buffer from a transport
+static bool transportReceive(TransportEnd *end, char *data, unsigned int length)
+{
+	while(length > 0) {
+		int received;
+		if(end->in) {
+			received = end->in->read(data, length);
+			if(received == 0) {
+				end->in->waitReadable(WAIT_FOREVER);
+				continue;
+			}
+		} else {
+			received = recv(end->sock, data, length, 0);
+		}
+
+		if(received <= 0)
+			return false;
+		data += received;
+		length -= received;
+	}
+
+	return true;
+}
+
+//Plays the node in the transport benchmark: takes the bulk data, answers
+//once it has all arrived, then echoes every message back
+static void TransportNodeShell(void *param)
+{
+	TransportEnd *end = (TransportEnd*)param;
+	char *buffer = new char[TRANSPORT_CHUNK_SIZE];
+
+	for(unsigned int received = 0; received < TRANSPORT_BENCHMARK_BYTES; received += TRANSPORT_CHUNK_SIZE) {
+		if(!transportReceive(end, buffer, TRANSPORT_CHUNK_SIZE))
+			break;
+	}
+	transportSend(end, buffer, 1);
+
+	for(int i = 0; i < TRANSPORT_ROUND_TRIPS; i++) {
+		if(!transportReceive(end, buffer, TRANSPORT_MESSAGE_SIZE) ||
+			!transportSend(end, buffer, TRANSPORT_MESSAGE_SIZE))
+			break;
+	}
+
+	delete[] buffer;
+}
+
+//Times bulk data and round trips through one transport
+static void timeTransport(const char *name, TransportEnd *host, TransportEnd *node)
+{
+	GLThread *thread = new GLThread(TransportNodeShell, node);
+	char *buffer = new char[TRANSPORT_CHUNK_SIZE];
+	unsigned long long start, trip, worst = 0;
+
+	memset(buffer, 0, TRANSPORT_CHUNK_SIZE);
+	if(!thread->start()) {
+		printf("Could not start the %s node thread\n", name);
+		delete thread;
+		delete[] buffer;
+		return;
+	}
+
+	//Throughput counts until the node has taken the last byte
+	start = timeMicroseconds();
+	for(unsigned int sent = 0; sent < TRANSPORT_BENCHMARK_BYTES; sent += TRANSPORT_CHUNK_SIZE)
+		transportSend(host, buffer, TRANSPORT_CHUNK_SIZE);
+	transportReceive(host, buffer, 1);
+	unsigned long long bulk = timeMicroseconds() - start;
+
+	//Latency is the round trip of a small message going there and back
+	start = timeMicroseconds();
+	for(int i = 0; i < TRANSPORT_ROUND_TRIPS; i++) {
+		trip = timeMicroseconds();
+		transportSend(host, buffer, TRANSPORT_MESSAGE_SIZE);
+		transportReceive(host, buffer, TRANSPORT_MESSAGE_SIZE);
+		trip = timeMicroseconds() - trip;
+		if(trip > worst)
+			worst = trip;
+	}
+	unsigned long long trips = timeMicroseconds() - start;
+
+	thread->join();
+	delete thread;
+	delete[] buffer;
+
+	printf("%s: %.0f MB/s, %.1fus average and %lluus worst round trip\n", name,
+		(double)TRANSPORT_BENCHMARK_BYTES / (double)bulk, (double)trips / TRANSPORT_ROUND_TRIPS, worst);
+}
+
+//Sends data and round trips through shared memory and loopback TCP and
+//reports the throughput and latency of each
+int App::benchmarkTransport()
+{
+	WSADATA wsaData;
+	char name[64];
+
+	if(WSAStartup(MAKEWORD(2,2), &wsaData) != 0) {
+		printf("Error %d occurred!\n",  WSAGetLastError());
+		return -1;
+	}
+
+	//Shared memory, a ring each way named for this process
+	GLSharedRing to_node, from_host, to_host, from_node;
+	sprintf(name, "Local\\GLWallBenchmark%luDown", GetCurrentProcessId());
+	BOOL rings = to_node.create(name, SHARED_RING_SIZE) && from_host.open(name);
+	sprintf(name, "Local\\GLWallBenchmark%luUp", GetCurrentProcessId());
+	rings = rings && to_host.create(name, SHARED_RING_SIZE) && from_node.open(name);
+	if(rings) {
+		TransportEnd host = {&to_node, &from_node, INVALID_SOCKET};
+		TransportEnd node = {&to_host, &from_host, INVALID_SOCKET};
+		timeTransport("Shared memory", &host, &node);
+	}
+
+	//Loopback TCP, a connected pair of sockets on an ephemeral port
+	sockaddr_in local;
+	int local_length = sizeof(local);
+	SOCKET server_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	SOCKET host_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	SOCKET node_sock = INVALID_SOCKET;
+	memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_addr.S_un.S_addr = inet_addr("127.0.0.1");
+	local.sin_port = 0;
+	if(bind(server_sock, (sockaddr*)&local, sizeof(local)) == SOCKET_ERROR ||
+		listen(server_sock, 1) == SOCKET_ERROR ||
+		getsockname(server_sock, (sockaddr*)&local, &local_length) == SOCKET_ERROR ||
+		connect(host_sock, (sockaddr*)&local, sizeof(local)) == SOCKET_ERROR ||
+		(node_sock = accept(server_sock, NULL, NULL)) == INVALID_SOCKET) {
+		printf("Error %d occurred!\n",  WSAGetLastError());
+	} else {
+		//Small messages would otherwise wait for Nagle's algorithm
+		int nodelay = 1;
+		setsockopt(host_sock, IPPROTO_TCP, TCP_NODELAY, (char*)&nodelay, sizeof(nodelay));
+		setsockopt(node_sock, IPPROTO_TCP, TCP_NODELAY, (char*)&nodelay, sizeof(nodelay));
 
-		//Sleep between frames and rotate shape
-		rtri += 0.2f;
+		TransportEnd host = {NULL, NULL, host_sock};
+		TransportEnd node = {NULL, NULL, node_sock};
+		timeTransport("Loopback TCP", &host, &node);
+		closesocket(node_sock);
 	}
+	closesocket(host_sock);
+	closesocket(server_sock);
 
+	WSACleanup();
 	return 0;
 }
 
@@ -8,6 +8,29 @@
 #include "RGLInterface.h"
 
 #include <stdio.h>
+#include <string.h>
+
+//Number of frames between statistics reports
+#define STATS_INTERVAL 1000
+
+//Frames of the scene encoded by the benchmark and times they are decoded
+#define BENCHMARK_FRAMES 1000
+#define BENCHMARK_PASSES 100
+
+//Microseconds per frame the animation speed is set for
+#define NOMINAL_FRAME_TIME 16667
+
+//Depth of the grid of copies and half its width and height, so it fills the
+//view
+#define COPIES_DEPTH -50.0f
+#define COPIES_HALF_SIZE 20.0f
+
+//Bytes sent through each transport to time throughput, the size of each
+//send, and the round trips and message size to time latency
+#define TRANSPORT_BENCHMARK_BYTES 268435456
+#define TRANSPORT_CHUNK_SIZE 65536
+#define TRANSPORT_ROUND_TRIPS 10000
+#define TRANSPORT_MESSAGE_SIZE 64
 
 class App
 {
@@ -21,6 +44,22 @@ private:
 	//Interface to remote OpenGL wall
 	RGLInterface *rgl_interface;
 
+	//Should the encodings be benchmarked instead of connecting to the wall
+	bool benchmark_mode;
+
+	//Should the transports be benchmarked instead of connecting to the wall
+	bool transport_mode;
+
+	//Number of copies of the shape the scene draws in a grid, 1 draws the
+	//shape on its own
+	unsigned int copies;
+
+	//Draws one frame of the scene
+	void drawScene(float rtri);
+
+	//Draws the shape under the current matrix
+	void drawShape();
+
 public:
 	App();
 	~App();
@@ -28,6 +67,14 @@ public:
 	//Main loop of app
 	int mainLoop();
 
+	//Encodes the scene with each protocol revision and reports the bytes
+	//per frame and the time to decode them
+	int benchmark();
+
+	//Sends data and round trips through shared memory and loopback TCP and
+	//reports the throughput and latency of each
+	int benchmarkTransport();
+
 	//Called when the program is run
 	int run(int argc, char **argv);
 };
@@ -0,0 +1,434 @@
+/*----------------------------------------------------------------------------*\
+|Delta frames. The host side encodes each chunk a node gets as edits of the    |
+|last frame it got, copies of ranges of that frame and literal bytes. The node |
+|side keeps its own copy of that frame and applies the edits to it.            |
+|                                                                              |
+|Stewart Hall                                                                  |
+|10/17/2026                                                                    |
+\*----------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "GLDelta.h"
+
+//Smallest hash table the reference is indexed in
+#define DELTA_TABLE_SIZE 4096
+
+//Hashes the DELTA_MIN_MATCH bytes at data
+static unsigned int hashBytes(const char *data)
+{
+	unsigned int low, high;
+
+	memcpy(&low, data, sizeof(unsigned int));
+	memcpy(&high, data + sizeof(unsigned int), sizeof(unsigned int));
+
+	unsigned int hash = low * 2654435761U ^ high * 2246822519U;
+	return hash ^ (hash >> 15);
+}
+
+//Returns how many bytes at a and b are the same, up to limit
+static unsigned int matchLength(const char *a, const char *b, unsigned int limit)
+{
+	unsigned int length = 0;
+
+	while(length < limit && a[length] == b[length])
+		length++;
+
+	return length;
+}
+
+//Reads a varint without going past the end of data, returns false if it
+//doesn't fit
+static bool readVarint(const char *data, unsigned int length, unsigned int *position, unsigned int *value)
+{
+	unsigned int shift = 0;
+	unsigned char byte;
+
+	*value = 0;
+	do {
+		if(*position >= length || shift >= 7 * VARINT_MAX_SIZE)
+			return false;
+		byte = (unsigned char)data[(*position)++];
+		*value |= (unsigned int)(byte & 0x7F) << shift;
+		shift += 7;
+	} while(byte & 0x80);
+
+	return true;
+}
+
+//Constructor
+GLDeltaEncoder::GLDeltaEncoder(unsigned int i_keyframe_interval)
+{
+	reference = NULL;
+	reference_length = 0;
+	reference_capacity = 0;
+	current = NULL;
+	current_length = 0;
+	current_capacity = 0;
+	chunk_start = 0;
+
+	table = NULL;
+	table_mask = 0;
+	indexed = false;
+
+	keyframe_interval = i_keyframe_interval;
+	frames_since_keyframe = 0;
+
+	//The node has nothing to refer to yet
+	keyframe_pending = true;
+	memset(&stats, 0, sizeof(stats));
+}
+
+//Destructor
+GLDeltaEncoder::~GLDeltaEncoder()
+{
+	delete[] reference;
+	delete[] current;
+	delete[] table;
+}
+
+//Adds commands to the chunk being encoded
+void GLDeltaEncoder::append(const char *data, unsigned int length)
+{
+	if(current_length + length > current_capacity) {
+		unsigned int capacity = current_capacity ? current_capacity : 4096;
+		while(capacity < current_length + length)
+			capacity *= 2;
+
+		char *grown = new char[capacity];
+		if(current) {
+			memcpy(grown, current, current_length);
+			delete[] current;
+		}
+		current = grown;
+		current_capacity = capacity;
+	}
+
+	memcpy(&current[current_length], data, length);
+	current_length += length;
+}
+
+//Returns the bytes added since the last encode
+unsigned int GLDeltaEncoder::pendingLength()
+{
+	return current_length - chunk_start;
+}
+
+//Encodes the pending chunk into out, which holds at least pendingLength() + 1
+//bytes. Returns the length written
+unsigned int GLDeltaEncoder::encode(char *out, bool frame_end)
+{
+	unsigned int length = current_length - chunk_start;
+	unsigned int written = 0;
+	unsigned char type;
+
+	//Keyframes start a frame and refer to nothing before it
+	if(chunk_start == 0 && (keyframe_pending || (keyframe_interval > 0 && frames_since_keyframe >= keyframe_interval))) {
+		reference_length = 0;
+		indexed = false;
+		keyframe_pending = false;
+		frames_since_keyframe = 0;
+		type = DELTA_KEYFRAME;
+		stats.keyframes++;
+	} else if(reference_length >= DELTA_MIN_MATCH && length >= DELTA_MIN_MATCH &&
+			(written = encodeEdits(&out[1], length)) > 0) {
+		type = DELTA_EDIT;
+		stats.edits++;
+	} else {
+		type = DELTA_RAW;
+		stats.raws++;
+	}
+
+	if(type != DELTA_EDIT) {
+		memcpy(&out[1], &current[chunk_start], length);
+		written = length;
+	}
+	out[0] = (char)(type | (frame_end ? DELTA_FRAME_END : 0));
+
+	stats.bytes_in += length;
+	stats.bytes_out += written + 1;
+	chunk_start = current_length;
+
+	//The finished frame is what the next one refers to
+	if(frame_end) {
+		char *data = reference;
+		unsigned int capacity = reference_capacity;
+
+		reference = current;
+		reference_length = current_length;
+		reference_capacity = current_capacity;
+		current = data;
+		current_length = 0;
+		current_capacity = capacity;
+		chunk_start = 0;
+		indexed = false;
+		frames_since_keyframe++;
+	}
+
+	return written + 1;
+}
+
+//Indexes the reference by the hash of every DELTA_MIN_MATCH bytes
+void GLDeltaEncoder::indexReference()
+{
+	unsigned int size = table ? table_mask + 1 : 0;
+
+	//About one entry per byte of the reference keeps collisions rare
+	if(size < reference_length || !table) {
+		if(size == 0)
+			size = DELTA_TABLE_SIZE;
+		while(size < reference_length)
+			size *= 2;
+
+		delete[] table;
+		table = new int[size];
+		table_mask = size - 1;
+	}
+
+	for(unsigned int i = 0; i < size; i++)
+		table[i] = -1;
+	for(unsigned int i = 0; i + DELTA_MIN_MATCH <= reference_length; i++)
+		table[hashBytes(&reference[i]) & table_mask] = (int)i;
+
+	indexed = true;
+}
+
+//Writes an edit script for the pending chunk, returns its length or 0 if it
+//would not be shorter than limit
+unsigned int GLDeltaEncoder::encodeEdits(char *out, unsigned int limit)
+{
+	const char *chunk = &current[chunk_start];
+	unsigned int length = current_length - chunk_start;
+	unsigned int written = 0;
+	unsigned int literal_start = 0;
+	unsigned int i = 0;
+
+	//Chunks after the first usually line up with the same place in the last
+	//frame, matching starts there
+	unsigned int expected = chunk_start;
+
+	if(!indexed)
+		indexReference();
+
+	if(2 * VARINT_MAX_SIZE > limit)
+		return 0;
+	written += encodeVarint(&out[written], length);
+	written += encodeVarint(&out[written], reference_length);
+
+	while(i <= length) {
+		unsigned int match = 0;
+		unsigned int source = 0;
+
+		//Try where the last copy left off, then anywhere with the same hash
+		if(i + DELTA_MIN_MATCH <= length) {
+			if(expected + DELTA_MIN_MATCH <= reference_length) {
+				source = expected;
+				match = matchLength(&chunk[i], &reference[source],
+					length - i < reference_length - source ? length - i : reference_length - source);
+			}
+
+			if(match < DELTA_MIN_MATCH) {
+				int candidate = table[hashBytes(&chunk[i]) & table_mask];
+				if(candidate >= 0) {
+					source = (unsigned int)candidate;
+					match = matchLength(&chunk[i], &reference[source],
+						length - i < reference_length - source ? length - i : reference_length - source);
+				}
+			}
+		}
+
+		//Changed bytes usually replace the same number of bytes, so keep the
+		//expected position in step
+		if(match < DELTA_MIN_MATCH && i < length) {
+			i++;
+			expected++;
+			continue;
+		}
+
+		//Send the bytes since the last copy as they are
+		if(i > literal_start) {
+			unsigned int literal = i - literal_start;
+			if(written + VARINT_MAX_SIZE + literal > limit)
+				return 0;
+			written += encodeVarint(&out[written], literal << 1 | DELTA_LITERAL);
+			memcpy(&out[written], &chunk[literal_start], literal);
+			written += literal;
+		}
+
+		if(i == length)
+			break;
+
+		if(written + 2 * VARINT_MAX_SIZE > limit)
+			return 0;
+		written += encodeVarint(&out[written], match << 1 | DELTA_COPY);
+		written += encodeVarint(&out[written], source);
+
+		i += match;
+		expected = source + match;
+		literal_start = i;
+	}
+
+	return written < limit ? written : 0;
+}
+
+//Makes the next frame a keyframe
+void GLDeltaEncoder::requestKeyframe()
+{
+	keyframe_pending = true;
+}
+
+//Returns how well delta encoding is doing
+DeltaStats GLDeltaEncoder::getStats()
+{
+	return stats;
+}
+
+//Constructor
+GLDeltaDecoder::GLDeltaDecoder()
+{
+	reference = NULL;
+	reference_length = 0;
+	reference_capacity = 0;
+	current = NULL;
+	current_length = 0;
+	current_capacity = 0;
+
+	//Nothing can be applied before the first keyframe
+	lost = true;
+}
+
+//Destructor
+GLDeltaDecoder::~GLDeltaDecoder()
+{
+	delete[] reference;
+	delete[] current;
+}
+
+//Makes room for length more bytes in the current frame
+void GLDeltaDecoder::grow(unsigned int length)
+{
+	if(current_length + length <= current_capacity)
+		return;
+
+	unsigned int capacity = current_capacity ? current_capacity : 4096;
+	while(capacity < current_length + length)
+		capacity *= 2;
+
+	char *grown = new char[capacity];
+	if(current) {
+		memcpy(grown, current, current_length);
+		delete[] current;
+	}
+	current = grown;
+	current_capacity = capacity;
+}
+
+//Applies an edit script to the reference, returns false if it doesn't fit
+bool GLDeltaDecoder::applyEdits(const char *data, unsigned int length)
+{
+	unsigned int position = 0;
+	unsigned int total, base, produced = 0;
+	unsigned int operation, run, source;
+
+	if(!readVarint(data, length, &position, &total) || !readVarint(data, length, &position, &base))
+		return false;
+
+	//The edits were made against a different frame than the one kept here
+	if(base != reference_length)
+		return false;
+
+	grow(total);
+	char *out = &current[current_length];
+
+	while(produced < total) {
+		if(!readVarint(data, length, &position, &operation))
+			return false;
+
+		run = operation >> 1;
+		if(run == 0 || run > total - produced)
+			return false;
+
+		if((operation & 1) == DELTA_COPY) {
+			if(!readVarint(data, length, &position, &source) || source > reference_length ||
+					run > reference_length - source)
+				return false;
+			memcpy(&out[produced], &reference[source], run);
+		} else {
+			if(run > length - position)
+				return false;
+			memcpy(&out[produced], &data[position], run);
+			position += run;
+		}
+
+		produced += run;
+	}
+
+	if(position != length)
+		return false;
+
+	current_length += total;
+	return true;
+}
+
+//Turns a received chunk into its commands, which stay valid until the next
+//call. Returns false if the chunk has to be skipped
+bool GLDeltaDecoder::decode(const char *data, unsigned int length, char **commands, unsigned int *commands_length)
+{
+	if(length == 0) {
+		lost = true;
+		return false;
+	}
+
+	unsigned char type = (unsigned char)data[0] & DELTA_TYPE_MASK;
+	bool frame_end = (data[0] & DELTA_FRAME_END) != 0;
+
+	//A keyframe starts over from nothing
+	if(type == DELTA_KEYFRAME) {
+		reference_length = 0;
+		current_length = 0;
+		lost = false;
+	}
+
+	if(lost)
+		return false;
+
+	unsigned int start = current_length;
+	if(type == DELTA_EDIT) {
+		if(!applyEdits(&data[1], length - 1)) {
+			lost = true;
+			return false;
+		}
+	} else if(type == DELTA_RAW || type == DELTA_KEYFRAME) {
+		grow(length - 1);
+		memcpy(&current[current_length], &data[1], length - 1);
+		current_length += length - 1;
+	} else {
+		lost = true;
+		return false;
+	}
+
+	*commands = &current[start];
+	*commands_length = current_length - start;
+
+	//The finished frame is what the next one refers to, the commands stay
+	//where they are until the next call
+	if(frame_end) {
+		char *swapped = reference;
+		unsigned int capacity = reference_capacity;
+
+		reference = current;
+		reference_length = current_length;
+		reference_capacity = current_capacity;
+		current = swapped;
+		current_length = 0;
+		current_capacity = capacity;
+	}
+
+	return true;
+}
+
+//Returns true while chunks are skipped waiting for a keyframe
+bool GLDeltaDecoder::isLost()
+{
+	return lost;
+}
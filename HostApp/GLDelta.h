@@ -0,0 +1,127 @@
+/*----------------------------------------------------------------------------*\
+|Delta frames. The host side encodes each chunk a node gets as edits of the    |
+|last frame it got, copies of ranges of that frame and literal bytes. The node |
+|side keeps its own copy of that frame and applies the edits to it.            |
+|                                                                              |
+|Stewart Hall                                                                  |
+|10/17/2026                                                                    |
+\*----------------------------------------------------------------------------*/
+
+#ifndef GLDELTA_H
+#define GLDELTA_H
+
+#include "GLProtocol.h"
+
+//Default number of frames between keyframes
+#define DELTA_KEYFRAME_INTERVAL 120
+
+//Shortest run of bytes copied from the last frame instead of sent as it is
+#define DELTA_MIN_MATCH 8
+
+//How well delta encoding is doing
+struct DeltaStats
+{
+	//Chunks sent as edits, as they are and as keyframes
+	unsigned int edits;
+	unsigned int raws;
+	unsigned int keyframes;
+
+	//Bytes of commands encoded and bytes sent for them
+	unsigned long long bytes_in;
+	unsigned long long bytes_out;
+};
+
+class GLDeltaEncoder
+{
+private:
+	//Frame the edits refer to
+	char *reference;
+	unsigned int reference_length;
+	unsigned int reference_capacity;
+
+	//Frame being sent, chunks are added to it until one ends the frame
+	char *current;
+	unsigned int current_length;
+	unsigned int current_capacity;
+
+	//Start of the part of the current frame not encoded yet
+	unsigned int chunk_start;
+
+	//Last position in the reference of each hash of DELTA_MIN_MATCH bytes,
+	//or -1. Built the first time a frame is matched against the reference
+	int *table;
+	unsigned int table_mask;
+	bool indexed;
+
+	//Frames between keyframes, frames since the last one, and whether the
+	//next frame has to be one
+	unsigned int keyframe_interval;
+	unsigned int frames_since_keyframe;
+	bool keyframe_pending;
+
+	DeltaStats stats;
+
+	//Indexes the reference by the hash of every DELTA_MIN_MATCH bytes
+	void indexReference();
+
+	//Writes an edit script for the pending chunk, returns its length or 0 if
+	//it would not be shorter than limit
+	unsigned int encodeEdits(char *out, unsigned int limit);
+
+public:
+	GLDeltaEncoder(unsigned int i_keyframe_interval);
+	~GLDeltaEncoder();
+
+	//Adds commands to the chunk being encoded
+	void append(const char *data, unsigned int length);
+
+	//Returns the bytes added since the last encode
+	unsigned int pendingLength();
+
+	//Encodes the pending chunk into out, which holds at least
+	//pendingLength() + 1 bytes. Returns the length written
+	unsigned int encode(char *out, bool frame_end);
+
+	//Makes the next frame a keyframe
+	void requestKeyframe();
+
+	//Returns how well delta encoding is doing
+	DeltaStats getStats();
+};
+
+class GLDeltaDecoder
+{
+private:
+	//Frame the edits refer to
+	char *reference;
+	unsigned int reference_length;
+	unsigned int reference_capacity;
+
+	//Frame being received
+	char *current;
+	unsigned int current_length;
+	unsigned int current_capacity;
+
+	//Set when an edit could not be applied, chunks are skipped until a
+	//keyframe arrives
+	bool lost;
+
+	//Makes room for length more bytes in the current frame
+	void grow(unsigned int length);
+
+	//Applies an edit script to the reference, returns false if it doesn't fit
+	bool applyEdits(const char *data, unsigned int length);
+
+public:
+	GLDeltaDecoder();
+	~GLDeltaDecoder();
+
+	//Turns a received chunk into its commands, which stay valid until the next
+	//call. Returns false if the chunk has to be skipped
+	bool decode(const char *data, unsigned int length, char **commands, unsigned int *commands_length);
+
+	//Returns true while chunks are skipped waiting for a keyframe
+	bool isLost();
+};
+
+#endif
@@ -0,0 +1,204 @@
+/*----------------------------------------------------------------------------*\
+|A block of encoded OpenGL commands that is shared by every pipe sending it.   |
+|Frames are encoded in place once and go back to their pool when the last pipe |
+|has finished sending them.                                                    |
+|                                                                              |
+|Stewart Hall                                                                  |
+|10/17/2026                                                                    |
+\*----------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "GLFrame.h"
+
+//Creates an empty frame belonging to a pool
+GLFrame::GLFrame(unsigned int i_capacity, GLFramePool *i_pool)
+{
+	references = 1;
+	pool = i_pool;
+	capacity = i_capacity;
+	length = 0;
+	data = new char[capacity];
+	next = NULL;
+
+	culled = NULL;
+	culled_count = 0;
+	culled_capacity = 0;
+	culled_masks = NULL;
+	mask_words = 0;
+
+	droppable = NULL;
+	droppable_count = 0;
+	droppable_capacity = 0;
+	frame_end = -1;
+	frame_end_length = 0;
+	generation = 0;
+}
+
+//Destructor
+GLFrame::~GLFrame()
+{
+	delete[] data;
+	delete[] culled;
+	delete[] culled_masks;
+	delete[] droppable;
+}
+
+//Grows the frame so it can hold at least size bytes, keeping its data
+void GLFrame::reserve(unsigned int size)
+{
+	if(size <= capacity)
+		return;
+
+	//Grow geometrically so large batches don't reallocate on every command
+	while(capacity < size)
+		capacity *= 2;
+
+	char *grown = new char[capacity];
+	memcpy(grown, data, length);
+	delete[] data;
+	data = grown;
+}
+
+//Marks a range as skipped by the pipes whose bits are set in mask
+void GLFrame::addCulledRange(unsigned int offset, unsigned int length, const unsigned int *mask, int words)
+{
+	//Make room for the range and its mask
+	if(culled_count == culled_capacity || words != mask_words) {
+		int capacity = culled_capacity ? culled_capacity * 2 : 16;
+		CulledRange *grown = new CulledRange[capacity];
+		unsigned int *grown_masks = new unsigned int[capacity * words];
+
+		if(words == mask_words) {
+			memcpy(grown, culled, culled_count * sizeof(CulledRange));
+			memcpy(grown_masks, culled_masks, culled_count * words * sizeof(unsigned int));
+		} else {
+			culled_count = 0;
+		}
+
+		delete[] culled;
+		delete[] culled_masks;
+		culled = grown;
+		culled_masks = grown_masks;
+		culled_capacity = capacity;
+		mask_words = words;
+	}
+
+	culled[culled_count].offset = offset;
+	culled[culled_count].length = length;
+	memcpy(&culled_masks[culled_count * words], mask, words * sizeof(unsigned int));
+	culled_count++;
+}
+
+//Returns TRUE if a pipe skips a range
+bool GLFrame::isCulled(int range, int pipe)
+{
+	return (culled_masks[range * mask_words + pipe / 32] & (1u << (pipe % 32))) != 0;
+}
+
+//Marks a range of commands as only drawing
+void GLFrame::addDroppableRange(unsigned int offset, unsigned int length)
+{
+	//Runs of drawing commands are kept as one range
+	if(droppable_count > 0) {
+		CulledRange *last = &droppable[droppable_count - 1];
+		if(last->offset + last->length == offset) {
+			last->length += length;
+			return;
+		}
+	}
+
+	if(droppable_count == droppable_capacity) {
+		int capacity = droppable_capacity ? droppable_capacity * 2 : 16;
+		CulledRange *grown = new CulledRange[capacity];
+		if(droppable)
+			memcpy(grown, droppable, droppable_count * sizeof(CulledRange));
+		delete[] droppable;
+		droppable = grown;
+		droppable_capacity = capacity;
+	}
+
+	droppable[droppable_count].offset = offset;
+	droppable[droppable_count].length = length;
+	droppable_count++;
+}
+
+//Adds a reference for another holder of the frame
+void GLFrame::addReference()
+{
+	atomicIncrement(&references);
+}
+
+//Drops a reference, recycles the frame if it was the last one
+void GLFrame::release()
+{
+	if(atomicDecrement(&references) == 0) {
+		if(pool)
+			pool->recycle(this);
+		else
+			delete this;
+	}
+}
+
+//Constructor
+GLFramePool::GLFramePool(unsigned int i_frame_size)
+{
+	free_frames = NULL;
+	free_count = 0;
+	frame_size = i_frame_size;
+	free_lock = new GLLock();
+}
+
+//Destructor, frames still held by pipes must have been released
+GLFramePool::~GLFramePool()
+{
+	while(free_frames) {
+		GLFrame *frame = free_frames;
+		free_frames = frame->next;
+		delete frame;
+	}
+
+	delete free_lock;
+}
+
+//Returns an empty frame held by the caller
+GLFrame *GLFramePool::acquire()
+{
+	GLFrame *frame = NULL;
+
+	free_lock->lock();
+	if(free_frames) {
+		frame = free_frames;
+		free_frames = frame->next;
+		free_count--;
+	}
+	free_lock->unlock();
+
+	if(!frame)
+		return new GLFrame(frame_size, this);
+
+	frame->length = 0;
+	frame->next = NULL;
+	frame->culled_count = 0;
+	frame->droppable_count = 0;
+	frame->frame_end = -1;
+	frame->addReference();
+	return frame;
+}
+
+//Takes back a frame that is no longer referenced
+void GLFramePool::recycle(GLFrame *frame)
+{
+	free_lock->lock();
+	if(free_count < FRAME_POOL_SIZE) {
+		frame->next = free_frames;
+		free_frames = frame;
+		free_count++;
+		frame = NULL;
+	}
+	free_lock->unlock();
+
+	//Pool is full, let the frame go
+	if(frame)
+		delete frame;
+}
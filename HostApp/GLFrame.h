@@ -0,0 +1,114 @@
+/*----------------------------------------------------------------------------*\
+|A block of encoded OpenGL commands that is shared by every pipe sending it.   |
+|Frames are encoded in place once and go back to their pool when the last pipe |
+|has finished sending them.                                                    |
+|                                                                              |
+|Stewart Hall                                                                  |
+|10/17/2026                                                                    |
+\*----------------------------------------------------------------------------*/
+
+#ifndef GLFRAME_H
+#define GLFRAME_H
+
+#include "GLThread.h"
+
+//Number of unused frames kept around by a pool for reuse
+#define FRAME_POOL_SIZE 256
+
+class GLFramePool;
+
+//A range of bytes in a frame that some pipes don't need to send
+struct CulledRange
+{
+	unsigned int offset;
+	unsigned int length;
+};
+
+class GLFrame
+{
+private:
+	//Number of holders that still need this frame
+	volatile long references;
+
+	//Pool to return to when released
+	GLFramePool *pool;
+
+public:
+	//Encoded commands, their length and the space allocated for them
+	char *data;
+	unsigned int length;
+	unsigned int capacity;
+
+	//Next free frame when sitting in a pool
+	GLFrame *next;
+
+	//Ranges skipped by some pipes, in order of offset
+	CulledRange *culled;
+	int culled_count;
+	int culled_capacity;
+
+	//For each range, one bit per pipe that skips it
+	unsigned int *culled_masks;
+	int mask_words;
+
+	//Ranges of commands that only draw, in order of offset. A pipe whose node
+	//is behind can leave them out and drop the frame
+	CulledRange *droppable;
+	int droppable_count;
+	int droppable_capacity;
+
+	//Offset and length of the command ending a displayed frame, or -1
+	int frame_end;
+	unsigned int frame_end_length;
+
+	//How many times the host had forgotten what the nodes hold when the
+	//frame was queued. A keyframe asked for after a reset starts no earlier
+	unsigned int generation;
+
+	GLFrame(unsigned int i_capacity, GLFramePool *i_pool);
+	~GLFrame();
+
+	//Grows the frame so it can hold at least size bytes, keeping its data
+	void reserve(unsigned int size);
+
+	//Marks a range as skipped by the pipes whose bits are set in mask
+	void addCulledRange(unsigned int offset, unsigned int length, const unsigned int *mask, int words);
+
+	//Returns TRUE if a pipe skips a range
+	bool isCulled(int range, int pipe);
+
+	//Marks a range of commands as only drawing
+	void addDroppableRange(unsigned int offset, unsigned int length);
+
+	//Adds a reference for another holder of the frame
+	void addReference();
+
+	//Drops a reference, recycles the frame if it was the last one
+	void release();
+};
+
+class GLFramePool
+{
+private:
+	//Frames waiting to be reused
+	GLFrame *free_frames;
+	int free_count;
+
+	//Capacity of newly allocated frames
+	unsigned int frame_size;
+
+	//Protects the free list, frames are recycled by the sender threads
+	GLLock *free_lock;
+
+public:
+	GLFramePool(unsigned int i_frame_size);
+	~GLFramePool();
+
+	//Returns an empty frame held by the caller
+	GLFrame *acquire();
+
+	//Takes back a frame that is no longer referenced
+	void recycle(GLFrame *frame);
+};
+
+#endif
@@ -0,0 +1,218 @@
+/*----------------------------------------------------------------------------*\
+|Host side of the geometry cache. Keeps the encoded vertex blocks each node has|
+|stored, by the hash of their bytes, and picks the node slot a new block goes  |
+|in. Every node gets the same stores, so one copy here mirrors all of them.    |
+|                                                                              |
+|Stewart Hall                                                                  |
+|10/17/2026                                                                    |
+\*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "GLGeometryCache.h"
+
+//Constructor
+GLGeometryCache::GLGeometryCache(int i_slot_count, unsigned int i_byte_limit)
+{
+	slot_count = i_slot_count;
+	byte_limit = i_byte_limit;
+	bytes = 0;
+
+	entries = new CacheEntry[slot_count];
+	for(int i = 0; i < slot_count; i++) {
+		entries[i].data = NULL;
+		entries[i].length = 0;
+		entries[i].older = -1;
+		entries[i].newer = -1;
+		entries[i].next = -1;
+	}
+
+	//Twice as many buckets as slots keeps the chains short
+	unsigned int bucket_count = 1;
+	while(bucket_count < (unsigned int)slot_count * 2)
+		bucket_count *= 2;
+	buckets = new int[bucket_count];
+	for(unsigned int i = 0; i < bucket_count; i++)
+		buckets[i] = -1;
+	bucket_mask = bucket_count - 1;
+
+	oldest = -1;
+	newest = -1;
+	next_unused = 0;
+	free_slots = -1;
+	memset(&stats, 0, sizeof(stats));
+}
+
+//Destructor
+GLGeometryCache::~GLGeometryCache()
+{
+	for(int i = 0; i < slot_count; i++) {
+		if(entries[i].data)
+			delete[] entries[i].data;
+	}
+	delete[] entries;
+	delete[] buckets;
+}
+
+//Hashes the bytes of a block, 64 bit FNV-1a
+unsigned long long GLGeometryCache::hashBlock(const char *data, unsigned int length)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+
+	for(unsigned int i = 0; i < length; i++) {
+		hash ^= (unsigned char)data[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+//Looks up a block. Returns true with its slot if the nodes have it, otherwise
+//false with the slot to store it in, -1 if it can't be cached
+bool GLGeometryCache::lookup(const char *data, unsigned int length, int *slot)
+{
+	unsigned long long hash = hashBlock(data, length);
+	unsigned int bucket = (unsigned int)(hash ^ (hash >> 32)) & bucket_mask;
+
+	//A hit has to match byte for byte, the hash alone could collide
+	for(int i = buckets[bucket]; i >= 0; i = entries[i].next) {
+		if(entries[i].hash == hash && entries[i].length == length && !memcmp(entries[i].data, data, length)) {
+			touch(i);
+			stats.hits++;
+			stats.bytes_saved += length;
+			*slot = i;
+			return true;
+		}
+	}
+
+	stats.misses++;
+	if(length > byte_limit) {
+		*slot = -1;
+		return false;
+	}
+
+	//Push out the least recently used blocks until the new one fits and a
+	//slot is free
+	while((free_slots < 0 && next_unused == slot_count) || bytes + length > byte_limit)
+		evict(oldest);
+
+	int chosen;
+	if(free_slots >= 0) {
+		chosen = free_slots;
+		free_slots = entries[chosen].next;
+	} else {
+		chosen = next_unused++;
+	}
+
+	CacheEntry *entry = &entries[chosen];
+	entry->hash = hash;
+	entry->data = new char[length];
+	memcpy(entry->data, data, length);
+	entry->length = length;
+	entry->next = buckets[bucket];
+	buckets[bucket] = chosen;
+	touch(chosen);
+
+	bytes += length;
+	stats.bytes_stored += length;
+	*slot = chosen;
+	return false;
+}
+
+//Takes an entry out of the used order
+void GLGeometryCache::unlink(int slot)
+{
+	CacheEntry *entry = &entries[slot];
+
+	if(entry->older >= 0)
+		entries[entry->older].newer = entry->newer;
+	else if(oldest == slot)
+		oldest = entry->newer;
+
+	if(entry->newer >= 0)
+		entries[entry->newer].older = entry->older;
+	else if(newest == slot)
+		newest = entry->older;
+
+	entry->older = -1;
+	entry->newer = -1;
+}
+
+//Makes an entry the most recently used one
+void GLGeometryCache::touch(int slot)
+{
+	if(newest == slot)
+		return;
+
+	unlink(slot);
+	entries[slot].older = newest;
+	if(newest >= 0)
+		entries[newest].newer = slot;
+	newest = slot;
+	if(oldest < 0)
+		oldest = slot;
+}
+
+//Drops the block in a slot and frees the slot for the next store
+void GLGeometryCache::evict(int slot)
+{
+	CacheEntry *entry = &entries[slot];
+	if(!entry->data)
+		return;
+
+	//Take it out of its bucket
+	unsigned int bucket = (unsigned int)(entry->hash ^ (entry->hash >> 32)) & bucket_mask;
+	int *link = &buckets[bucket];
+	while(*link != slot)
+		link = &entries[*link].next;
+	*link = entry->next;
+
+	unlink(slot);
+	bytes -= entry->length;
+	delete[] entry->data;
+	entry->data = NULL;
+	entry->length = 0;
+	entry->next = free_slots;
+	free_slots = slot;
+	stats.evictions++;
+}
+
+//Forgets every block, for when the nodes can't be trusted to have them. The
+//stats carry on
+void GLGeometryCache::clear()
+{
+	for(int i = 0; i < slot_count; i++) {
+		if(entries[i].data)
+			delete[] entries[i].data;
+		entries[i].data = NULL;
+		entries[i].length = 0;
+		entries[i].older = -1;
+		entries[i].newer = -1;
+		entries[i].next = -1;
+	}
+	for(unsigned int i = 0; i <= bucket_mask; i++)
+		buckets[i] = -1;
+
+	bytes = 0;
+	oldest = -1;
+	newest = -1;
+	next_unused = 0;
+	free_slots = -1;
+}
+
+//Returns how well the cache is doing
+CacheStats GLGeometryCache::getStats()
+{
+	return stats;
+}
+
+//Prints out hits, misses and evictions
+void GLGeometryCache::printStats()
+{
+	unsigned int lookups = stats.hits + stats.misses;
+
+	printf("Geometry cache: %u hits, %u misses (%.1f%% hit rate), %u evictions, %u bytes held, %llu bytes saved, %llu bytes stored\n",
+		stats.hits, stats.misses, lookups ? 100.0 * stats.hits / lookups : 0.0, stats.evictions, bytes,
+		stats.bytes_saved, stats.bytes_stored);
+}
@@ -0,0 +1,109 @@
+/*----------------------------------------------------------------------------*\
+|Host side of the geometry cache. Keeps the encoded vertex blocks each node has|
+|stored, by the hash of their bytes, and picks the node slot a new block goes  |
+|in. Every node gets the same stores, so one copy here mirrors all of them.    |
+|                                                                              |
+|Stewart Hall                                                                  |
+|10/17/2026                                                                    |
+\*----------------------------------------------------------------------------*/
+
+#ifndef GLGEOMETRYCACHE_H
+#define GLGEOMETRYCACHE_H
+
+//Default number of blocks a node keeps
+#define CACHE_SLOTS 1024
+
+//Default bytes of blocks a node keeps
+#define CACHE_BYTES 16777216
+
+//Blocks smaller than this are sent in full, an ID would barely save anything
+#define CACHE_MIN_BLOCK 64
+
+//How well the cache is doing
+struct CacheStats
+{
+	//Blocks drawn from the cache and blocks that had to be stored first
+	unsigned int hits;
+	unsigned int misses;
+
+	//Blocks pushed out to make room for others
+	unsigned int evictions;
+
+	//Bytes of blocks not sent because the nodes had them, and bytes stored
+	unsigned long long bytes_saved;
+	unsigned long long bytes_stored;
+};
+
+//A block the nodes have in one of their slots
+struct CacheEntry
+{
+	//Hash of the block and its bytes, to tell blocks with the same hash apart
+	unsigned long long hash;
+	char *data;
+	unsigned int length;
+
+	//Neighbours in the least recently used order, -1 at the ends
+	int older;
+	int newer;
+
+	//Next entry in the same hash bucket, or the next free slot, or -1
+	int next;
+};
+
+class GLGeometryCache
+{
+private:
+	//One entry per node slot, unused ones have no data
+	CacheEntry *entries;
+	int slot_count;
+
+	//Bytes of every block stored, at most byte_limit
+	unsigned int bytes;
+	unsigned int byte_limit;
+
+	//First entry of each hash bucket, or -1. Bucket count is a power of two
+	int *buckets;
+	unsigned int bucket_mask;
+
+	//Least and most recently used entries, or -1
+	int oldest;
+	int newest;
+
+	//Next slot that has never been used, and slots emptied by evictions
+	int next_unused;
+	int free_slots;
+
+	CacheStats stats;
+
+	//Takes an entry out of the used order
+	void unlink(int slot);
+
+	//Makes an entry the most recently used one
+	void touch(int slot);
+
+	//Drops the block in a slot and frees the slot for the next store
+	void evict(int slot);
+
+public:
+	GLGeometryCache(int i_slot_count, unsigned int i_byte_limit);
+	~GLGeometryCache();
+
+	//Hashes the bytes of a block
+	static unsigned long long hashBlock(const char *data, unsigned int length);
+
+	//Looks up a block. Returns true with its slot if the nodes have it,
+	//otherwise false with the slot to store it in, -1 if it can't be cached
+	bool lookup(const char *data, unsigned int length, int *slot);
+
+	//Forgets every block, for when the nodes can't be trusted to have them.
+	//The stats carry on
+	void clear();
+
+	//Returns how well the cache is doing
+	CacheStats getStats();
+
+	//Prints out hits, misses and evictions
+	void printStats();
+};
+
+#endif
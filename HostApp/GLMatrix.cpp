@@ -0,0 +1,178 @@
+/*----------------------------------------------------------------------------*\
+|A 4x4 matrix stored column major like OpenGL. Lets the host follow the        |
+|transforms it sends so it knows where geometry ends up on the wall.           |
+|                                                                              |
+|Stewart Hall                                                                  |
+|10/17/2026                                                                    |
+\*----------------------------------------------------------------------------*/
+
+#include <math.h>
+#include <string.h>
+
+#include "GLMatrix.h"
+
+#ifdef GLMATRIX_SSE
+#include <xmmintrin.h>
+#endif
+
+#define PI 3.14159265f
+
+//Constructor, starts out as the identity
+GLMatrix::GLMatrix()
+{
+	identity();
+}
+
+//Replaces the matrix with the identity matrix
+void GLMatrix::identity()
+{
+	memset(m, 0, sizeof(m));
+	m[0] = m[5] = m[10] = m[15] = 1.0f;
+}
+
+//Replaces the matrix with 16 elements in column major order, like
+//glLoadMatrixf
+void GLMatrix::load(const float *elements)
+{
+	memcpy(m, elements, sizeof(m));
+}
+
+//Returns true if the matrix is the identity matrix
+bool GLMatrix::isIdentity() const
+{
+	for(int i = 0; i < 16; i++) {
+		if(m[i] != (i % 5 == 0 ? 1.0f : 0.0f))
+			return false;
+	}
+
+	return true;
+}
+
+//Returns true if the bottom row of the matrix is 0, 0, 0, 1
+bool GLMatrix::isAffine() const
+{
+	return m[3] == 0.0f && m[7] == 0.0f && m[11] == 0.0f && m[15] == 1.0f;
+}
+
+//Multiplies the matrix by another one on the right
+void GLMatrix::multiply(const GLMatrix &other)
+{
+	float result[16];
+
+#ifdef GLMATRIX_SSE
+	//Each column of the result is the columns of this matrix weighted by the
+	//same column of the other one
+	__m128 col0 = _mm_loadu_ps(&m[0]);
+	__m128 col1 = _mm_loadu_ps(&m[4]);
+	__m128 col2 = _mm_loadu_ps(&m[8]);
+	__m128 col3 = _mm_loadu_ps(&m[12]);
+
+	for(int col = 0; col < 4; col++) {
+		const float *weights = &other.m[col * 4];
+		__m128 sum = _mm_mul_ps(col0, _mm_set1_ps(weights[0]));
+		sum = _mm_add_ps(sum, _mm_mul_ps(col1, _mm_set1_ps(weights[1])));
+		sum = _mm_add_ps(sum, _mm_mul_ps(col2, _mm_set1_ps(weights[2])));
+		sum = _mm_add_ps(sum, _mm_mul_ps(col3, _mm_set1_ps(weights[3])));
+		_mm_storeu_ps(&result[col * 4], sum);
+	}
+#else
+	for(int col = 0; col < 4; col++) {
+		for(int row = 0; row < 4; row++) {
+			result[col * 4 + row] =
+				m[row] * other.m[col * 4] +
+				m[4 + row] * other.m[col * 4 + 1] +
+				m[8 + row] * other.m[col * 4 + 2] +
+				m[12 + row] * other.m[col * 4 + 3];
+		}
+	}
+#endif
+
+	memcpy(m, result, sizeof(m));
+}
+
+//Multiplies the matrix by a translation matrix, like glTranslatef
+void GLMatrix::translate(float x, float y, float z)
+{
+#ifdef GLMATRIX_SSE
+	__m128 offset = _mm_mul_ps(_mm_loadu_ps(&m[0]), _mm_set1_ps(x));
+	offset = _mm_add_ps(offset, _mm_mul_ps(_mm_loadu_ps(&m[4]), _mm_set1_ps(y)));
+	offset = _mm_add_ps(offset, _mm_mul_ps(_mm_loadu_ps(&m[8]), _mm_set1_ps(z)));
+	_mm_storeu_ps(&m[12], _mm_add_ps(_mm_loadu_ps(&m[12]), offset));
+#else
+	for(int row = 0; row < 4; row++)
+		m[12 + row] += m[row] * x + m[4 + row] * y + m[8 + row] * z;
+#endif
+}
+
+//Multiplies the matrix by a rotation matrix, like glRotatef
+void GLMatrix::rotate(float angle, float x, float y, float z)
+{
+	GLMatrix rotation;
+	float length = sqrtf(x * x + y * y + z * z);
+	if(length == 0.0f)
+		return;
+
+	x /= length;
+	y /= length;
+	z /= length;
+
+	float c = cosf(angle * PI / 180.0f);
+	float s = sinf(angle * PI / 180.0f);
+	float t = 1.0f - c;
+
+	rotation.m[0] = x * x * t + c;
+	rotation.m[1] = y * x * t + z * s;
+	rotation.m[2] = x * z * t - y * s;
+	rotation.m[4] = x * y * t - z * s;
+	rotation.m[5] = y * y * t + c;
+	rotation.m[6] = y * z * t + x * s;
+	rotation.m[8] = x * z * t + y * s;
+	rotation.m[9] = y * z * t - x * s;
+	rotation.m[10] = z * z * t + c;
+
+	multiply(rotation);
+}
+
+//Multiplies the matrix by a scaling matrix, like glScalef
+void GLMatrix::scale(float x, float y, float z)
+{
+#ifdef GLMATRIX_SSE
+	_mm_storeu_ps(&m[0], _mm_mul_ps(_mm_loadu_ps(&m[0]), _mm_set1_ps(x)));
+	_mm_storeu_ps(&m[4], _mm_mul_ps(_mm_loadu_ps(&m[4]), _mm_set1_ps(y)));
+	_mm_storeu_ps(&m[8], _mm_mul_ps(_mm_loadu_ps(&m[8]), _mm_set1_ps(z)));
+#else
+	for(int row = 0; row < 4; row++) {
+		m[row] *= x;
+		m[4 + row] *= y;
+		m[8 + row] *= z;
+	}
+#endif
+}
+
+//Replaces the matrix with a perspective matrix, like glFrustum
+void GLMatrix::frustum(float left, float right, float bottom, float top, float near_clip, float far_clip)
+{
+	memset(m, 0, sizeof(m));
+	m[0] = 2.0f * near_clip / (right - left);
+	m[5] = 2.0f * near_clip / (top - bottom);
+	m[8] = (right + left) / (right - left);
+	m[9] = (top + bottom) / (top - bottom);
+	m[10] = -(far_clip + near_clip) / (far_clip - near_clip);
+	m[11] = -1.0f;
+	m[14] = -2.0f * far_clip * near_clip / (far_clip - near_clip);
+}
+
+//Transforms a point, result holds x, y, z and w
+void GLMatrix::transform(float *result, float x, float y, float z, float w) const
+{
+#ifdef GLMATRIX_SSE
+	__m128 sum = _mm_mul_ps(_mm_loadu_ps(&m[0]), _mm_set1_ps(x));
+	sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(&m[4]), _mm_set1_ps(y)));
+	sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(&m[8]), _mm_set1_ps(z)));
+	sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(&m[12]), _mm_set1_ps(w)));
+	_mm_storeu_ps(result, sum);
+#else
+	for(int row = 0; row < 4; row++)
+		result[row] = m[row] * x + m[4 + row] * y + m[8 + row] * z + m[12 + row] * w;
+#endif
+}
@@ -0,0 +1,58 @@
+/*----------------------------------------------------------------------------*\
+|A 4x4 matrix stored column major like OpenGL. Lets the host follow the        |
+|transforms it sends so it knows where geometry ends up on the wall.           |
+|                                                                              |
+|Stewart Hall                                                                  |
+|10/17/2026                                                                    |
+\*----------------------------------------------------------------------------*/
+
+#ifndef GLMATRIX_H
+#define GLMATRIX_H
+
+//Work on whole columns with SSE on x86 and x64. MSVC takes the intrinsics
+//without /arch:SSE, and the loads and stores don't need aligned matrices
+#if defined(__SSE__) || defined(_M_X64) || defined(_M_IX86)
+#define GLMATRIX_SSE
+#endif
+
+class GLMatrix
+{
+public:
+	//Elements in column major order
+	float m[16];
+
+	GLMatrix();
+
+	//Replaces the matrix with the identity matrix
+	void identity();
+
+	//Replaces the matrix with 16 elements in column major order, like
+	//glLoadMatrixf
+	void load(const float *elements);
+
+	//Returns true if the matrix is the identity matrix
+	bool isIdentity() const;
+
+	//Returns true if the bottom row of the matrix is 0, 0, 0, 1
+	bool isAffine() const;
+
+	//Multiplies the matrix by another one on the right
+	void multiply(const GLMatrix &other);
+
+	//Multiplies the matrix by a translation matrix, like glTranslatef
+	void translate(float x, float y, float z);
+
+	//Multiplies the matrix by a rotation matrix, like glRotatef
+	void rotate(float angle, float x, float y, float z);
+
+	//Multiplies the matrix by a scaling matrix, like glScalef
+	void scale(float x, float y, float z);
+
+	//Replaces the matrix with a perspective matrix, like glFrustum
+	void frustum(float left, float right, float bottom, float top, float near_clip, float far_clip);
+
+	//Transforms a point, result holds x, y, z and w
+	void transform(float *result, float x, float y, float z, float w) const;
+};
+
+#endif
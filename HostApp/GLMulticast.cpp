@@ -0,0 +1,252 @@
+/*----------------------------------------------------------------------------*\
+|Sends the command stream once to every node through a UDP multicast group.   |
+|Frames are split into numbered fragments and kept for a while so fragments   |
+|that a node reports missing can be sent again.                                |
+|                                                                              |
+|Stewart Hall                                                                  |
+|10/17/2026                                                                    |
+\*----------------------------------------------------------------------------*/
+
+#ifndef CAPTUREDLL
+#include <ws2tcpip.h>
+#endif
+
+#include "GLMulticast.h"
+
+//Entry point for the sender thread
+static void MulticastShell(void *param)
+{
+	((GLMulticast*)param)->senderMain();
+}
+
+//Constructor
+GLMulticast::GLMulticast(char *i_group, int i_port, char *i_interface, int i_ttl, BOOL i_loopback, int i_drop_rate)
+{
+	group = i_group;
+	port = i_port;
+	interface_address = i_interface;
+	ttl = i_ttl;
+	loopback = i_loopback;
+	drop_rate = i_drop_rate;
+
+	multicast_sock = INVALID_SOCKET;
+	sender = NULL;
+	work_event = new GLEvent();
+	space_event = new GLEvent();
+	running = 0;
+
+	for(int i = 0; i < MULTICAST_HISTORY; i++) {
+		history[i] = NULL;
+		history_frame[i] = 0;
+	}
+	history_lock = new GLLock();
+	next_frame = 0;
+
+	datagrams_sent = 0;
+	datagrams_dropped = 0;
+	retransmits = 0;
+}
+
+//Destructor
+GLMulticast::~GLMulticast()
+{
+	for(int i = 0; i < MULTICAST_HISTORY; i++) {
+		if(history[i])
+			history[i]->release();
+	}
+
+	delete history_lock;
+	delete work_event;
+	delete space_event;
+}
+
+//Creates the socket and starts the sender thread
+int GLMulticast::open()
+{
+	multicast_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if(multicast_sock == INVALID_SOCKET) {
+		printf("Error %d occurred!\n",  WSAGetLastError());
+		return -1;
+	}
+
+	//Choose the interface, time to live and loopback of outgoing datagrams
+	in_addr iface;
+	iface.s_addr = inet_addr(interface_address);
+	if(setsockopt(multicast_sock, IPPROTO_IP, IP_MULTICAST_IF, (char*)&iface, sizeof(iface)) == SOCKET_ERROR ||
+		setsockopt(multicast_sock, IPPROTO_IP, IP_MULTICAST_TTL, (char*)&ttl, sizeof(ttl)) == SOCKET_ERROR ||
+		setsockopt(multicast_sock, IPPROTO_IP, IP_MULTICAST_LOOP, (char*)&loopback, sizeof(loopback)) == SOCKET_ERROR) {
+		printf("Error %d occurred!\n",  WSAGetLastError());
+		return -1;
+	}
+
+	//Start the thread that sends queued frames
+	running = 1;
+	sender = new GLThread(MulticastShell, this);
+	if(!sender->start()) {
+		printf("Could not start multicast sender thread\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+//Sends everything queued and closes the socket
+void GLMulticast::close()
+{
+	if(sender) {
+		atomicStore(&running, 0);
+		work_event->signal();
+		sender->join();
+		delete sender;
+		sender = NULL;
+	}
+
+	if(multicast_sock != INVALID_SOCKET) {
+		closesocket(multicast_sock);
+		multicast_sock = INVALID_SOCKET;
+	}
+}
+
+//Queues a frame for the sender thread, holding a reference until sent
+int GLMulticast::queueFrame(GLFrame *frame)
+{
+	frame->addReference();
+
+	//Wait for the sender thread to make room if it is behind
+	while(!queue.push(frame))
+		space_event->wait(1);
+
+	work_event->signal();
+	return 0;
+}
+
+//Sends queued frames until closed, runs on the sender thread
+void GLMulticast::senderMain()
+{
+	GLFrame *frame;
+	GLFrame *evicted;
+	unsigned int sequence;
+	unsigned int fragments;
+
+	for(;;) {
+		if(!queue.pop(&frame)) {
+			//Exit once closed and everything has been sent
+			if(!atomicLoad(&running)) {
+				if(queue.count() == 0)
+					break;
+				continue;
+			}
+
+			work_event->wait(WAIT_FOREVER);
+			continue;
+		}
+		space_event->signal();
+
+		//Number the frame and keep it for retransmission, the queue's
+		//reference now belongs to the history
+		history_lock->lock();
+		sequence = next_frame++;
+		evicted = history[sequence % MULTICAST_HISTORY];
+		history[sequence % MULTICAST_HISTORY] = frame;
+		history_frame[sequence % MULTICAST_HISTORY] = sequence;
+		history_lock->unlock();
+
+		if(evicted)
+			evicted->release();
+
+		fragments = multicastFragments(frame->length);
+		for(unsigned int i = 0; i < fragments; i++) {
+			//Simulate packet loss for testing
+			if(drop_rate > 0 && (datagrams_sent + datagrams_dropped) % drop_rate == drop_rate - 1) {
+				datagrams_dropped++;
+				continue;
+			}
+
+			sendFragment(frame, sequence, i);
+		}
+	}
+}
+
+//Sends one fragment of a frame to the group
+int GLMulticast::sendFragment(GLFrame *frame, unsigned int sequence, unsigned int fragment)
+{
+	MulticastHeader header;
+	WSABUF buffers[2];
+	DWORD sent;
+
+	header.magic = MULTICAST_MAGIC;
+	header.frame = sequence;
+	header.fragment = fragment;
+	header.fragments = multicastFragments(frame->length);
+	header.length = frame->length;
+
+	//Send the header and the slice of the frame without copying them together
+	buffers[0].buf = (char*)&header;
+	buffers[0].len = sizeof(MulticastHeader);
+	buffers[1].buf = &frame->data[fragment * MULTICAST_PAYLOAD_SIZE];
+	buffers[1].len = frame->length - fragment * MULTICAST_PAYLOAD_SIZE;
+	if(buffers[1].len > MULTICAST_PAYLOAD_SIZE)
+		buffers[1].len = MULTICAST_PAYLOAD_SIZE;
+
+	sockaddr_in anews;
+	anews.sin_port = htons(port);
+	anews.sin_addr.S_un.S_addr = inet_addr(group);
+	anews.sin_family = AF_INET;
+	if(WSASendTo(multicast_sock, buffers, 2, &sent, 0, (sockaddr*)&anews, sizeof(anews), NULL, NULL) == SOCKET_ERROR) {
+		printf("Error %d occurred!\n",  WSAGetLastError());
+		return -1;
+	}
+
+	atomicIncrement(&datagrams_sent);
+	return 0;
+}
+
+//Sends a fragment again after a node reported it missing
+void GLMulticast::retransmit(unsigned int sequence, unsigned int fragment)
+{
+	GLFrame *frame = NULL;
+
+	//Hold on to the frame while sending in case it is evicted meanwhile
+	history_lock->lock();
+	if(history[sequence % MULTICAST_HISTORY] && history_frame[sequence % MULTICAST_HISTORY] == sequence) {
+		frame = history[sequence % MULTICAST_HISTORY];
+		frame->addReference();
+	}
+	history_lock->unlock();
+
+	if(!frame) {
+		printf("Frame %u is no longer available for retransmission\n", sequence);
+		return;
+	}
+
+	if(fragment == MULTICAST_ALL_FRAGMENTS) {
+		unsigned int fragments = multicastFragments(frame->length);
+		for(unsigned int i = 0; i < fragments; i++)
+			sendFragment(frame, sequence, i);
+		retransmits += fragments;
+	} else if(fragment < multicastFragments(frame->length)) {
+		sendFragment(frame, sequence, fragment);
+		retransmits++;
+	}
+
+	frame->release();
+}
+
+//Prints out configuration and transmission statistics
+void GLMulticast::printStatus()
+{
+	printf("Multicast configuration and status:\n");
+	printf("\tGroup: %s:%d\n", group, port);
+	printf("\tInterface: %s\n", interface_address);
+	printf("\tFrames sent: %u\n", next_frame);
+	printf("\tDatagrams sent: %ld\n", datagrams_sent);
+	printf("\tDatagrams dropped for testing: %ld\n", datagrams_dropped);
+	printf("\tFragments retransmitted: %ld\n", retransmits);
+}
+
+//Prints out a one line summary of transmission statistics
+void GLMulticast::printStats()
+{
+	printf("Multicast: %ld datagrams sent, %ld dropped for testing, %ld retransmitted\n",
+		datagrams_sent, datagrams_dropped, retransmits);
+}
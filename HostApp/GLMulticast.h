@@ -0,0 +1,98 @@
+/*----------------------------------------------------------------------------*\
+|Sends the command stream once to every node through a UDP multicast group.   |
+|Frames are split into numbered fragments and kept for a while so fragments   |
+|that a node reports missing can be sent again.                                |
+|                                                                              |
+|Stewart Hall                                                                  |
+|10/17/2026                                                                    |
+\*----------------------------------------------------------------------------*/
+
+#ifndef GLMULTICAST_H
+#define GLMULTICAST_H
+
+#include "GLPipe.h"
+#include "GLProtocol.h"
+
+//Number of recently sent frames kept for retransmission
+#define MULTICAST_HISTORY 256
+
+class GLMulticast
+{
+private:
+	//Group address and port
+	char *group;
+	int port;
+
+	//Address of the interface to send from
+	char *interface_address;
+
+	//Time to live of datagrams, 1 keeps them on the local network
+	int ttl;
+
+	//Should datagrams be looped back to nodes on this machine
+	BOOL loopback;
+
+	//Drop one out of this many datagrams to exercise retransmission, 0 to disable
+	int drop_rate;
+
+	//Socket to send datagrams over
+	SOCKET multicast_sock;
+
+	//Frames waiting to be sent by the sender thread
+	GLRing<GLFrame*, PIPE_QUEUE_SIZE> queue;
+
+	//Thread that fragments and sends queued frames
+	GLThread *sender;
+
+	//Signalled when frames are queued and when queue space frees up
+	GLEvent *work_event;
+	GLEvent *space_event;
+
+	//Non-zero while the sender thread should keep running
+	volatile long running;
+
+	//Recently sent frames and their sequence numbers
+	GLFrame *history[MULTICAST_HISTORY];
+	unsigned int history_frame[MULTICAST_HISTORY];
+
+	//Protects the history, it is read when nodes ask for retransmits
+	GLLock *history_lock;
+
+	//Sequence number of the next frame to send
+	unsigned int next_frame;
+
+	//Statistics, retransmits are only counted by the backchannel thread
+	volatile long datagrams_sent;
+	long datagrams_dropped;
+	long retransmits;
+
+	//Sends one fragment of a frame to the group
+	int sendFragment(GLFrame *frame, unsigned int sequence, unsigned int fragment);
+
+public:
+	GLMulticast(char *i_group, int i_port, char *i_interface, int i_ttl, BOOL i_loopback, int i_drop_rate);
+	~GLMulticast();
+
+	//Creates the socket and starts the sender thread
+	int open();
+
+	//Sends everything queued and closes the socket
+	void close();
+
+	//Queues a frame for the sender thread, holding a reference until sent
+	int queueFrame(GLFrame *frame);
+
+	//Sends queued frames until closed, runs on the sender thread
+	void senderMain();
+
+	//Sends a fragment again after a node reported it missing
+	void retransmit(unsigned int sequence, unsigned int fragment);
+
+	//Prints out configuration and transmission statistics
+	void printStatus();
+
+	//Prints out a one line summary of transmission statistics
+	void printStats();
+};
+
+#endif
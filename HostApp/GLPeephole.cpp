@@ -0,0 +1,418 @@
+/*----------------------------------------------------------------------------*\
+|Peephole pass over each frame the host sends. Takes out commands that leave   |
+|the nodes as they were, state set to the value it already has and transforms |
+|overwritten before anything is drawn, and joins glBegin/glEnd runs that could |
+|have been one. What each command does is looked up in a table by opcode.      |
+|                                                                              |
+|Stewart Hall                                                                  |
+|10/17/2026                                                                    |
+\*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "GLPeephole.h"
+
+//Primitive modes of glBegin, GL_POINTS and friends
+#define PEEPHOLE_POINTS 0x0000
+#define PEEPHOLE_LINES 0x0001
+#define PEEPHOLE_TRIANGLES 0x0004
+#define PEEPHOLE_QUADS 0x0007
+
+struct PeepholeRule
+{
+	//What the command does
+	unsigned char role;
+
+	//State value it sets, or the one a block's colors leave undefined
+	unsigned char state;
+
+	//Set if two runs can still be joined across it
+	unsigned char joinable;
+};
+
+//What each command does, indexed by opcode
+#define GL_COMMAND_RULE(opcode, name, masks, integers, floats, flags, handler, role, state, joinable) \
+	{PEEPHOLE_##role, PEEPHOLE_##state, joinable},
+static const PeepholeRule peephole_rules[OPCODE_COUNT] = {
+	GL_COMMANDS(GL_COMMAND_RULE)
+};
+
+//Returns the vertices each primitive of a mode takes, or 0 if two runs in the
+//mode can't be joined into one
+static unsigned int primitiveVertices(unsigned int mode)
+{
+	switch(mode) {
+	case PEEPHOLE_POINTS:
+		return 1;
+	case PEEPHOLE_LINES:
+		return 2;
+	case PEEPHOLE_TRIANGLES:
+		return 3;
+	case PEEPHOLE_QUADS:
+		return 4;
+	}
+
+	//Strips, fans, loops and polygons connect every vertex of a run
+	return 0;
+}
+
+//Constructor
+GLPeephole::GLPeephole()
+{
+	commands = NULL;
+	command_count = 0;
+	command_capacity = 0;
+	transforms = NULL;
+	transform_count = 0;
+
+	memset(&stats, 0, sizeof(stats));
+	reset();
+}
+
+//Destructor
+GLPeephole::~GLPeephole()
+{
+	delete[] commands;
+	delete[] transforms;
+}
+
+//Forgets what the nodes have, for a new stream
+void GLPeephole::reset()
+{
+	for(int i = 0; i < PEEPHOLE_STATES; i++) {
+		state_known[i] = false;
+		state_length[i] = 0;
+	}
+
+	forgetPending();
+	frame_commands_removed = 0;
+	frame_bytes_removed = 0;
+}
+
+//Forgets the transforms waiting for a draw and the run that could be joined
+void GLPeephole::forgetPending()
+{
+	transform_count = 0;
+	batch_mode = -1;
+	batch_vertices = 0;
+	batch_end = -1;
+}
+
+//Reads the command at offset, returns false if it isn't a known command
+bool GLPeephole::readCommand(const char *data, unsigned int offset, unsigned int revision, PeepholeCommand *command)
+{
+	unsigned int pointer = offset;
+	unsigned int value;
+	int id;
+
+	if(revision >= PROTOCOL_REVISION_2) {
+		id = (unsigned char)data[pointer++];
+	} else {
+		memcpy(&id, &data[pointer], sizeof(int));
+		pointer += sizeof(int);
+	}
+
+	if(id < 0 || id >= OPCODE_COUNT)
+		return false;
+
+	command->offset = offset;
+	command->id = id;
+	command->arguments = pointer;
+	command->removed = false;
+
+	//Fixed arguments are described by the command table
+	const GLCommandInfo *info = &gl_commands[id];
+	for(int i = 0; i < info->masks; i++) {
+		if(revision >= PROTOCOL_REVISION_2) {
+			if((unsigned char)data[pointer++] == CLEAR_MASK_RAW)
+				pointer += decodeVarint(&data[pointer], &value);
+		} else {
+			pointer += sizeof(unsigned int);
+		}
+	}
+	for(int i = 0; i < info->integers; i++) {
+		if(revision >= PROTOCOL_REVISION_2) {
+			pointer += decodeVarint(&data[pointer], &value);
+		} else {
+			memcpy(&value, &data[pointer], sizeof(unsigned int));
+			pointer += sizeof(unsigned int);
+		}
+		command->integers[i] = value;
+	}
+	pointer += info->floats * sizeof(float);
+
+	//Vertex blocks carry data after them, sized by their count and flags, a
+	//store carries a whole block and an instanced draw matrices and a draw
+	if(id == PACKED_VERTICES) {
+		pointer += command->integers[1] * packedVertexFloats(command->integers[2]) * sizeof(float);
+	} else if(id == COMPACT_VERTICES) {
+		pointer += compactDataSize(command->integers[1], command->integers[2]);
+	} else if(id == OPCODE_CacheStore || id == OPCODE_DrawInstances) {
+		PeepholeCommand block;
+		if(id == OPCODE_DrawInstances)
+			pointer += command->integers[0] * instanceMatrixFloats(command->integers[1]) * sizeof(float);
+		if(!readCommand(data, pointer, revision, &block))
+			return false;
+		pointer += block.length;
+	}
+
+	command->length = pointer - offset;
+	return true;
+}
+
+//Takes a command out and counts it
+void GLPeephole::remove(int index)
+{
+	commands[index].removed = true;
+	frame_commands_removed++;
+	frame_bytes_removed += commands[index].length;
+	stats.commands_removed++;
+	stats.bytes_removed += commands[index].length;
+}
+
+//Takes out what it can of a frame encoded with a protocol revision, before it
+//is sent
+void GLPeephole::optimize(GLFrame *frame, unsigned int revision)
+{
+	unsigned int offset = 0;
+	int range = 0;
+
+	//Find every command first, the frame is only changed if all of it is
+	//understood
+	command_count = 0;
+	while(offset < frame->length) {
+		if(command_count == command_capacity) {
+			int capacity = command_capacity ? command_capacity * 2 : 1024;
+			PeepholeCommand *grown = new PeepholeCommand[capacity];
+			if(commands)
+				memcpy(grown, commands, command_count * sizeof(PeepholeCommand));
+			delete[] commands;
+			delete[] transforms;
+			commands = grown;
+			transforms = new int[capacity];
+			command_capacity = capacity;
+		}
+
+		if(!readCommand(frame->data, offset, revision, &commands[command_count]))
+			break;
+		offset += commands[command_count].length;
+		command_count++;
+	}
+
+	if(offset != frame->length) {
+		printf("Peephole pass found a command it doesn't know, sending the frame as it is\n");
+		reset();
+		return;
+	}
+
+	stats.commands_in += command_count;
+	stats.bytes_in += frame->length;
+
+	//Earlier frames have gone out, only the state values carry over
+	forgetPending();
+
+	for(int i = 0; i < command_count; i++) {
+		PeepholeCommand *command = &commands[i];
+		const PeepholeRule *rule = &peephole_rules[command->id];
+
+		//Commands some nodes skip only change what the others have
+		while(range < frame->culled_count && frame->culled[range].offset + frame->culled[range].length <= command->offset)
+			range++;
+		bool culled = range < frame->culled_count && frame->culled[range].offset <= command->offset;
+
+		//Anything but a color between two runs keeps them apart
+		if(!rule->joinable && rule->role != PEEPHOLE_BEGIN)
+			batch_end = -1;
+
+		switch(rule->role) {
+		case PEEPHOLE_STATE: {
+			const char *value = &frame->data[command->arguments];
+			unsigned int length = command->offset + command->length - command->arguments;
+			int slot = rule->state;
+
+			if(slot == PEEPHOLE_NONE) {
+				//Sets nothing the pass follows
+			} else if(state_known[slot] && state_length[slot] == length && !memcmp(state[slot], value, length)) {
+				//Every node already has this value
+				remove(i);
+			} else if(culled || length > PEEPHOLE_STATE_SIZE) {
+				state_known[slot] = false;
+			} else {
+				memcpy(state[slot], value, length);
+				state_length[slot] = length;
+				state_known[slot] = true;
+			}
+			break;
+		}
+		case PEEPHOLE_TRANSFORM:
+			if(culled)
+				transform_count = 0;
+			else
+				transforms[transform_count++] = i;
+			break;
+		case PEEPHOLE_LOAD:
+			if(culled) {
+				transform_count = 0;
+				break;
+			}
+
+			//Nothing was drawn with the matrix this replaces
+			for(int j = 0; j < transform_count; j++)
+				remove(transforms[j]);
+			transforms[0] = i;
+			transform_count = 1;
+			break;
+		case PEEPHOLE_BEGIN:
+			transform_count = 0;
+
+			//The last run carries on, so its glEnd and this glBegin go
+			if(batch_end >= 0 && !culled && (int)command->integers[0] == batch_mode) {
+				remove(batch_end);
+				remove(i);
+				batch_end = -1;
+				stats.batches_merged++;
+				break;
+			}
+
+			batch_end = -1;
+			batch_vertices = 0;
+			if(culled || primitiveVertices(command->integers[0]) == 0)
+				batch_mode = -1;
+			else
+				batch_mode = (int)command->integers[0];
+			break;
+		case PEEPHOLE_VERTEX:
+			batch_vertices++;
+			break;
+		case PEEPHOLE_END:
+			//Only a run of whole primitives seen by every node can be joined
+			if(batch_mode >= 0 && !culled && batch_vertices % primitiveVertices(batch_mode) == 0)
+				batch_end = i;
+			break;
+		case PEEPHOLE_BLOCK:
+			transform_count = 0;
+			if((command->integers[2] & PACKED_VERTICES_COLORS) && rule->state != PEEPHOLE_NONE)
+				state_known[rule->state] = false;
+			break;
+		case PEEPHOLE_CACHED:
+			transform_count = 0;
+			if(rule->state != PEEPHOLE_NONE)
+				state_known[rule->state] = false;
+			break;
+		case PEEPHOLE_FRAME:
+			forgetPending();
+			break;
+		case PEEPHOLE_OTHER:
+			break;
+		default:
+			forgetPending();
+			for(int j = 0; j < PEEPHOLE_STATES; j++)
+				state_known[j] = false;
+			break;
+		}
+	}
+
+	compact(frame);
+
+	//Count what came out of each displayed frame
+	if(frame->frame_end >= 0) {
+		stats.frames++;
+		stats.last_commands_removed = frame_commands_removed;
+		stats.last_bytes_removed = frame_bytes_removed;
+		frame_commands_removed = 0;
+		frame_bytes_removed = 0;
+	}
+}
+
+//Moves an offset back by the bytes of the removed commands before it. Offsets
+//have to be asked for in order, cursor and shift carry the walk between calls
+static unsigned int moveOffset(const PeepholeCommand *commands, int count, unsigned int offset, int *cursor, unsigned int *shift)
+{
+	while(*cursor < count && commands[*cursor].offset < offset) {
+		if(commands[*cursor].removed)
+			*shift += commands[*cursor].length;
+		(*cursor)++;
+	}
+
+	return offset - *shift;
+}
+
+//Moves ranges with the commands they cover, dropping ranges left empty and
+//their masks if they have them
+static void moveRanges(const PeepholeCommand *commands, int count, CulledRange *ranges, int *range_count, unsigned int *masks, int words)
+{
+	int cursor = 0;
+	unsigned int shift = 0;
+	int kept = 0;
+
+	for(int i = 0; i < *range_count; i++) {
+		unsigned int start = moveOffset(commands, count, ranges[i].offset, &cursor, &shift);
+		unsigned int end = moveOffset(commands, count, ranges[i].offset + ranges[i].length, &cursor, &shift);
+
+		if(end == start)
+			continue;
+
+		//Ranges without masks that now touch are kept as one
+		if(!masks && kept > 0 && ranges[kept - 1].offset + ranges[kept - 1].length == start) {
+			ranges[kept - 1].length += end - start;
+			continue;
+		}
+
+		ranges[kept].offset = start;
+		ranges[kept].length = end - start;
+		if(masks && kept != i)
+			memmove(&masks[kept * words], &masks[i * words], words * sizeof(unsigned int));
+		kept++;
+	}
+
+	*range_count = kept;
+}
+
+//Closes the gaps left by removed commands and moves the frame's ranges with
+//the commands they cover
+void GLPeephole::compact(GLFrame *frame)
+{
+	unsigned int length = 0;
+
+	for(int i = 0; i < command_count; i++) {
+		if(commands[i].removed)
+			continue;
+		if(length != commands[i].offset)
+			memmove(&frame->data[length], &frame->data[commands[i].offset], commands[i].length);
+		length += commands[i].length;
+	}
+
+	if(length == frame->length)
+		return;
+
+	moveRanges(commands, command_count, frame->culled, &frame->culled_count, frame->culled_masks, frame->mask_words);
+	moveRanges(commands, command_count, frame->droppable, &frame->droppable_count, NULL, 0);
+
+	if(frame->frame_end >= 0) {
+		int cursor = 0;
+		unsigned int shift = 0;
+		frame->frame_end = (int)moveOffset(commands, command_count, (unsigned int)frame->frame_end, &cursor, &shift);
+	}
+
+	frame->length = length;
+}
+
+//Returns how much the pass took out
+PeepholeStats GLPeephole::getStats()
+{
+	return stats;
+}
+
+//Prints out the commands and bytes taken out
+void GLPeephole::printStats()
+{
+	printf("Peephole: %llu of %llu commands (%.1f%%) and %llu of %llu bytes (%.1f%%) taken out, %u runs joined\n",
+		stats.commands_removed, stats.commands_in, stats.commands_in ? 100.0 * stats.commands_removed / stats.commands_in : 0.0,
+		stats.bytes_removed, stats.bytes_in, stats.bytes_in ? 100.0 * stats.bytes_removed / stats.bytes_in : 0.0,
+		stats.batches_merged);
+	printf("Peephole: last frame %u commands and %u bytes taken out, %.1f commands and %.1f bytes per frame\n",
+		stats.last_commands_removed, stats.last_bytes_removed,
+		stats.frames ? (double)stats.commands_removed / stats.frames : 0.0,
+		stats.frames ? (double)stats.bytes_removed / stats.frames : 0.0);
+}
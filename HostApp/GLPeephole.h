@@ -0,0 +1,122 @@
+/*----------------------------------------------------------------------------*\
+|Peephole pass over each frame the host sends. Takes out commands that leave   |
+|the nodes as they were, state set to the value it already has and transforms |
+|overwritten before anything is drawn, and joins glBegin/glEnd runs that could |
+|have been one. What each command does is looked up in a table by opcode.      |
+|                                                                              |
+|Stewart Hall                                                                  |
+|10/17/2026                                                                    |
+\*----------------------------------------------------------------------------*/
+
+#ifndef GLPEEPHOLE_H
+#define GLPEEPHOLE_H
+
+#include "GLProtocol.h"
+#include "GLFrame.h"
+
+//Number of state values the pass follows, every one before PEEPHOLE_NONE,
+//and the most argument bytes one takes
+#define PEEPHOLE_STATES PEEPHOLE_NONE
+#define PEEPHOLE_STATE_SIZE 16
+
+//How much the pass took out
+struct PeepholeStats
+{
+	//Displayed frames passed over
+	unsigned int frames;
+
+	//Commands and bytes looked at and taken out, over every frame
+	unsigned long long commands_in;
+	unsigned long long commands_removed;
+	unsigned long long bytes_in;
+	unsigned long long bytes_removed;
+
+	//Commands and bytes taken out of the last displayed frame
+	unsigned int last_commands_removed;
+	unsigned int last_bytes_removed;
+
+	//glBegin/glEnd runs joined to the run before them
+	unsigned int batches_merged;
+};
+
+//A command found in a frame
+struct PeepholeCommand
+{
+	//Where it starts, how many bytes it takes and its opcode
+	unsigned int offset;
+	unsigned int length;
+	int id;
+
+	//Where its fixed arguments start, and its enums and unsigned integers
+	unsigned int arguments;
+	unsigned int integers[3];
+
+	//Set when the pass takes it out
+	bool removed;
+};
+
+class GLPeephole
+{
+private:
+	//Commands of the frame being passed over
+	PeepholeCommand *commands;
+	int command_count;
+	int command_capacity;
+
+	//Value every node has for each state, as its encoded arguments, and
+	//whether it is known
+	char state[PEEPHOLE_STATES][PEEPHOLE_STATE_SIZE];
+	unsigned int state_length[PEEPHOLE_STATES];
+	bool state_known[PEEPHOLE_STATES];
+
+	//Transforms since the matrix was last drawn with, taken out if a matrix
+	//load replaces them first
+	int *transforms;
+	int transform_count;
+
+	//Primitive mode and vertices of the run since the last glBegin, mode is
+	//-1 outside a run the pass can join
+	int batch_mode;
+	unsigned int batch_vertices;
+
+	//The glEnd of the last run if the next glBegin can join it, or -1
+	int batch_end;
+
+	//Commands and bytes taken out of the displayed frame being sent
+	unsigned int frame_commands_removed;
+	unsigned int frame_bytes_removed;
+
+	PeepholeStats stats;
+
+	//Reads the command at offset, returns false if it isn't a known command
+	bool readCommand(const char *data, unsigned int offset, unsigned int revision, PeepholeCommand *command);
+
+	//Takes a command out and counts it
+	void remove(int index);
+
+	//Forgets the transforms waiting for a draw and the run that could be joined
+	void forgetPending();
+
+	//Closes the gaps left by removed commands and moves the frame's ranges
+	//with the commands they cover
+	void compact(GLFrame *frame);
+
+public:
+	GLPeephole();
+	~GLPeephole();
+
+	//Forgets what the nodes have, for a new stream
+	void reset();
+
+	//Takes out what it can of a frame encoded with a protocol revision,
+	//before it is sent
+	void optimize(GLFrame *frame, unsigned int revision);
+
+	//Returns how much the pass took out
+	PeepholeStats getStats();
+
+	//Prints out the commands and bytes taken out
+	void printStats();
+};
+
+#endif
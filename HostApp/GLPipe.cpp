@@ -6,8 +6,60 @@
 |11/26/2012                                                                    |
 \*----------------------------------------------------------------------------*/
 
+#include <math.h>
+#include <string.h>
+
 #include "GLPipe.h"
 
+//A gathered send of several frames in flight on the socket
+struct PipeSend
+{
+	WSAOVERLAPPED overlapped;
+
+	//Frames in the send
+	GLFrame *frames[PIPE_GATHER_SIZE];
+	int count;
+
+	//Length sent ahead of each frame when the node takes length prefixes
+	unsigned int prefixes[PIPE_GATHER_SIZE];
+
+	//Parts of the frames to send, frames with culled ranges take several
+	WSABUF *buffers;
+	int buffer_count;
+	int buffer_capacity;
+
+	//Set once the send port has collected the send's completion
+	BOOL done;
+};
+
+//Entry point for the sender thread
+static void SenderShell(void *param)
+{
+	((GLPipe*)param)->senderMain();
+}
+
+//Returns TRUE if an address belongs to this machine
+static BOOL isLocalAddress(char *address)
+{
+	unsigned long target = inet_addr(address);
+	char name[256];
+	hostent *host;
+
+	//Anything on the loopback network
+	if((ntohl(target) >> 24) == 127)
+		return TRUE;
+
+	//Or one of the addresses of this machine's own interfaces
+	if(gethostname(name, sizeof(name)) == 0 && (host = gethostbyname(name)) != NULL) {
+		for(int i = 0; host->h_addr_list[i]; i++) {
+			if(*(unsigned long*)host->h_addr_list[i] == target)
+				return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
 //Constructor
 GLPipe::GLPipe(int h_width, int h_height, int width, int height, int x_off, int y_off, int x_loc, int y_loc, int dev, int n_port, char *name)
 {
@@ -23,11 +75,96 @@ GLPipe::GLPipe(int h_width, int h_height, int width, int height, int x_off, int
 	device_id = dev;
 	port = n_port;
 	node_identifier = name;
+
+	index = 0;
+	connect_timeout = CONNECT_TIMEOUT;
+	connect_retries = CONNECT_RETRIES;
+	connect_start = 0;
+	connect_done = 0;
+	handshake_done = 0;
+	connect_attempts = 0;
+	features = 0;
+	revision = PROTOCOL_REVISION_1;
+	bytes_sent = 0;
+	bytes_culled = 0;
+
+	clock_samples = 0;
+	clock_offset = 0;
+	clock_rtt = 0;
+	clock_lock = new GLLock();
+
+	//Work out the same frustum the node sets up in ReSizeGLScene
+	float aspect = (float)host_width / (float)host_height;
+	float full_width = 2.0f * tan(VIEW_FOV * 3.14159265f / 180.0f) * VIEW_NEAR_CLIP;
+	float full_height = full_width / aspect;
+	float left = (float)x_offset / (float)host_width - 0.5f;
+	float right = left + (float)win_width / (float)host_width;
+	float top = -1.0f * ((float)y_offset / (float)host_height - 0.5f);
+	float bottom = top - (float)win_height / (float)host_height;
+	projection.frustum(left * full_width, right * full_width, bottom * full_height, top * full_height,
+		VIEW_NEAR_CLIP, VIEW_FAR_CLIP);
+
+	sender = NULL;
+	work_event = new GLEvent();
+	space_event = new GLEvent();
+	running = 0;
+	failed = 0;
+
+	sends = new PipeSend[PIPE_SENDS_IN_FLIGHT];
+	for(int i = 0; i < PIPE_SENDS_IN_FLIGHT; i++) {
+		memset(&sends[i].overlapped, 0, sizeof(WSAOVERLAPPED));
+		sends[i].overlapped.hEvent = WSACreateEvent();
+		sends[i].count = 0;
+		sends[i].buffer_capacity = PIPE_GATHER_SIZE;
+		sends[i].buffers = new WSABUF[PIPE_GATHER_SIZE];
+		sends[i].buffer_count = 0;
+		sends[i].done = FALSE;
+	}
+	first_send = 0;
+	sends_in_flight = 0;
+	pipe_sock = INVALID_SOCKET;
+	zero_copy = FALSE;
+	no_delay = TRUE;
+	send_buffer = SOCKET_BUFFER_DEFAULT;
+	receive_buffer = SOCKET_BUFFER_DEFAULT;
+	shared_memory = FALSE;
+	shared_size = SHARED_RING_SIZE;
+	shared_ring = NULL;
+	send_port = NULL;
+
+	pending_capacity = PIPE_GATHER_SIZE;
+	pending = new GLFrame*[pending_capacity];
+	pending_count = 0;
+	frame_start = TRUE;
+	drop_frames = FALSE;
+	skip_length = 0;
+	coalesced = NULL;
+	frames_dropped = 0;
+	bytes_dropped = 0;
+
+	delta_keyframe = DELTA_KEYFRAME_INTERVAL;
+	delta = NULL;
+	delta_pool = NULL;
+	keyframe_requested = 0;
+	keyframe_generation = 0;
 }
 
 //Destructor
 GLPipe::~GLPipe()
 {
+	for(int i = 0; i < PIPE_SENDS_IN_FLIGHT; i++) {
+		WSACloseEvent(sends[i].overlapped.hEvent);
+		delete[] sends[i].buffers;
+	}
+	delete[] sends;
+	delete[] pending;
+	delete shared_ring;
+	delete delta;
+	delete delta_pool;
+
+	delete work_event;
+	delete space_event;
+	delete clock_lock;
 	delete node_identifier;
 }
 
@@ -35,41 +172,285 @@ GLPipe::~GLPipe()
 int GLPipe::connectPipe(char *address)
 {
 	int length = 0;
+	char handshake[HANDSHAKE_SIZE];
+	HandshakeFeatures offer;
+	BackchannelMessage reply;
+	SocketOptions options;
+
+	//Connect to the node, it may not be listening yet so try a few times
+	connect_start = timeMicroseconds();
+	for(connect_attempts = 1; ; connect_attempts++) {
+		pipe_sock = socketConnect(address, port, connect_timeout);
+		if(pipe_sock != INVALID_SOCKET)
+			break;
 
-	//Create the socket
-	pipe_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-	if(pipe_sock == INVALID_SOCKET) {
-		printf("Error %d occurred!\n",  WSAGetLastError());
-		return - 1;
+		if(connect_attempts > connect_retries) {
+			printf("Could not connect to node %s after %d attempts\n", node_identifier, connect_attempts);
+			return -1;
+		}
+		Sleep(CONNECT_RETRY_WAIT);
 	}
+	connect_done = timeMicroseconds();
 
-	//Connect to the node
-	sockaddr_in anews;
-	anews.sin_port = htons(port);
-	anews.sin_addr.S_un.S_addr = inet_addr(address);
-	anews.sin_family = AF_INET;
-	if(connect(pipe_sock, (sockaddr*)&anews, sizeof(anews)) == SOCKET_ERROR) {
-		printf("Error %d occurred!\n",  WSAGetLastError());
-		return -1;
+	//Frames go out as soon as they are queued and the backchannel thread
+	//waits on every socket at once, so nothing should block on one node. With
+	//no socket buffer, overlapped sends go straight from the frames
+	options.no_delay = no_delay ? true : false;
+	options.non_blocking = true;
+	options.send_buffer = zero_copy ? 0 : send_buffer;
+	options.receive_buffer = receive_buffer;
+	socketSetOptions(pipe_sock, &options);
+
+	//Send the name of this pipe's target node for validity check, the
+	//features to use go in the spare bytes after it
+	memset(handshake, 0, HANDSHAKE_SIZE);
+	strncpy(handshake, node_identifier, HANDSHAKE_FEATURES_OFFSET - 1);
+	offer.magic = HANDSHAKE_MAGIC;
+	offer.features = features;
+	offer.revision = revision;
+	offer.node = index;
+	offer.ring = 0;
+	//A node on this machine can take the stream through shared memory, the
+	//ring has to exist before the node sees the handshake. A node still
+	//holding the ring of an earlier connection keeps its own
+	if(shared_memory && isLocalAddress(address)) {
+		char name[64];
+		offer.ring = (unsigned int)timeMicroseconds() ^ (unsigned int)(GetCurrentProcessId() << 20);
+		sprintf(name, SHARED_RING_NAME, port, offer.ring);
+		shared_ring = new GLSharedRing();
+		if(shared_ring->create(name, shared_size)) {
+			offer.features |= FEATURE_SHARED_MEMORY;
+		} else {
+			delete shared_ring;
+			shared_ring = NULL;
+		}
 	}
-	
-	//Send the name of this pipe's target node for validity check
-	if((length = send(pipe_sock, node_identifier, 256, 0)) != 256) {
+	memcpy(&handshake[HANDSHAKE_FEATURES_OFFSET], &offer, sizeof(offer));
+	if((length = socketSend(pipe_sock, handshake, HANDSHAKE_SIZE)) != HANDSHAKE_SIZE) {
 		if(length == SOCKET_ERROR)
-			printf("Error %d occurred!\n",  WSAGetLastError());
+			printf("Error %d occurred!\n",  socketError());
 		else
 			printf("Connection was terminated unexpectedly\n");
 			
 		return -1;
 	}
 
+	//The node answers with the features it accepted. It already has the
+	//connection, so a node that doesn't answer isn't tried again
+	if(receiveMessage(&reply, connect_timeout) < 0) {
+		printf(" during handshake with node %s\n", node_identifier);
+		return -1;
+	}
+	if(reply.type != BACKCHANNEL_FEATURES) {
+		printf("Unexpected handshake reply %u\n", reply.type);
+		return -1;
+	}
+	features &= reply.args[0];
+	if(reply.args[1] < revision)
+		revision = reply.args[1];
+
+	//Each chunk goes out as edits of the last frame the node got
+	if(features & FEATURE_DELTA_FRAMES) {
+		delta = new GLDeltaEncoder(delta_keyframe);
+		delta_pool = new GLFramePool(DELTA_FRAME_SIZE);
+	}
+
+	//Fall back to the socket if the node couldn't open the ring
+	if(shared_ring) {
+		if(reply.args[0] & FEATURE_SHARED_MEMORY) {
+			printf("Node %s: sending through shared memory\n", node_identifier);
+		} else {
+			delete shared_ring;
+			shared_ring = NULL;
+		}
+	}
+	handshake_done = timeMicroseconds();
+
+	//The send port sends for every pipe, fall back to a thread of our own if
+	//the socket can't be added to it. Ring writes block while the ring is
+	//full, so a shared memory pipe keeps its own thread and a slow local node
+	//can't hold up the port's sends to every other node
+	if(send_port && (shared_ring || !send_port->attach(this, pipe_sock)))
+		send_port = NULL;
+	if(send_port)
+		return 0;
+
+	//Start the thread that sends queued frames
+	running = 1;
+	sender = new GLThread(SenderShell, this);
+	if(!sender->start()) {
+		printf("Could not start sender thread\n");
+		return -1;
+	}
+
 	return 0;
 }
 
 //Close the pipe
 void GLPipe::closePipe()
 {
-	closesocket(pipe_sock);
+	//Let the sender thread drain the queue and exit
+	if(sender) {
+		atomicStore(&running, 0);
+		work_event->signal();
+		sender->join();
+		delete sender;
+		sender = NULL;
+	}
+
+	//Tell the node the stream has ended
+	if(shared_ring) {
+		delete shared_ring;
+		shared_ring = NULL;
+	}
+
+	socketClose(pipe_sock);
+	pipe_sock = INVALID_SOCKET;
+}
+
+//Sends frames without copying them into the socket buffer
+void GLPipe::setZeroCopy(BOOL enable)
+{
+	zero_copy = enable;
+}
+
+//Sets up the socket once connected, sizes of SOCKET_BUFFER_DEFAULT leave the
+//buffers to the OS
+void GLPipe::setSocketOptions(BOOL i_no_delay, int i_send_buffer, int i_receive_buffer)
+{
+	no_delay = i_no_delay;
+	send_buffer = i_send_buffer;
+	receive_buffer = i_receive_buffer;
+}
+
+//Lets whole frames be dropped when the node falls behind, the stream uses the
+//given protocol revision
+void GLPipe::setDropFrames(BOOL enable, unsigned int stream_revision)
+{
+	drop_frames = enable;
+
+	//The end of a dropped frame is replaced with SkipFrame
+	if(stream_revision >= PROTOCOL_REVISION_2) {
+		skip_command[0] = (char)OPCODE_SkipFrame;
+		skip_length = 1;
+	} else {
+		int value = OPCODE_SkipFrame;
+		memcpy(skip_command, &value, sizeof(int));
+		skip_length = sizeof(int);
+	}
+}
+
+//Sends the stream through a shared memory ring of the given size when the node
+//is on this machine
+void GLPipe::setSharedMemory(BOOL enable, unsigned int size)
+{
+	shared_memory = enable;
+	shared_size = size;
+}
+
+//Sends through a completion port shared by every pipe instead of a thread of
+//its own
+void GLPipe::setSendPort(GLSendPort *port)
+{
+	send_port = port;
+}
+
+//Sets how long a connect attempt and the handshake reply may take in
+//milliseconds, and how many times a failed connect is tried again
+void GLPipe::setConnectTimeout(unsigned int timeout, int retries)
+{
+	connect_timeout = timeout;
+	connect_retries = retries;
+}
+
+//Sets the frames between keyframes when the node takes delta frames
+void GLPipe::setDeltaKeyframe(unsigned int interval)
+{
+	delta_keyframe = interval;
+}
+
+//Notes that the node asked for a keyframe, run by the backchannel thread when
+//the node could not apply an edit
+void GLPipe::requestKeyframe()
+{
+	atomicStore(&keyframe_requested, 1);
+}
+
+//Returns TRUE if the node asked for a keyframe that hasn't been started
+BOOL GLPipe::keyframeRequested()
+{
+	return atomicLoad(&keyframe_requested) ? TRUE : FALSE;
+}
+
+//Starts the keyframe the node asked for, if it did, at the first frame of a
+//generation. Run by the application thread once it has forgotten what the
+//nodes hold
+void GLPipe::startKeyframe(unsigned int generation)
+{
+	//The node only asks again after this keyframe reached it, so no request
+	//is lost between the two stores
+	if(atomicLoad(&keyframe_requested)) {
+		atomicStore(&keyframe_requested, 0);
+		atomicStore(&keyframe_generation, (long)generation);
+	}
+}
+
+//Sets the position of this pipe in the interface
+void GLPipe::setIndex(int i_index)
+{
+	index = i_index;
+}
+
+//Sets the features to ask the node for when connecting
+void GLPipe::requestFeatures(unsigned int requested)
+{
+	features = requested;
+}
+
+//Returns the features the node accepted
+unsigned int GLPipe::getFeatures()
+{
+	return features;
+}
+
+//Sets the protocol revision to ask the node for when connecting
+void GLPipe::requestRevision(unsigned int requested)
+{
+	revision = requested;
+}
+
+//Returns the protocol revision the node agreed to
+unsigned int GLPipe::getRevision()
+{
+	return revision;
+}
+
+//Returns TRUE if any of the 8 corners of a box in eye space, stored as
+//x, y, z, w, might be inside this node's part of the view
+BOOL GLPipe::canSee(float *corners)
+{
+	float clip[8][4];
+	int outside[6] = {0, 0, 0, 0, 0, 0};
+
+	for(int i = 0; i < 8; i++) {
+		projection.transform(clip[i], corners[i * 4], corners[i * 4 + 1], corners[i * 4 + 2], corners[i * 4 + 3]);
+
+		//Count the corners outside of each clip plane
+		if(clip[i][0] < -clip[i][3]) outside[0]++;
+		if(clip[i][0] > clip[i][3]) outside[1]++;
+		if(clip[i][1] < -clip[i][3]) outside[2]++;
+		if(clip[i][1] > clip[i][3]) outside[3]++;
+		if(clip[i][2] < -clip[i][3]) outside[4]++;
+		if(clip[i][2] > clip[i][3]) outside[5]++;
+	}
+
+	//The box is hidden only if all its corners are outside the same plane
+	for(int i = 0; i < 6; i++) {
+		if(outside[i] == 8)
+			return FALSE;
+	}
+
+	return TRUE;
 }
 
 //Send a command over the pipe
@@ -78,9 +459,9 @@ int GLPipe::sendCommand(char *buffer, unsigned int length)
 	int send_length;
 
 	//Send the name of this pipe's target node for validity check
-	if((send_length = send(pipe_sock, buffer, length, 0)) != length) {
+	if((send_length = socketSend(pipe_sock, buffer, length)) != (int)length) {
 		if(send_length == SOCKET_ERROR)
-			printf("Error %d occurred!",  WSAGetLastError());
+			printf("Error %d occurred!",  socketError());
 		else
 			printf("Connection was terminated unexpectedly");
 			
@@ -90,6 +471,451 @@ int GLPipe::sendCommand(char *buffer, unsigned int length)
 	return 0;
 }
 
+//Receives a message the node sent back over the pipe, waiting up to timeout
+//milliseconds for it
+int GLPipe::receiveMessage(BackchannelMessage *message, unsigned int timeout)
+{
+	int length;
+
+	//Messages are small but can still arrive split across reads
+	length = socketReceive(pipe_sock, (char*)message, sizeof(BackchannelMessage), timeout);
+	if(length <= 0) {
+		if(length == 0)
+			printf("Connection was terminated unexpectedly");
+		else if(length == SOCKET_TIMEOUT)
+			printf("Timed out");
+		else
+			printf("Error %d occurred!",  socketError());
+		return -1;
+	}
+
+	return 0;
+}
+
+//Returns the socket connected to the node
+SOCKET GLPipe::getSocket()
+{
+	return pipe_sock;
+}
+
+//Returns the name of the node
+char *GLPipe::getName()
+{
+	return node_identifier;
+}
+
+//Queues a frame for the sender thread, holding a reference until sent
+int GLPipe::queueFrame(GLFrame *frame)
+{
+	if(atomicLoad(&failed))
+		return -1;
+
+	frame->addReference();
+
+	//Wait for the sender thread to make room if the node is behind
+	while(!queue.push(frame)) {
+		if(send_port)
+			send_port->wake();
+		space_event->wait(1);
+	}
+
+	//The send port is woken once for all pipes by the interface
+	if(!send_port)
+		work_event->signal();
+	return 0;
+}
+
+//Sends queued frames until the pipe is closed, runs on the sender thread
+void GLPipe::senderMain()
+{
+	HANDLE handles[2];
+
+	for(;;) {
+		takeQueued();
+
+		//Gather pending frames into a free send slot and post it
+		if(sends_in_flight < PIPE_SENDS_IN_FLIGHT && pending_count > 0) {
+			startSend();
+			continue;
+		}
+
+		if(sends_in_flight > 0) {
+			PipeSend *oldest = &sends[first_send];
+
+			//With a free slot, or when frames have to be taken as they are
+			//queued, wake up for new frames as well as the oldest send
+			if(sends_in_flight < PIPE_SENDS_IN_FLIGHT || drop_frames) {
+				handles[0] = oldest->overlapped.hEvent;
+				handles[1] = work_event->getHandle();
+				if(WaitForMultipleObjects(2, handles, FALSE, INFINITE) != WAIT_OBJECT_0)
+					continue;
+			}
+
+			completeSend(oldest);
+			first_send = (first_send + 1) % PIPE_SENDS_IN_FLIGHT;
+			sends_in_flight--;
+			continue;
+		}
+
+		//Exit once the pipe is closed and everything has been sent
+		if(!atomicLoad(&running)) {
+			if(queue.count() == 0 && pending_count == 0)
+				break;
+			continue;
+		}
+
+		work_event->wait(WAIT_FOREVER);
+	}
+}
+
+//Gathers pending frames into the next free send slot and posts it
+void GLPipe::startSend()
+{
+	PipeSend *send = &sends[(first_send + sends_in_flight) % PIPE_SENDS_IN_FLIGHT];
+	int taken = 0;
+	send->count = 0;
+	send->buffer_count = 0;
+	while(send->count < PIPE_GATHER_SIZE && taken < pending_count) {
+		GLFrame *frame = pending[taken++];
+
+		//Nothing more can be added to a frame once it is being sent
+		if(frame == coalesced)
+			coalesced = NULL;
+		frame_start = frame->frame_end >= 0;
+
+		if(delta && !(frame = encodeFrame(frame)))
+			continue;
+
+		send->frames[send->count++] = frame;
+		addFrame(send, frame);
+	}
+	pending_count -= taken;
+	memmove(pending, &pending[taken], pending_count * sizeof(GLFrame*));
+
+	//Every frame taken was culled away
+	if(send->count == 0)
+		return;
+
+	//Drop frames after a failure, the node can no longer follow the stream
+	if(atomicLoad(&failed) || postSend(send) < 0) {
+		for(int i = 0; i < send->count; i++)
+			send->frames[i]->release();
+		return;
+	}
+
+	sends_in_flight++;
+}
+
+//Posts queued frames and retires finished sends, run by the send port.
+//Returns TRUE once everything queued has been sent
+BOOL GLPipe::pumpSends()
+{
+	for(;;) {
+		//Sends on a socket finish in order, retire them from the oldest
+		while(sends_in_flight > 0 && sends[first_send].done) {
+			completeSend(&sends[first_send]);
+			first_send = (first_send + 1) % PIPE_SENDS_IN_FLIGHT;
+			sends_in_flight--;
+		}
+
+		takeQueued();
+		if(sends_in_flight == PIPE_SENDS_IN_FLIGHT || pending_count == 0)
+			break;
+		startSend();
+	}
+
+	return sends_in_flight == 0 && pending_count == 0 && queue.count() == 0;
+}
+
+//Marks a send as finished when the send port collects its completion
+void GLPipe::sendCompleted(void *overlapped)
+{
+	for(int i = 0; i < PIPE_SENDS_IN_FLIGHT; i++) {
+		if(&sends[i].overlapped == overlapped)
+			sends[i].done = TRUE;
+	}
+}
+
+//Moves frames from the queue to the pending list. When frames can be dropped
+//every queued frame is taken so the host never waits on the node
+void GLPipe::takeQueued()
+{
+	GLFrame *frame;
+	BOOL taken = FALSE;
+
+	while((drop_frames || pending_count < PIPE_GATHER_SIZE) && queue.pop(&frame)) {
+		if(pending_count == pending_capacity) {
+			GLFrame **grown = new GLFrame*[pending_capacity * 2];
+			memcpy(grown, pending, pending_count * sizeof(GLFrame*));
+			delete[] pending;
+			pending = grown;
+			pending_capacity *= 2;
+		}
+		pending[pending_count++] = frame;
+		taken = TRUE;
+
+		//A finished frame makes the whole frames waiting before it stale
+		if(drop_frames && frame->frame_end >= 0)
+			dropPending();
+	}
+
+	if(taken)
+		space_event->signal();
+}
+
+//Drops the whole frames pending before the one that just finished
+void GLPipe::dropPending()
+{
+	int first = 0;
+	int last = -1;
+
+	//The rest of a frame that has started going out is sent whole
+	if(!frame_start) {
+		while(first < pending_count && pending[first]->frame_end < 0)
+			first++;
+		first++;
+	}
+
+	//Every frame ending before the new one is stale
+	for(int i = first; i < pending_count - 1; i++) {
+		if(pending[i]->frame_end >= 0)
+			last = i;
+	}
+	if(last < first)
+		return;
+
+	//Keep adding to the frame holding earlier dropped frames if it is next
+	GLFrame *target = pending[first];
+	int next = first + 1;
+	if(target != coalesced) {
+		target = new GLFrame(COALESCED_FRAME_SIZE, NULL);
+		next = first;
+	}
+
+	for(int i = next; i <= last; i++) {
+		if(pending[i]->frame_end >= 0)
+			frames_dropped++;
+		coalesceFrame(target, pending[i]);
+		pending[i]->release();
+	}
+
+	coalesced = target;
+	pending[first] = target;
+	memmove(&pending[first + 1], &pending[last + 1], (pending_count - last - 1) * sizeof(GLFrame*));
+	pending_count -= last - first;
+}
+
+//Appends what a dropped frame can't go without to the coalesced frame: every
+//command this node gets except the ones that only draw, with the end of the
+//frame turned into SkipFrame
+void GLPipe::coalesceFrame(GLFrame *target, GLFrame *frame)
+{
+	unsigned int offset = 0;
+	unsigned int kept = 0;
+	unsigned int culled_bytes = 0;
+	int culled = 0;
+	int droppable = 0;
+	CulledRange end;
+	BOOL end_pending = frame->frame_end >= 0;
+
+	end.offset = frame->frame_end;
+	end.length = frame->frame_end_length;
+	target->reserve(target->length + frame->length + skip_length);
+
+	//No draws are kept from a dropped frame, so the coalesced frame can start
+	//a keyframe once any frame in it could
+	if(frame->generation > target->generation)
+		target->generation = frame->generation;
+
+	//Walk the culled, droppable and end ranges together in offset order,
+	//copying what lies between them
+	for(;;) {
+		CulledRange *range = NULL;
+
+		while(culled < frame->culled_count && !frame->isCulled(culled, index))
+			culled++;
+		if(culled < frame->culled_count)
+			range = &frame->culled[culled];
+		if(droppable < frame->droppable_count && (!range || frame->droppable[droppable].offset < range->offset))
+			range = &frame->droppable[droppable];
+		if(end_pending && (!range || end.offset < range->offset))
+			range = &end;
+		if(!range)
+			break;
+
+		if(range->offset > offset) {
+			memcpy(&target->data[target->length], &frame->data[offset], range->offset - offset);
+			target->length += range->offset - offset;
+			kept += range->offset - offset;
+		}
+		if(range->offset + range->length > offset)
+			offset = range->offset + range->length;
+
+		if(range == &end) {
+			target->frame_end = target->length;
+			target->frame_end_length = skip_length;
+			memcpy(&target->data[target->length], skip_command, skip_length);
+			target->length += skip_length;
+			end_pending = FALSE;
+		} else if(culled < frame->culled_count && range == &frame->culled[culled]) {
+			culled_bytes += range->length;
+			culled++;
+		} else {
+			droppable++;
+		}
+	}
+
+	if(frame->length > offset) {
+		memcpy(&target->data[target->length], &frame->data[offset], frame->length - offset);
+		target->length += frame->length - offset;
+		kept += frame->length - offset;
+	}
+
+	bytes_culled += culled_bytes;
+	bytes_dropped += frame->length - kept - culled_bytes;
+}
+
+//Encodes what this node gets of a frame as edits of the last frame it got.
+//Releases the frame and returns the encoded one, or NULL if the node gets none
+//of it
+GLFrame *GLPipe::encodeFrame(GLFrame *frame)
+{
+	unsigned int offset = 0;
+	BOOL frame_end = frame->frame_end >= 0;
+
+	//Frames queued before the host forgot what the node holds may use cache
+	//slots and state the node skipped, the keyframe comes after them
+	long generation = atomicLoad(&keyframe_generation);
+	if(generation && frame->generation >= (unsigned int)generation) {
+		atomicStore(&keyframe_generation, 0);
+		delta->requestKeyframe();
+	}
+
+	//The edits are made against what the node got after culling
+	for(int i = 0; i < frame->culled_count; i++) {
+		if(!frame->isCulled(i, index))
+			continue;
+
+		if(frame->culled[i].offset > offset)
+			delta->append(&frame->data[offset], frame->culled[i].offset - offset);
+
+		offset = frame->culled[i].offset + frame->culled[i].length;
+		bytes_culled += frame->culled[i].length;
+	}
+	if(frame->length > offset)
+		delta->append(&frame->data[offset], frame->length - offset);
+	frame->release();
+
+	if(delta->pendingLength() == 0 && !frame_end)
+		return NULL;
+
+	GLFrame *encoded = delta_pool->acquire();
+	encoded->reserve(delta->pendingLength() + 1);
+	encoded->length = delta->encode(encoded->data, frame_end ? true : false);
+	return encoded;
+}
+
+//Adds the parts of a frame this pipe doesn't skip to a send
+void GLPipe::addFrame(PipeSend *send, GLFrame *frame)
+{
+	unsigned int offset = 0;
+
+	//The prefix holds what this node gets of the frame after culling
+	if(features & FEATURE_LENGTH_PREFIX) {
+		unsigned int *prefix = &send->prefixes[send->count - 1];
+		*prefix = frame->length;
+		for(int i = 0; i < frame->culled_count; i++) {
+			if(frame->isCulled(i, index))
+				*prefix -= frame->culled[i].length;
+		}
+
+		if(*prefix == 0) {
+			bytes_culled += frame->length;
+			return;
+		}
+		addBuffer(send, (char*)prefix, sizeof(unsigned int));
+	}
+
+	for(int i = 0; i < frame->culled_count; i++) {
+		if(!frame->isCulled(i, index))
+			continue;
+
+		if(frame->culled[i].offset > offset)
+			addBuffer(send, &frame->data[offset], frame->culled[i].offset - offset);
+
+		offset = frame->culled[i].offset + frame->culled[i].length;
+		bytes_culled += frame->culled[i].length;
+	}
+
+	if(frame->length > offset)
+		addBuffer(send, &frame->data[offset], frame->length - offset);
+}
+
+//Adds one buffer to a send
+void GLPipe::addBuffer(PipeSend *send, char *data, unsigned int length)
+{
+	if(send->buffer_count == send->buffer_capacity) {
+		WSABUF *grown = new WSABUF[send->buffer_capacity * 2];
+		memcpy(grown, send->buffers, send->buffer_count * sizeof(WSABUF));
+		delete[] send->buffers;
+		send->buffers = grown;
+		send->buffer_capacity *= 2;
+	}
+
+	send->buffers[send->buffer_count].buf = data;
+	send->buffers[send->buffer_count].len = length;
+	send->buffer_count++;
+	bytes_sent += length;
+}
+
+//Starts an overlapped send of the frames gathered in a send slot
+int GLPipe::postSend(PipeSend *send)
+{
+	DWORD sent;
+
+	WSAResetEvent(send->overlapped.hEvent);
+	send->done = FALSE;
+
+	//Copying into the ring finishes the send, it only waits if the ring is full
+	if(shared_ring) {
+		for(int i = 0; i < send->buffer_count; i++) {
+			if(!shared_ring->write(send->buffers[i].buf, send->buffers[i].len)) {
+				printf("Shared memory to node %s has failed\n", node_identifier);
+				atomicStore(&failed, 1);
+				return -1;
+			}
+		}
+
+		WSASetEvent(send->overlapped.hEvent);
+		send->done = TRUE;
+		return 0;
+	}
+	if(WSASend(pipe_sock, send->buffers, send->buffer_count, &sent, 0, &send->overlapped, NULL) == SOCKET_ERROR &&
+		WSAGetLastError() != WSA_IO_PENDING) {
+		printf("Error %d occurred! on node %s\n", WSAGetLastError(), node_identifier);
+		atomicStore(&failed, 1);
+		return -1;
+	}
+
+	return 0;
+}
+
+//Waits for a send to finish and releases its frames
+void GLPipe::completeSend(PipeSend *send)
+{
+	DWORD sent, flags;
+
+	if(!shared_ring && !WSAGetOverlappedResult(pipe_sock, &send->overlapped, &sent, TRUE, &flags)) {
+		printf("Error %d occurred! on node %s\n", WSAGetLastError(), node_identifier);
+		atomicStore(&failed, 1);
+	}
+
+	//The node has the data, the frames can go back to their pool
+	for(int i = 0; i < send->count; i++)
+		send->frames[i]->release();
+	send->count = 0;
+}
+
 //Print configuration information about the pipe
 void GLPipe::printStatus()
 {
@@ -101,3 +927,99 @@ void GLPipe::printStatus()
 	printf("\tUse graphics device: %d\n", device_id);
 	printf("\tListen on port: %d\n", port);
 }
+
+//Prints out how long connecting took, relative to start
+void GLPipe::printTimeline(unsigned long long start)
+{
+	if(!handshake_done) {
+		printf("\t%s: failed after %d connect attempts\n", node_identifier, connect_attempts);
+		return;
+	}
+
+	printf("\t%s: started %.1fms, connected %.1fms after %d attempts, handshake done %.1fms\n", node_identifier,
+		(connect_start - start) / 1000.0, (connect_done - start) / 1000.0, connect_attempts,
+		(handshake_done - start) / 1000.0);
+}
+
+//Returns how long connecting and the handshake took in microseconds
+unsigned long long GLPipe::getConnectTime()
+{
+	return handshake_done ? handshake_done - connect_start : 0;
+}
+
+//Prints out how many bytes were sent and saved by culling
+void GLPipe::printStats()
+{
+	unsigned long long total = bytes_sent + bytes_culled;
+
+	printf("Node %s: %llu bytes sent, %llu bytes culled (%.1f%% saved)\n", node_identifier,
+		bytes_sent, bytes_culled, total ? 100.0 * (double)bytes_culled / (double)total : 0.0);
+}
+
+//Prints out how many frames were dropped for the node
+void GLPipe::printDrops()
+{
+	printf("Node %s: %u frames dropped, %llu bytes of them not sent\n", node_identifier,
+		frames_dropped, bytes_dropped);
+}
+
+//Prints out how much delta frames saved
+void GLPipe::printDelta()
+{
+	if(!delta)
+		return;
+
+	DeltaStats stats = delta->getStats();
+	printf("Node %s: %u delta frames, %u raw, %u keyframes, %llu bytes encoded as %llu (%.1f%% saved)\n",
+		node_identifier, stats.edits, stats.raws, stats.keyframes, stats.bytes_in, stats.bytes_out,
+		stats.bytes_in ? 100.0 * (1.0 - (double)stats.bytes_out / (double)stats.bytes_in) : 0.0);
+}
+
+//Adds a clock sample from a probe sent at host time sent, run by the node
+//at node_time and answered at host time received
+void GLPipe::addClockSample(unsigned long long sent, unsigned long long node_time, unsigned long long received)
+{
+	//Assume the probe took as long to get there as the answer took to come
+	//back, the offset is then off by at most half the round trip
+	unsigned int rtt = (unsigned int)(received - sent);
+	long long offset = (long long)node_time - (long long)(sent + rtt / 2);
+
+	clock_lock->lock();
+	clock_offsets[clock_samples % CLOCK_WINDOW] = offset;
+	clock_rtts[clock_samples % CLOCK_WINDOW] = rtt;
+	clock_samples++;
+
+	//Probes that waited behind frames have long round trips, use the quickest
+	//recent one. Old samples drop out so drift between the clocks is followed
+	int count = clock_samples < CLOCK_WINDOW ? clock_samples : CLOCK_WINDOW;
+	int best = 0;
+	for(int i = 1; i < count; i++) {
+		if(clock_rtts[i] < clock_rtts[best])
+			best = i;
+	}
+	clock_offset = clock_offsets[best];
+	clock_rtt = clock_rtts[best];
+	clock_lock->unlock();
+}
+
+//Gets the node's clock minus the host's, returns FALSE until sampled
+BOOL GLPipe::getClockOffset(long long *offset)
+{
+	BOOL valid;
+
+	clock_lock->lock();
+	valid = clock_samples > 0;
+	*offset = clock_offset;
+	clock_lock->unlock();
+
+	return valid;
+}
+
+//Prints out the clock offset to the node and how accurate it is
+void GLPipe::printClock()
+{
+	clock_lock->lock();
+	if(clock_samples > 0)
+		printf("Node %s: clock offset %lldus, within %uus\n", node_identifier, clock_offset, clock_rtt / 2);
+	clock_lock->unlock();
+}
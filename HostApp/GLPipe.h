@@ -6,10 +6,13 @@
 |11/26/2012                                                                    |
 \*----------------------------------------------------------------------------*/
 
+#ifndef GLPIPE_H
+#define GLPIPE_H
+
 #define _CRT_SECURE_NO_WARNINGS
 
 #ifndef CAPTUREDLL
-#include <windows.h>
+#include "GLSocket.h"
 #include <stdio.h>
 #endif
 
@@ -18,8 +21,48 @@
 #define FALSE 0
 #define NULL 0
 typedef int BOOL;
+#ifdef CAPTUREDLL
 typedef unsigned int SOCKET;
 #endif
+#endif
+
+#include "GLThread.h"
+#include "GLSharedRing.h"
+#include "GLSendPort.h"
+#include "GLFrame.h"
+#include "GLProtocol.h"
+#include "GLMatrix.h"
+#include "GLDelta.h"
+
+//Number of frames that can wait to be sent on a pipe
+#define PIPE_QUEUE_SIZE 64
+
+//Number of queued frames gathered into a single send
+#define PIPE_GATHER_SIZE 16
+
+//Number of gathered sends that can be in flight on a pipe at once
+#define PIPE_SENDS_IN_FLIGHT 4
+
+//Number of recent clock samples the offset to the node is picked from
+#define CLOCK_WINDOW 16
+
+//Starting size of the frame holding what is kept of dropped frames
+#define COALESCED_FRAME_SIZE 4096
+
+//Milliseconds a connect or the handshake reply is waited on by default
+#define CONNECT_TIMEOUT 2000
+
+//Times a refused or timed out connect is tried again by default
+#define CONNECT_RETRIES 3
+
+//Milliseconds between connect attempts
+#define CONNECT_RETRY_WAIT 250
+
+//Starting size of the frames delta encoded chunks are written to
+#define DELTA_FRAME_SIZE 65536
+
+//A gathered send of several frames, defined with the socket code
+struct PipeSend;
 
 class GLPipe
 {
@@ -51,6 +94,159 @@ private:
 	//Socket to communicate over
 	SOCKET pipe_sock;
 
+	//Position of this pipe in the interface, selects its bit in cull masks
+	int index;
+
+	//Projection the node uses for its part of the host application
+	GLMatrix projection;
+
+	//Bytes sent to the node and bytes skipped because of culling
+	unsigned long long bytes_sent;
+	unsigned long long bytes_culled;
+
+	//Adds the parts of a frame this pipe doesn't skip to a send
+	void addFrame(PipeSend *send, GLFrame *frame);
+
+	//Adds one buffer to a send
+	void addBuffer(PipeSend *send, char *data, unsigned int length);
+
+	//Frames waiting to be sent by the sender thread
+	GLRing<GLFrame*, PIPE_QUEUE_SIZE> queue;
+
+	//Thread that sends queued frames to the node
+	GLThread *sender;
+
+	//Signalled when frames are queued and when queue space frees up
+	GLEvent *work_event;
+	GLEvent *space_event;
+
+	//Non-zero while the sender thread should keep running
+	volatile long running;
+
+	//Non-zero once a send to the node has failed
+	volatile long failed;
+
+	//Ring of gathered sends, the oldest one in flight is at first_send
+	PipeSend *sends;
+	int first_send;
+	int sends_in_flight;
+
+	//Should the socket send straight from the frames instead of copying
+	BOOL zero_copy;
+
+	//Should small sends go out right away, and the socket buffer sizes to
+	//ask for, SOCKET_BUFFER_DEFAULT leaves them to the OS
+	BOOL no_delay;
+	int send_buffer;
+	int receive_buffer;
+
+	//Should the stream go through shared memory if the node is on this
+	//machine, and the size of the ring to ask for
+	BOOL shared_memory;
+	unsigned int shared_size;
+
+	//Ring carrying the stream once the node has accepted it, or NULL to send
+	//on the socket
+	GLSharedRing *shared_ring;
+
+	//Milliseconds a connect attempt and the handshake reply may take, and
+	//how many times a failed connect is tried again
+	unsigned int connect_timeout;
+	int connect_retries;
+
+	//When connecting started, the socket connected and the handshake
+	//finished, and the connect attempts it took
+	unsigned long long connect_start;
+	unsigned long long connect_done;
+	unsigned long long handshake_done;
+	int connect_attempts;
+
+	//Features asked for in the handshake, then the ones the node accepted
+	unsigned int features;
+
+	//Protocol revision asked for in the handshake, then the one to use
+	unsigned int revision;
+
+	//Recent clock samples, each the node's clock minus the host's and the
+	//round trip it was measured over, in microseconds
+	long long clock_offsets[CLOCK_WINDOW];
+	unsigned int clock_rtts[CLOCK_WINDOW];
+	unsigned int clock_samples;
+
+	//Offset and round trip of the sample with the shortest round trip, its
+	//error is at most half the round trip
+	long long clock_offset;
+	unsigned int clock_rtt;
+
+	//Guards the clock estimate, samples arrive on the backchannel thread
+	GLLock *clock_lock;
+
+	//Starts an overlapped send of the frames gathered in a send slot
+	int postSend(PipeSend *send);
+
+	//Waits for a send to finish and releases its frames
+	void completeSend(PipeSend *send);
+
+	//Gathers pending frames into the next free send slot and posts it
+	void startSend();
+
+	//Completion port sending for this pipe, or NULL when it has a sender thread
+	GLSendPort *send_port;
+
+	//Frames taken off the queue that are waiting for a free send slot
+	GLFrame **pending;
+	int pending_count;
+	int pending_capacity;
+
+	//Set when the last frame handed to a send ended a displayed frame
+	BOOL frame_start;
+
+	//Should whole frames be dropped when the node falls behind
+	BOOL drop_frames;
+
+	//SkipFrame encoded for the protocol revision of the stream
+	char skip_command[sizeof(int)];
+	unsigned int skip_length;
+
+	//Frame in pending holding what was kept of dropped frames, or NULL
+	GLFrame *coalesced;
+
+	//Frames dropped for the node and bytes of them that were not sent
+	unsigned int frames_dropped;
+	unsigned long long bytes_dropped;
+
+	//Moves frames from the queue to the pending list. When frames can be
+	//dropped every queued frame is taken so the host never waits on the node
+	void takeQueued();
+
+	//Drops the whole frames pending before the one that just finished
+	void dropPending();
+
+	//Appends what a dropped frame can't go without to the coalesced frame
+	void coalesceFrame(GLFrame *target, GLFrame *frame);
+
+	//Frames between keyframes when the node takes delta frames
+	unsigned int delta_keyframe;
+
+	//Encodes what the node gets as edits of the last frame it got, or NULL
+	//to send frames as they are
+	GLDeltaEncoder *delta;
+
+	//Frames holding encoded chunks until they have been sent
+	GLFramePool *delta_pool;
+
+	//Non-zero once the node has asked for a keyframe
+	volatile long keyframe_requested;
+
+	//Generation of the first frame the asked for keyframe can start at, or 0
+	//while the host hasn't forgotten what the node holds yet
+	volatile long keyframe_generation;
+
+	//Encodes what this node gets of a frame as edits of the last frame it
+	//got. Releases the frame and returns the encoded one, or NULL if the node
+	//gets none of it
+	GLFrame *encodeFrame(GLFrame *frame);
+
 public:
 	GLPipe(int h_width, int h_height, int width, int height, int x_off, int y_off, int x_loc, int y_loc, int dev, int n_port, char *name);
 	~GLPipe();
@@ -61,9 +257,116 @@ public:
 	//Closes the connection to the node
 	void closePipe();
 
+	//Sends frames without copying them into the socket buffer
+	void setZeroCopy(BOOL enable);
+
+	//Sets up the socket once connected, sizes of SOCKET_BUFFER_DEFAULT leave
+	//the buffers to the OS
+	void setSocketOptions(BOOL i_no_delay, int i_send_buffer, int i_receive_buffer);
+
+	//Sends the stream through a shared memory ring of the given size when the
+	//node is on this machine
+	void setSharedMemory(BOOL enable, unsigned int size);
+
+	//Lets whole frames be dropped when the node falls behind, the stream uses
+	//the given protocol revision
+	void setDropFrames(BOOL enable, unsigned int stream_revision);
+
+	//Sets how long a connect attempt and the handshake reply may take in
+	//milliseconds, and how many times a failed connect is tried again
+	void setConnectTimeout(unsigned int timeout, int retries);
+
+	//Sets the frames between keyframes when the node takes delta frames
+	void setDeltaKeyframe(unsigned int interval);
+
+	//Notes that the node asked for a keyframe, run by the backchannel thread
+	//when the node could not apply an edit
+	void requestKeyframe();
+
+	//Starts the keyframe the node asked for, if it did, at the first frame of
+	//a generation. Run by the application thread once it has forgotten what
+	//the nodes hold
+	void startKeyframe(unsigned int generation);
+
+	//Returns TRUE if the node asked for a keyframe that hasn't been started
+	BOOL keyframeRequested();
+
+	//Sets the position of this pipe in the interface
+	void setIndex(int i_index);
+
+	//Sets the features to ask the node for when connecting
+	void requestFeatures(unsigned int requested);
+
+	//Returns the features the node accepted
+	unsigned int getFeatures();
+
+	//Sets the protocol revision to ask the node for when connecting
+	void requestRevision(unsigned int requested);
+
+	//Returns the protocol revision the node agreed to
+	unsigned int getRevision();
+
+	//Returns TRUE if any of the 8 corners of a box in eye space, stored as
+	//x, y, z, w, might be inside this node's part of the view
+	BOOL canSee(float *corners);
+
 	//Sends data in the supplied buffer to the node
 	int sendCommand(char *buffer, unsigned int length);
 
+	//Receives a message the node sent back over the pipe, waiting up to
+	//timeout milliseconds for it
+	int receiveMessage(BackchannelMessage *message, unsigned int timeout);
+
+	//Returns the socket connected to the node
+	SOCKET getSocket();
+
+	//Returns the name of the node
+	char *getName();
+
+	//Queues a frame for the sender thread, holding a reference until sent
+	int queueFrame(GLFrame *frame);
+
+	//Sends queued frames until the pipe is closed, runs on the sender thread
+	void senderMain();
+
+	//Sends through a completion port shared by every pipe instead of a thread
+	//of its own
+	void setSendPort(GLSendPort *port);
+
+	//Posts queued frames and retires finished sends, run by the send port.
+	//Returns TRUE once everything queued has been sent
+	BOOL pumpSends();
+
+	//Marks a send as finished when the send port collects its completion
+	void sendCompleted(void *overlapped);
+
 	//Prints out configuration data and connection info
 	void printStatus();
+
+	//Prints out how long connecting took, relative to start
+	void printTimeline(unsigned long long start);
+
+	//Returns how long connecting and the handshake took in microseconds
+	unsigned long long getConnectTime();
+
+	//Prints out how many bytes were sent and saved by culling
+	void printStats();
+
+	//Prints out how many frames were dropped for the node
+	void printDrops();
+
+	//Prints out how much delta frames saved
+	void printDelta();
+
+	//Adds a clock sample from a probe sent at host time sent, run by the node
+	//at node_time and answered at host time received
+	void addClockSample(unsigned long long sent, unsigned long long node_time, unsigned long long received);
+
+	//Gets the node's clock minus the host's, returns FALSE until sampled
+	BOOL getClockOffset(long long *offset);
+
+	//Prints out the clock offset to the node and how accurate it is
+	void printClock();
 };
+
+#endif
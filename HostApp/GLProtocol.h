@@ -0,0 +1,529 @@
+/*----------------------------------------------------------------------------*\
+|Wire formats shared by the host (RGLInterface, GLPipe) and the GLNode. Both   |
+|sides include this file so the layouts cannot drift apart.                    |
+|                                                                              |
+|Stewart Hall                                                                  |
+|10/17/2026                                                                    |
+\*----------------------------------------------------------------------------*/
+
+#ifndef GLPROTOCOL_H
+#define GLPROTOCOL_H
+
+//------------------------------------------------------------------------------
+//View frustum, the host needs the same one as the nodes to cull geometry
+//------------------------------------------------------------------------------
+#define VIEW_NEAR_CLIP 0.1f
+#define VIEW_FAR_CLIP 100.0f
+#define VIEW_FOV 45.0f
+
+//------------------------------------------------------------------------------
+//Handshake, the name buffer the host sends when it connects to a node
+//------------------------------------------------------------------------------
+//Size of the name buffer
+#define HANDSHAKE_SIZE 256
+
+//Marks the features at the end of the name buffer as valid
+#define HANDSHAKE_MAGIC 0x574C4853
+
+//Features the host can ask the node for
+#define FEATURE_COMPACT_VERTICES 1
+#define FEATURE_LENGTH_PREFIX 2
+#define FEATURE_SHARED_MEMORY 4
+#define FEATURE_GEOMETRY_CACHE 8
+#define FEATURE_DELTA_FRAMES 16
+#define FEATURE_INSTANCING 32
+
+//Name of the shared memory ring that carries the command stream to the node
+//listening on a port, when FEATURE_SHARED_MEMORY is accepted. The host creates
+//it before the handshake and the node opens it when it accepts the feature.
+//The ring value in the handshake makes it unique to the connection
+#define SHARED_RING_NAME "Local\\GLWallRing%d_%08x"
+
+//Revisions of the command encoding
+//1: 4 byte opcodes and 4 byte arguments
+//2: 1 byte opcodes, varint integers and enums, packed clear masks
+#define PROTOCOL_REVISION_1 1
+#define PROTOCOL_REVISION_2 2
+
+//Latest revision both sides understand
+#define PROTOCOL_REVISION PROTOCOL_REVISION_2
+
+//Stored in the last bytes of the name buffer, after the name
+struct HandshakeFeatures
+{
+	//Always HANDSHAKE_MAGIC
+	unsigned int magic;
+
+	//Features the host would like to use
+	unsigned int features;
+
+	//Protocol revision the host would like to use
+	unsigned int revision;
+
+	//Position of the node in the host's config, names it in ClockOffset
+	unsigned int node;
+
+	//Picked by the host for each connection, names the shared memory ring
+	unsigned int ring;
+};
+
+#define HANDSHAKE_FEATURES_OFFSET (HANDSHAKE_SIZE - sizeof(HandshakeFeatures))
+
+//------------------------------------------------------------------------------
+//Revision 2 argument encodings
+//------------------------------------------------------------------------------
+//Largest number of bytes a varint takes
+#define VARINT_MAX_SIZE 5
+
+//Writes an integer 7 bits at a time, low bits first, the top bit of each byte
+//set if more follow. Returns the number of bytes written
+inline unsigned int encodeVarint(char *out, unsigned int value)
+{
+	unsigned int size = 0;
+
+	while(value >= 0x80) {
+		out[size++] = (char)(value | 0x80);
+		value >>= 7;
+	}
+	out[size++] = (char)value;
+
+	return size;
+}
+
+//Reads a varint, returns the number of bytes read
+inline unsigned int decodeVarint(const char *in, unsigned int *value)
+{
+	unsigned int size = 0;
+	unsigned int shift = 0;
+	unsigned char byte;
+
+	*value = 0;
+	do {
+		byte = (unsigned char)in[size++];
+		*value |= (unsigned int)(byte & 0x7F) << shift;
+		shift += 7;
+	} while((byte & 0x80) && size < VARINT_MAX_SIZE);
+
+	return size;
+}
+
+//Folds a signed integer into an unsigned one, small magnitudes staying small
+//so they make short varints
+inline unsigned int encodeZigzag(int value)
+{
+	return ((unsigned int)value << 1) ^ (unsigned int)(value >> 31);
+}
+
+//Unfolds an integer folded by encodeZigzag
+inline int decodeZigzag(unsigned int value)
+{
+	return (int)(value >> 1) ^ -(int)(value & 1);
+}
+
+//Buffer bits of glClear, GL_COLOR_BUFFER_BIT and friends
+#define CLEAR_COLOR_BIT 0x00004000
+#define CLEAR_DEPTH_BIT 0x00000100
+#define CLEAR_STENCIL_BIT 0x00000400
+#define CLEAR_ACCUM_BIT 0x00000200
+
+//A packed clear mask with this bit set is followed by the full mask as a varint
+#define CLEAR_MASK_RAW 0x80
+
+//Packs a glClear mask into one byte, one bit per buffer
+inline unsigned char packClearMask(unsigned int mask)
+{
+	unsigned char packed = 0;
+
+	if(mask & ~(CLEAR_COLOR_BIT | CLEAR_DEPTH_BIT | CLEAR_STENCIL_BIT | CLEAR_ACCUM_BIT))
+		return CLEAR_MASK_RAW;
+
+	if(mask & CLEAR_COLOR_BIT) packed |= 1;
+	if(mask & CLEAR_DEPTH_BIT) packed |= 2;
+	if(mask & CLEAR_STENCIL_BIT) packed |= 4;
+	if(mask & CLEAR_ACCUM_BIT) packed |= 8;
+
+	return packed;
+}
+
+//Turns a packed clear mask back into a glClear mask
+inline unsigned int unpackClearMask(unsigned char packed)
+{
+	unsigned int mask = 0;
+
+	if(packed & 1) mask |= CLEAR_COLOR_BIT;
+	if(packed & 2) mask |= CLEAR_DEPTH_BIT;
+	if(packed & 4) mask |= CLEAR_STENCIL_BIT;
+	if(packed & 8) mask |= CLEAR_ACCUM_BIT;
+
+	return mask;
+}
+
+//------------------------------------------------------------------------------
+//Commands
+//------------------------------------------------------------------------------
+//Every command in the stream, in opcode order. Adding a command takes a line
+//here: its encoder push_<name> in RGLInterface and its rule in GLPeephole are
+//generated from the line, and so is its handler _<name> in GLNode unless the
+//command needs more than an OpenGL call.
+//The fixed arguments of a command are sent as its clear masks, then its enums
+//and unsigned integers, then its floats; variable data follows them
+
+//Flags of a command: it only draws, so a node that skips a frame can go
+//without it, or it ends a displayed frame
+#define COMMAND_DROPPABLE 1
+#define COMMAND_FRAME_END 2
+
+//Handlers: GL passes the fixed arguments straight to the OpenGL function of
+//the same name, NODE runs a handler written in GLNode
+
+//What a command does for the peephole pass, its role PEEPHOLE_<role>:
+//BARRIER: anything, the pass forgets what the nodes have
+//OTHER: leaves the state, the matrix and runs alone
+//FRAME: ends or stands in for a displayed frame, nodes may reset their
+//matrices after it
+//STATE: sets a state value to its arguments
+//TRANSFORM: multiplies the matrix, LOAD: replaces it
+//BEGIN, END, VERTEX: glBegin, glEnd and glVertex of an unpacked run
+//BLOCK: draws a packed or compact block, which may carry colors
+//CACHED: draws a cached block or copies of a block, which may carry colors
+#define PEEPHOLE_BARRIER 0
+#define PEEPHOLE_OTHER 1
+#define PEEPHOLE_FRAME 2
+#define PEEPHOLE_STATE 3
+#define PEEPHOLE_TRANSFORM 4
+#define PEEPHOLE_LOAD 5
+#define PEEPHOLE_BEGIN 6
+#define PEEPHOLE_END 7
+#define PEEPHOLE_VERTEX 8
+#define PEEPHOLE_BLOCK 9
+#define PEEPHOLE_CACHED 10
+
+//State value PEEPHOLE_<state> a STATE command sets, or the one a block's
+//colors leave undefined. NONE for the other roles, it comes after the real
+//states so it names none of them
+#define PEEPHOLE_COLOR 0
+#define PEEPHOLE_CLEAR_COLOR 1
+#define PEEPHOLE_NONE 2
+
+//Joinable is 1 if two glBegin/glEnd runs can still be joined across the
+//command
+#define GL_COMMANDS(X) \
+	/*opcode, name,              masks, integers, floats, flags, handler, role, state, joinable*/ \
+	X(0, Sync,                  0, 0, 0, COMMAND_FRAME_END, NODE, FRAME, NONE, 0) \
+	X(1, glClearColor,          0, 0, 4, 0, GL, STATE, CLEAR_COLOR, 0) \
+	X(2, glClear,               1, 0, 0, COMMAND_DROPPABLE, GL, OTHER, NONE, 0) \
+	X(3, glLoadIdentity,        0, 0, 0, 0, GL, LOAD, NONE, 0) \
+	X(4, glTranslatef,          0, 0, 3, 0, GL, TRANSFORM, NONE, 0) \
+	X(5, glBegin,               0, 1, 0, COMMAND_DROPPABLE, GL, BEGIN, NONE, 0) \
+	X(6, glEnd,                 0, 0, 0, COMMAND_DROPPABLE, GL, END, NONE, 0) \
+	X(7, glVertex3f,            0, 0, 3, COMMAND_DROPPABLE, GL, VERTEX, NONE, 0) \
+	X(8, glColor3f,             0, 0, 3, 0, GL, STATE, COLOR, 1) \
+	X(9, glRotatef,             0, 0, 4, 0, GL, TRANSFORM, NONE, 0) \
+	X(10, glScalef,              0, 0, 3, 0, GL, TRANSFORM, NONE, 0) \
+	X(11, glDrawVertices,        0, 3, 0, COMMAND_DROPPABLE, NODE, BLOCK, COLOR, 0) \
+	X(12, glDrawCompactVertices, 0, 3, 6, COMMAND_DROPPABLE, NODE, BLOCK, COLOR, 0) \
+	X(13, SwapBarrier,           0, 1, 0, 0, NODE, FRAME, NONE, 0) \
+	X(14, Swap,                  0, 1, 0, COMMAND_FRAME_END, NODE, FRAME, NONE, 0) \
+	X(15, ClockProbe,            0, 1, 0, 0, NODE, OTHER, NONE, 0) \
+	X(16, ClockOffset,           0, 3, 0, 0, NODE, OTHER, NONE, 0) \
+	X(17, PresentAt,             0, 3, 0, COMMAND_FRAME_END, NODE, FRAME, NONE, 0) \
+	X(18, SkipFrame,             0, 0, 0, 0, NODE, FRAME, NONE, 0) \
+	X(19, CacheStore,            0, 1, 0, 0, NODE, OTHER, NONE, 0) \
+	X(20, CacheDraw,             0, 1, 0, COMMAND_DROPPABLE, NODE, CACHED, COLOR, 0) \
+	X(21, glLoadMatrixf,         0, 0, 16, 0, GL, LOAD, NONE, 0) \
+	X(22, DrawInstances,         0, 2, 0, COMMAND_DROPPABLE, NODE, CACHED, COLOR, 0)
+
+//Fixed arguments of each shape of command, named by its number of masks,
+//integers and floats. PARAMETERS declares them as parameters and ARGUMENTS
+//passes them on, PUSH encodes them in RGLInterface and READ declares and
+//decodes them in GLNode. Up to 4 floats are passed one by one, more as an
+//array. A command with a new shape needs a line in each
+#define GL_PARAMETERS_0_0_0
+#define GL_PARAMETERS_1_0_0 GLbitfield m0
+#define GL_PARAMETERS_0_1_0 GLuint i0
+#define GL_PARAMETERS_0_2_0 GLuint i0, GLuint i1
+#define GL_PARAMETERS_0_3_0 GLuint i0, GLuint i1, GLuint i2
+#define GL_PARAMETERS_0_0_3 GLfloat f0, GLfloat f1, GLfloat f2
+#define GL_PARAMETERS_0_0_4 GLfloat f0, GLfloat f1, GLfloat f2, GLfloat f3
+#define GL_PARAMETERS_0_0_16 const GLfloat *f
+#define GL_PARAMETERS_0_3_6 GLuint i0, GLuint i1, GLuint i2, const GLfloat *f
+
+#define GL_ARGUMENTS_0_0_0
+#define GL_ARGUMENTS_1_0_0 m0
+#define GL_ARGUMENTS_0_1_0 i0
+#define GL_ARGUMENTS_0_2_0 i0, i1
+#define GL_ARGUMENTS_0_3_0 i0, i1, i2
+#define GL_ARGUMENTS_0_0_3 f0, f1, f2
+#define GL_ARGUMENTS_0_0_4 f0, f1, f2, f3
+#define GL_ARGUMENTS_0_0_16 f
+#define GL_ARGUMENTS_0_3_6 i0, i1, i2, f
+
+#define GL_PUSH_0_0_0
+#define GL_PUSH_1_0_0 pushGLbitfield(m0);
+#define GL_PUSH_0_1_0 pushGLuint(i0);
+#define GL_PUSH_0_2_0 pushGLuint(i0); pushGLuint(i1);
+#define GL_PUSH_0_3_0 pushGLuint(i0); pushGLuint(i1); pushGLuint(i2);
+#define GL_PUSH_0_0_3 pushGLfloat(f0); pushGLfloat(f1); pushGLfloat(f2);
+#define GL_PUSH_0_0_4 pushGLfloat(f0); pushGLfloat(f1); pushGLfloat(f2); pushGLfloat(f3);
+#define GL_PUSH_0_0_16 for(int n = 0; n < 16; n++) pushGLfloat(f[n]);
+#define GL_PUSH_0_3_6 pushGLuint(i0); pushGLuint(i1); pushGLuint(i2); for(int n = 0; n < 6; n++) pushGLfloat(f[n]);
+
+#define GL_READ_0_0_0
+#define GL_READ_1_0_0 GLbitfield m0; getGLbitfield(&m0);
+#define GL_READ_0_1_0 GLuint i0; getGLuint(&i0);
+#define GL_READ_0_2_0 GLuint i0, i1; getGLuint(&i0); getGLuint(&i1);
+#define GL_READ_0_3_0 GLuint i0, i1, i2; getGLuint(&i0); getGLuint(&i1); getGLuint(&i2);
+#define GL_READ_0_0_3 GLfloat f0, f1, f2; getGLfloat(&f0); getGLfloat(&f1); getGLfloat(&f2);
+#define GL_READ_0_0_4 GLfloat f0, f1, f2, f3; getGLfloat(&f0); getGLfloat(&f1); getGLfloat(&f2); getGLfloat(&f3);
+#define GL_READ_0_0_16 GLfloat f[16]; for(int n = 0; n < 16; n++) getGLfloat(&f[n]);
+#define GL_READ_0_3_6 GLuint i0, i1, i2; GLfloat f[6]; getGLuint(&i0); getGLuint(&i1); getGLuint(&i2); for(int n = 0; n < 6; n++) getGLfloat(&f[n]);
+
+//Name of a list for the shape of a command
+#define GL_SHAPE(list, masks, integers, floats) list##_##masks##_##integers##_##floats
+
+//Opcodes, OPCODE_<name>
+#define GL_COMMAND_OPCODE(opcode, name, masks, integers, floats, flags, handler, role, state, joinable) OPCODE_##name = opcode,
+enum GLOpcode {
+	GL_COMMANDS(GL_COMMAND_OPCODE)
+	OPCODE_COUNT
+};
+
+//Bytes of the fixed arguments in revision 1, ARGS_<name>
+#define GL_COMMAND_ARGS(opcode, name, masks, integers, floats, flags, handler, role, state, joinable) ARGS_##name = 4 * (masks + integers + floats),
+enum GLCommandArgs {
+	GL_COMMANDS(GL_COMMAND_ARGS)
+	ARGS_UNUSED
+};
+
+//Position of each command in the table
+#define GL_COMMAND_POSITION(opcode, name, masks, integers, floats, flags, handler, role, state, joinable) POSITION_##name,
+enum GLCommandPosition {
+	GL_COMMANDS(GL_COMMAND_POSITION)
+	POSITION_COUNT
+};
+
+//Fails to compile if the table isn't in opcode order without gaps, tables
+//indexed by opcode are generated from it
+#define GL_COMMAND_CHECK(opcode, name, masks, integers, floats, flags, handler, role, state, joinable) typedef char check_##name[(POSITION_##name == opcode) ? 1 : -1];
+GL_COMMANDS(GL_COMMAND_CHECK)
+
+//Revision 2 opcodes are one byte and revision 1 arguments are 4 bytes each
+typedef char check_opcode_size[(OPCODE_COUNT <= 256) ? 1 : -1];
+typedef char check_float_size[(sizeof(float) == 4 && sizeof(unsigned int) == 4) ? 1 : -1];
+
+//Fixed arguments of each command, indexed by opcode
+struct GLCommandInfo {
+	const char *name;
+	unsigned char masks;
+	unsigned char integers;
+	unsigned char floats;
+	unsigned char flags;
+};
+
+#define GL_COMMAND_INFO(opcode, name, masks, integers, floats, flags, handler, role, state, joinable) {#name, masks, integers, floats, flags},
+static const GLCommandInfo gl_commands[OPCODE_COUNT] = {
+	GL_COMMANDS(GL_COMMAND_INFO)
+};
+
+//11: a glBegin/glEnd run sent as one block. Followed by the mode, the vertex
+//count, flags and the vertices, each x, y, z and then r, g, b if the block
+//has colors
+#define PACKED_VERTICES OPCODE_glDrawVertices
+
+//Set in the flags of a packed block when each vertex carries a color
+#define PACKED_VERTICES_COLORS 1
+
+//Number of floats each vertex of a packed block takes
+inline unsigned int packedVertexFloats(unsigned int flags)
+{
+	return (flags & PACKED_VERTICES_COLORS) ? 6 : 3;
+}
+
+//12: a packed run with quantized attributes, used with FEATURE_COMPACT_VERTICES.
+//Followed by the mode, the vertex count, flags, the corner of the run's
+//bounding box and the size of one quantization step on each axis. Positions
+//come next as planes of x, y and z, either 16 bit steps from the corner or
+//the first vertex followed by the steps between neighbouring vertices as
+//zigzag varints. If the run has colors they follow as RGBA8, starting on a 4
+//byte boundary
+#define COMPACT_VERTICES OPCODE_glDrawCompactVertices
+
+//Set in the flags of a compact block when positions are sent as deltas. The
+//bytes the deltas take are kept in the flags above COMPACT_DELTA_SHIFT
+#define COMPACT_VERTICES_DELTA 2
+#define COMPACT_DELTA_SHIFT 8
+
+//Number of quantization steps across the bounding box
+#define COMPACT_POSITION_STEPS 65535
+
+//Bytes of a compact block that follow its header
+inline unsigned int compactDataSize(unsigned int count, unsigned int flags)
+{
+	unsigned int size;
+
+	if(count == 0)
+		return 0;
+
+	if(flags & COMPACT_VERTICES_DELTA)
+		size = 3 * sizeof(unsigned short) + (flags >> COMPACT_DELTA_SHIFT);
+	else
+		size = 3 * sizeof(unsigned short) * count;
+
+	//Colors start on a 4 byte boundary
+	size = (size + 3) & ~3;
+	if(flags & PACKED_VERTICES_COLORS)
+		size += 4 * count;
+
+	return size;
+}
+
+//13: ends a frame like Sync, but the node only reports the frame number with
+//BACKCHANNEL_FRAME_READY once it is drawn and doesn't swap yet
+//14: releases the swap barrier, the node swaps the frame with this number.
+//The host sends it once every node is ready, before any of the next frame. It
+//ends the displayed frame the way Sync does
+//15: the node answers with BACKCHANNEL_CLOCK carrying the probe number and its
+//clock when it ran the probe
+//16: the node at an index in the handshake should add an offset to host
+//times to get its own, sent as the low and then high 32 bits
+//17: ends a frame like Sync, the node presents it when its clock reaches the
+//given host time and reports BACKCHANNEL_PRESENTED. Followed by the frame
+//number and the time as low and high 32 bits
+//18: takes the place of the end of a frame the host dropped for a node that
+//fell behind. The node counts the frame as done without drawing or swapping
+//19: stores a vertex block in a slot of the node's geometry cache, used with
+//FEATURE_GEOMETRY_CACHE. Followed by the slot and then a whole packed or
+//compact block command, which the node keeps instead of drawing. The host
+//picks the slots and sends every node the same stores, so this is never
+//culled or dropped
+//20: draws the block stored in a slot of the geometry cache
+//21: replaces the current matrix with 16 floats in column major order. The
+//host folds runs of glLoadIdentity, glTranslatef, glRotatef and glScalef into
+//one of these, sent just before the next draw
+//22: draws one vertex block under several matrices, used with
+//FEATURE_INSTANCING. Followed by the number of copies, flags, the matrix of
+//each copy in column major order and then a whole packed or compact block or
+//CacheDraw command. The node draws the block once under each matrix and
+//leaves its own matrix as it was
+
+//Set in the flags of an instanced draw when every matrix has 0, 0, 0, 1 as its
+//bottom row. It is left out, so each matrix is the top three rows of each
+//column, 12 floats
+#define INSTANCES_AFFINE 1
+
+//Number of floats each matrix of an instanced draw takes
+inline unsigned int instanceMatrixFloats(unsigned int flags)
+{
+	return (flags & INSTANCES_AFFINE) ? 12 : 16;
+}
+
+//Most slots the host can use in a node's geometry cache
+#define CACHE_MAX_SLOTS 65536
+
+//Joins the two halves of a 64 bit value sent as 32 bit arguments
+inline unsigned long long joinHalves(unsigned int low, unsigned int high)
+{
+	return ((unsigned long long)high << 32) | low;
+}
+
+//------------------------------------------------------------------------------
+//Delta frames, used with FEATURE_DELTA_FRAMES on length prefixed streams
+//------------------------------------------------------------------------------
+//Each length prefixed chunk starts with a byte holding its type, with
+//DELTA_FRAME_END set if the chunk ends a displayed frame. Both sides then make
+//the frame they just finished the one the next frame's edits refer to
+//DELTA_RAW: the commands follow as they are
+//DELTA_EDIT: followed by varints for the length of the commands and of the
+//last frame, then operations until the commands are complete. Each operation
+//is a varint holding its length shifted left by one, with the low bit set for
+//a copy. A copy is followed by a varint offset into the last frame, a literal
+//by its bytes
+//DELTA_KEYFRAME: a raw chunk starting a frame that refers to nothing before it
+#define DELTA_RAW 0
+#define DELTA_EDIT 1
+#define DELTA_KEYFRAME 2
+#define DELTA_TYPE_MASK 0x0F
+#define DELTA_FRAME_END 0x80
+
+//Operation types in the low bit of an operation's length
+#define DELTA_LITERAL 0
+#define DELTA_COPY 1
+
+//------------------------------------------------------------------------------
+//Multicast transport
+//------------------------------------------------------------------------------
+//Marks a datagram as a multicast fragment of the command stream
+#define MULTICAST_MAGIC 0x574C4D43
+
+//Bytes of command data carried by each datagram
+#define MULTICAST_PAYLOAD_SIZE 1400
+
+//Fragment index used in a NACK to ask for every fragment of a frame
+#define MULTICAST_ALL_FRAGMENTS 0xFFFFFFFF
+
+//Number of datagrams needed to send a frame, empty frames still take one
+inline unsigned int multicastFragments(unsigned int length)
+{
+	if(length == 0)
+		return 1;
+	return (length + MULTICAST_PAYLOAD_SIZE - 1) / MULTICAST_PAYLOAD_SIZE;
+}
+
+//Header at the start of each multicast datagram
+struct MulticastHeader
+{
+	//Always MULTICAST_MAGIC
+	unsigned int magic;
+
+	//Sequence number of the frame this fragment belongs to
+	unsigned int frame;
+
+	//Index of this fragment and the number of fragments in the frame
+	unsigned int fragment;
+	unsigned int fragments;
+
+	//Total length of the frame in bytes
+	unsigned int length;
+};
+
+//------------------------------------------------------------------------------
+//Backchannel, messages sent from a node to the host over the pipe socket
+//------------------------------------------------------------------------------
+//A multicast fragment went missing: args are the frame and fragment index
+#define BACKCHANNEL_NACK 1
+
+//Reply to the handshake: args[0] holds the features the node accepted and
+//args[1] the protocol revision to use
+#define BACKCHANNEL_FEATURES 2
+
+//Sent by a node when a frame ended by SwapBarrier is drawn, args[0] is the
+//frame number
+#define BACKCHANNEL_FRAME_READY 3
+
+//Answer to a ClockProbe: args[0] is the probe number, args[1] and args[2] the
+//node's clock in microseconds, low and high 32 bits
+#define BACKCHANNEL_CLOCK 4
+
+//Sent by a node after presenting a frame ended by PresentAt: args[0] is the
+//frame number, args[1] and args[2] when it was presented in host time
+#define BACKCHANNEL_PRESENTED 5
+
+//Sent by a node after each swap: args[0] is the number of frames it has
+//finished, the host uses it to limit the frames in flight
+#define BACKCHANNEL_FRAME_DONE 6
+
+//Sent by a node that could not apply a delta frame, it skips chunks until a
+//keyframe arrives. The host forgets the cache slots and state it thought the
+//nodes had before it starts the keyframe, so the node keeps its cache
+#define BACKCHANNEL_KEYFRAME 7
+
+struct BackchannelMessage
+{
+	//Type of message
+	unsigned int type;
+
+	//Message specific arguments
+	unsigned int args[3];
+};
+
+#endif
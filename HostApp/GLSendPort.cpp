@@ -0,0 +1,185 @@
+/*----------------------------------------------------------------------------*\
+|Sends for every pipe from one thread through an I/O completion port. A frame |
+|queued on all pipes wakes the thread once, it posts every pipe's send in one |
+|pass and collects finished sends in batches instead of one thread per node.  |
+|                                                                              |
+|Stewart Hall                                                                  |
+|10/17/2026                                                                    |
+\*----------------------------------------------------------------------------*/
+
+#include "GLPipe.h"
+#include "GLSendPort.h"
+
+//A finished operation as returned by GetQueuedCompletionStatusEx, declared
+//here since older SDKs only have it for Vista and later
+struct PortEntry
+{
+	ULONG_PTR key;
+	LPOVERLAPPED overlapped;
+	ULONG_PTR internal;
+	DWORD bytes;
+};
+
+//GetQueuedCompletionStatusEx, looked up at run time so XP falls back to
+//taking one completion per call
+typedef BOOL (WINAPI *GetCompletionsFunc)(HANDLE port, PortEntry *entries, ULONG count,
+	ULONG *removed, DWORD timeout, BOOL alertable);
+
+//Completion key of the wake up posted by wake, pipes use their address
+#define SEND_PORT_WAKE 0
+
+//Entry point for the port thread
+static void PortShell(void *param)
+{
+	((GLSendPort*)param)->portMain();
+}
+
+//Constructor
+GLSendPort::GLSendPort(int i_pipe_capacity)
+{
+	port = NULL;
+	pipe_capacity = i_pipe_capacity;
+	pipes = new GLPipe*[pipe_capacity];
+	pipe_count = 0;
+	attach_lock = new GLLock();
+	thread = NULL;
+	running = 0;
+	wake_pending = 0;
+	get_completions = NULL;
+	wakeups = 0;
+	completions = 0;
+}
+
+//Destructor
+GLSendPort::~GLSendPort()
+{
+	close();
+	if(port)
+		CloseHandle((HANDLE)port);
+	delete[] pipes;
+	delete attach_lock;
+}
+
+//Creates the completion port, returns false if the OS has none
+bool GLSendPort::open()
+{
+	port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+	if(!port) {
+		printf("Error %d creating a completion port\n", GetLastError());
+		return false;
+	}
+
+	HMODULE kernel = GetModuleHandle("kernel32.dll");
+	if(kernel)
+		get_completions = GetProcAddress(kernel, "GetQueuedCompletionStatusEx");
+
+	return true;
+}
+
+//Sends a pipe's frames through the port from now on
+bool GLSendPort::attach(GLPipe *pipe, unsigned int sock)
+{
+	attach_lock->lock();
+	if(pipe_count == pipe_capacity) {
+		attach_lock->unlock();
+		return false;
+	}
+
+	if(!CreateIoCompletionPort((HANDLE)sock, (HANDLE)port, (ULONG_PTR)pipe, 0)) {
+		printf("Error %d adding a socket to the completion port\n", GetLastError());
+		attach_lock->unlock();
+		return false;
+	}
+
+	pipes[pipe_count++] = pipe;
+	attach_lock->unlock();
+	return true;
+}
+
+//Starts the thread once every pipe is attached
+bool GLSendPort::start()
+{
+	running = 1;
+	thread = new GLThread(PortShell, this);
+	if(!thread->start()) {
+		printf("Could not start the send port thread\n");
+		delete thread;
+		thread = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+//Wakes the thread to send newly queued frames
+void GLSendPort::wake()
+{
+	//One wake up covers every frame queued before the thread takes it
+	if(atomicIncrement(&wake_pending) == 1)
+		PostQueuedCompletionStatus((HANDLE)port, 0, SEND_PORT_WAKE, NULL);
+}
+
+//Sends everything still queued and stops the thread
+void GLSendPort::close()
+{
+	if(!thread)
+		return;
+
+	atomicStore(&running, 0);
+	PostQueuedCompletionStatus((HANDLE)port, 0, SEND_PORT_WAKE, NULL);
+	thread->join();
+	delete thread;
+	thread = NULL;
+}
+
+//Posts sends and collects completions until closed, runs on its thread
+void GLSendPort::portMain()
+{
+	PortEntry entries[SEND_PORT_BATCH];
+	ULONG count;
+
+	for(;;) {
+		//Post what every pipe has queued
+		bool idle = true;
+		for(int i = 0; i < pipe_count; i++) {
+			if(!pipes[i]->pumpSends())
+				idle = false;
+		}
+
+		//Exit once closed and every pipe has sent everything
+		if(!atomicLoad(&running) && idle)
+			break;
+
+		//Sleep until a send finishes or more frames are queued
+		if(get_completions) {
+			if(!((GetCompletionsFunc)get_completions)((HANDLE)port, entries, SEND_PORT_BATCH, &count, INFINITE, FALSE))
+				continue;
+		} else {
+			DWORD bytes;
+			entries[0].overlapped = NULL;
+			if(!GetQueuedCompletionStatus((HANDLE)port, &bytes, &entries[0].key, &entries[0].overlapped, INFINITE) &&
+				!entries[0].overlapped)
+				continue;
+			count = 1;
+		}
+		wakeups++;
+
+		//Failed sends come back too, the pipe finds the error when it retires them
+		for(ULONG i = 0; i < count; i++) {
+			if(entries[i].key == SEND_PORT_WAKE) {
+				atomicStore(&wake_pending, 0);
+				continue;
+			}
+
+			((GLPipe*)entries[i].key)->sendCompleted(entries[i].overlapped);
+			completions++;
+		}
+	}
+}
+
+//Prints out how many completions each wake up collected
+void GLSendPort::printStats()
+{
+	if(wakeups > 0)
+		printf("Send port: %u wakeups, %.2f completions per wakeup\n", wakeups, (double)completions / wakeups);
+}
@@ -0,0 +1,76 @@
+/*----------------------------------------------------------------------------*\
+|Sends for every pipe from one thread through an I/O completion port. A frame |
+|queued on all pipes wakes the thread once, it posts every pipe's send in one |
+|pass and collects finished sends in batches instead of one thread per node.  |
+|                                                                              |
+|Stewart Hall                                                                  |
+|10/17/2026                                                                    |
+\*----------------------------------------------------------------------------*/
+
+#ifndef GLSENDPORT_H
+#define GLSENDPORT_H
+
+#include "GLThread.h"
+
+//Most finished sends collected with one call
+#define SEND_PORT_BATCH 64
+
+class GLPipe;
+
+class GLSendPort
+{
+private:
+	//OS handle of the completion port
+	void *port;
+
+	//Pipes sending through the port
+	GLPipe **pipes;
+	int pipe_count;
+	int pipe_capacity;
+
+	//Guards the pipes while they attach, they connect on threads of their own
+	GLLock *attach_lock;
+
+	//Thread posting sends and collecting their completions
+	GLThread *thread;
+
+	//Non-zero while the thread should keep running
+	volatile long running;
+
+	//Non-zero while a wake up is queued on the port and not yet taken
+	volatile long wake_pending;
+
+	//Collects several completions at once where the OS can, or NULL
+	void *get_completions;
+
+	//Number of times the thread woke up and completions it collected
+	unsigned int wakeups;
+	unsigned int completions;
+
+public:
+	GLSendPort(int i_pipe_capacity);
+	~GLSendPort();
+
+	//Creates the completion port, returns false if the OS has none
+	bool open();
+
+	//Sends a pipe's frames through the port from now on
+	bool attach(GLPipe *pipe, unsigned int sock);
+
+	//Starts the thread once every pipe is attached
+	bool start();
+
+	//Wakes the thread to send newly queued frames
+	void wake();
+
+	//Sends everything still queued and stops the thread
+	void close();
+
+	//Posts sends and collects completions until closed, runs on its thread
+	void portMain();
+
+	//Prints out how many completions each wake up collected
+	void printStats();
+};
+
+#endif
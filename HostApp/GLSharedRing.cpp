@@ -0,0 +1,302 @@
+/*----------------------------------------------------------------------------*\
+|A byte ring in shared memory that carries the command stream from the host to |
+|a node on the same machine, so it doesn't go through the loopback stack. Each |
+|side only makes a system call to wake the other when the other is asleep.     |
+|                                                                              |
+|Stewart Hall                                                                  |
+|10/17/2026                                                                    |
+\*----------------------------------------------------------------------------*/
+
+#include <windows.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "GLSharedRing.h"
+
+//Marks the control block as set up by the writer
+#define SHARED_RING_MAGIC 0x574C5352
+
+//Bytes between the fields each side writes, so they don't share a cache line
+#define SHARED_RING_LINE 64
+
+//Control block at the start of the shared memory. Positions count every byte
+//ever written or read and wrap around, so they are only ever subtracted
+struct SharedRingHeader
+{
+	//Set up by the writer
+	volatile long magic;
+	unsigned int size;
+	volatile long closed;
+	char pad0[SHARED_RING_LINE - 3 * sizeof(long)];
+
+	//Written by the writer: how far it has written and if it waits for space
+	volatile long write_position;
+	volatile long writer_waiting;
+	char pad1[SHARED_RING_LINE - 2 * sizeof(long)];
+
+	//Written by the reader: how far it has read and if it waits for data
+	volatile long read_position;
+	volatile long reader_waiting;
+	char pad2[SHARED_RING_LINE - 2 * sizeof(long)];
+};
+
+//Constructor
+GLSharedRing::GLSharedRing()
+{
+	mapping = NULL;
+	data_event = NULL;
+	space_event = NULL;
+	header = NULL;
+	data = NULL;
+	size = 0;
+}
+
+//Destructor
+GLSharedRing::~GLSharedRing()
+{
+	close();
+}
+
+//Creates a ring holding at least i_size bytes, done by the writer
+bool GLSharedRing::create(const char *name, unsigned int i_size)
+{
+	//Positions are masked into the ring, so its size is a power of two
+	size = 4096;
+	while(size < i_size)
+		size *= 2;
+
+	mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0,
+		sizeof(SharedRingHeader) + size, name);
+	if(!mapping) {
+		printf("Error %d creating shared memory %s\n", GetLastError(), name);
+		return false;
+	}
+
+	//A section that already exists keeps its own size and may still be used
+	//by someone else, so it is never taken over
+	if(GetLastError() == ERROR_ALREADY_EXISTS) {
+		printf("Shared memory %s is already in use\n", name);
+		CloseHandle(mapping);
+		mapping = NULL;
+		return false;
+	}
+
+	header = (SharedRingHeader*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	if(!header) {
+		printf("Error %d mapping shared memory %s\n", GetLastError(), name);
+		close();
+		return false;
+	}
+	data = (char*)header + sizeof(SharedRingHeader);
+
+	if(!openEvents(name, true)) {
+		close();
+		return false;
+	}
+
+	//Only mark it valid once it is set up
+	atomicStore(&header->magic, 0);
+	header->size = size;
+	header->closed = 0;
+	header->write_position = 0;
+	header->writer_waiting = 0;
+	header->read_position = 0;
+	header->reader_waiting = 0;
+	atomicStore(&header->magic, SHARED_RING_MAGIC);
+
+	return true;
+}
+
+//Opens a ring created by the writer, done by the reader
+bool GLSharedRing::open(const char *name)
+{
+	mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name);
+	if(!mapping) {
+		printf("Error %d opening shared memory %s\n", GetLastError(), name);
+		return false;
+	}
+
+	header = (SharedRingHeader*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	if(!header || atomicLoad(&header->magic) != SHARED_RING_MAGIC) {
+		printf("Shared memory %s is not set up\n", name);
+		close();
+		return false;
+	}
+	data = (char*)header + sizeof(SharedRingHeader);
+	size = header->size;
+
+	if(!openEvents(name, false)) {
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+//Opens the events named after the ring, creating them if asked
+bool GLSharedRing::openEvents(const char *name, bool create)
+{
+	char event_name[256];
+
+	_snprintf(event_name, sizeof(event_name) - 1, "%sData", name);
+	event_name[sizeof(event_name) - 1] = 0;
+	data_event = create ? CreateEventA(NULL, FALSE, FALSE, event_name) : OpenEventA(EVENT_ALL_ACCESS, FALSE, event_name);
+
+	_snprintf(event_name, sizeof(event_name) - 1, "%sSpace", name);
+	event_name[sizeof(event_name) - 1] = 0;
+	space_event = create ? CreateEventA(NULL, FALSE, FALSE, event_name) : OpenEventA(EVENT_ALL_ACCESS, FALSE, event_name);
+
+	if(!data_event || !space_event) {
+		printf("Error %d opening the events of shared memory %s\n", GetLastError(), name);
+		return false;
+	}
+
+	return true;
+}
+
+//Tells the other side nothing more is coming and unmaps the ring
+void GLSharedRing::close()
+{
+	if(header) {
+		atomicStore(&header->closed, 1);
+		if(data_event)
+			SetEvent(data_event);
+		if(space_event)
+			SetEvent(space_event);
+		UnmapViewOfFile(header);
+		header = NULL;
+		data = NULL;
+	}
+
+	if(data_event) {
+		CloseHandle(data_event);
+		data_event = NULL;
+	}
+	if(space_event) {
+		CloseHandle(space_event);
+		space_event = NULL;
+	}
+	if(mapping) {
+		CloseHandle(mapping);
+		mapping = NULL;
+	}
+}
+
+//Writes bytes to the ring, waiting for space. Returns false if the reader has
+//gone away
+bool GLSharedRing::write(const char *buffer, unsigned int length)
+{
+	unsigned int written = 0;
+	unsigned int waited = 0;
+
+	while(written < length) {
+		unsigned long position = (unsigned long)header->write_position;
+		unsigned int space = size - (unsigned int)(position - (unsigned long)atomicLoad(&header->read_position));
+
+		if(space == 0) {
+			if(atomicLoad(&header->closed))
+				return false;
+
+			//Ask to be woken, then look again in case the reader just missed it
+			atomicStore(&header->writer_waiting, 1);
+			space = size - (unsigned int)(position - (unsigned long)atomicLoad(&header->read_position));
+			if(space == 0) {
+				if(WaitForSingleObject(space_event, SHARED_RING_WAIT) == WAIT_TIMEOUT) {
+					waited += SHARED_RING_WAIT;
+					if(waited >= SHARED_RING_TIMEOUT) {
+						printf("Shared memory reader stopped taking data\n");
+						return false;
+					}
+				}
+				continue;
+			}
+		}
+		waited = 0;
+
+		//Copy what fits, in two parts if it wraps around the end
+		unsigned int chunk = length - written < space ? length - written : space;
+		unsigned int offset = position & (size - 1);
+		unsigned int first = chunk < size - offset ? chunk : size - offset;
+		memcpy(&data[offset], buffer + written, first);
+		memcpy(data, buffer + written + first, chunk - first);
+
+		//Publish the data, then wake the reader if it went to sleep
+		atomicStore(&header->write_position, (long)(position + chunk));
+		written += chunk;
+		wakeReader();
+	}
+
+	return true;
+}
+
+//Reads up to length bytes without waiting. Returns the number read, or -1
+//once the writer has closed the ring and everything has been read
+int GLSharedRing::read(char *buffer, unsigned int length)
+{
+	unsigned long position = (unsigned long)header->read_position;
+	unsigned int waiting = (unsigned int)((unsigned long)atomicLoad(&header->write_position) - position);
+
+	if(waiting == 0)
+		return atomicLoad(&header->closed) ? -1 : 0;
+
+	unsigned int chunk = length < waiting ? length : waiting;
+	unsigned int offset = position & (size - 1);
+	unsigned int first = chunk < size - offset ? chunk : size - offset;
+	memcpy(buffer, &data[offset], first);
+	memcpy(buffer + first, data, chunk - first);
+
+	//Free the space, then wake the writer if it is waiting for it
+	atomicStore(&header->read_position, (long)(position + chunk));
+	wakeWriter();
+
+	return (int)chunk;
+}
+
+//Returns true if data or the close can be read, waiting up to timeout
+//milliseconds for it
+bool GLSharedRing::waitReadable(unsigned int timeout)
+{
+	if(header->write_position != header->read_position || atomicLoad(&header->closed))
+		return true;
+	if(timeout == 0)
+		return false;
+
+	prepareWait();
+	if(atomicLoad(&header->write_position) == header->read_position && !atomicLoad(&header->closed))
+		WaitForSingleObject(data_event, timeout);
+
+	return atomicLoad(&header->write_position) != header->read_position || atomicLoad(&header->closed);
+}
+
+//Asks the writer to signal the data handle for the next write. Called before
+//a last check for data and a wait on the handle
+void GLSharedRing::prepareWait()
+{
+	atomicStore(&header->reader_waiting, 1);
+}
+
+//Returns the OS handle signalled when data is written while the reader waits
+void *GLSharedRing::getDataHandle()
+{
+	return data_event;
+}
+
+//Wakes the reader if it is waiting for data
+void GLSharedRing::wakeReader()
+{
+	//The flag is set before the reader looks at the position for the last
+	//time, so a reader about to sleep always sees the data or gets the signal
+	if(atomicLoad(&header->reader_waiting)) {
+		atomicStore(&header->reader_waiting, 0);
+		SetEvent(data_event);
+	}
+}
+
+//Wakes the writer if it is waiting for space
+void GLSharedRing::wakeWriter()
+{
+	if(atomicLoad(&header->writer_waiting)) {
+		atomicStore(&header->writer_waiting, 0);
+		SetEvent(space_event);
+	}
+}
@@ -0,0 +1,86 @@
+/*----------------------------------------------------------------------------*\
+|A byte ring in shared memory that carries the command stream from the host to |
+|a node on the same machine, so it doesn't go through the loopback stack. Each |
+|side only makes a system call to wake the other when the other is asleep.     |
+|                                                                              |
+|Stewart Hall                                                                  |
+|10/17/2026                                                                    |
+\*----------------------------------------------------------------------------*/
+
+#ifndef GLSHAREDRING_H
+#define GLSHAREDRING_H
+
+#include "GLThread.h"
+
+//Default bytes of command data the ring holds
+#define SHARED_RING_SIZE 4194304
+
+//Milliseconds a full ring is waited on before checking the other side again
+#define SHARED_RING_WAIT 100
+
+//Milliseconds a full ring can go without space freeing up before the reader
+//is given up on
+#define SHARED_RING_TIMEOUT 10000
+
+//Control block at the start of the shared memory, defined with the ring code
+struct SharedRingHeader;
+
+class GLSharedRing
+{
+private:
+	//OS handles of the file mapping and of the events signalled when data is
+	//written and when space is freed
+	void *mapping;
+	void *data_event;
+	void *space_event;
+
+	//The mapped control block and the data that follows it
+	SharedRingHeader *header;
+	char *data;
+
+	//Bytes the ring holds, a power of two
+	unsigned int size;
+
+	//Wakes the reader if it is waiting for data
+	void wakeReader();
+
+	//Wakes the writer if it is waiting for space
+	void wakeWriter();
+
+	//Opens the events named after the ring, creating them if asked
+	bool openEvents(const char *name, bool create);
+
+public:
+	GLSharedRing();
+	~GLSharedRing();
+
+	//Creates a ring holding at least i_size bytes, done by the writer
+	bool create(const char *name, unsigned int i_size);
+
+	//Opens a ring created by the writer, done by the reader
+	bool open(const char *name);
+
+	//Tells the other side nothing more is coming and unmaps the ring
+	void close();
+
+	//Writes bytes to the ring, waiting for space. Returns false if the reader
+	//has gone away
+	bool write(const char *buffer, unsigned int length);
+
+	//Reads up to length bytes without waiting. Returns the number read, or -1
+	//once the writer has closed the ring and everything has been read
+	int read(char *buffer, unsigned int length);
+
+	//Returns true if data or the close can be read, waiting up to timeout
+	//milliseconds for it
+	bool waitReadable(unsigned int timeout);
+
+	//Asks the writer to signal the data handle for the next write. Called
+	//before a last check for data and a wait on the handle
+	void prepareWait();
+
+	//Returns the OS handle signalled when data is written while the reader waits
+	void *getDataHandle();
+};
+
+#endif
@@ -0,0 +1,508 @@
+/*----------------------------------------------------------------------------*\
+|Sockets for the connections between the host and the nodes. Hides the        |
+|differences between Winsock and BSD sockets, and waits on many sockets with   |
+|epoll on Linux, poll on other POSIX systems and select on Windows.            |
+|                                                                              |
+|Stewart Hall                                                                  |
+|10/17/2026                                                                    |
+\*----------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "GLSocket.h"
+
+#ifdef _WIN32
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <errno.h>
+#include <fcntl.h>
+#ifdef SOCKET_EPOLL
+#include <sys/epoll.h>
+#endif
+#endif
+
+//Milliseconds a non-blocking send or receive waits before trying again
+#define SOCKET_RETRY_WAIT 100
+
+//Sets up the OS socket library, returns false if it can't be used
+bool socketStartup()
+{
+#ifdef _WIN32
+	WSADATA wsaData;
+	int starterr = WSAStartup(MAKEWORD(2,2), &wsaData);
+
+	//Error checking
+	if(starterr != 0) {
+		printf("Error %d occurred!\n",  starterr);
+		return false;
+	}
+#endif
+
+	return true;
+}
+
+//Releases the OS socket library
+void socketCleanup()
+{
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
+
+//Returns the error code of the last failed socket call
+int socketError()
+{
+#ifdef _WIN32
+	return WSAGetLastError();
+#else
+	return errno;
+#endif
+}
+
+//Returns true if the last failed call would have had to wait
+bool socketWouldBlock()
+{
+#ifdef _WIN32
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+	return errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR;
+#endif
+}
+
+//Connects to a port on an address, giving up after timeout milliseconds.
+//Returns INVALID_SOCKET on failure
+SOCKET socketConnect(const char *address, int port, unsigned int timeout)
+{
+	int error = 0;
+
+	//Create the socket
+	SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if(sock == INVALID_SOCKET) {
+		printf("Error %d occurred!\n",  socketError());
+		return INVALID_SOCKET;
+	}
+
+	//Connect without blocking so an unreachable node only costs the timeout
+	//instead of the OS's own, which is many seconds
+	if(!socketSetNonBlocking(sock, true)) {
+		socketClose(sock);
+		return INVALID_SOCKET;
+	}
+
+	//Connect to the node
+	sockaddr_in anews;
+	memset(&anews, 0, sizeof(anews));
+	anews.sin_port = htons(port);
+	anews.sin_addr.s_addr = inet_addr(address);
+	anews.sin_family = AF_INET;
+	if(connect(sock, (sockaddr*)&anews, sizeof(anews)) == SOCKET_ERROR) {
+#ifdef _WIN32
+		if(WSAGetLastError() != WSAEWOULDBLOCK) {
+#else
+		if(errno != EINPROGRESS) {
+#endif
+			printf("Error %d occurred!\n",  socketError());
+			socketClose(sock);
+			return INVALID_SOCKET;
+		}
+
+		//The socket becomes writable once connected. Windows reports a
+		//failed connect in the exception set instead
+#ifdef _WIN32
+		fd_set writable, failed;
+		timeval wait;
+
+		FD_ZERO(&writable);
+		FD_SET(sock, &writable);
+		FD_ZERO(&failed);
+		FD_SET(sock, &failed);
+		wait.tv_sec = timeout / 1000;
+		wait.tv_usec = (timeout % 1000) * 1000;
+		int result = select(0, NULL, &writable, &failed, timeout == WAIT_FOREVER ? NULL : &wait);
+#else
+		pollfd entry;
+
+		entry.fd = sock;
+		entry.events = POLLOUT;
+		entry.revents = 0;
+		int result = poll(&entry, 1, timeout == WAIT_FOREVER ? -1 : (int)timeout);
+#endif
+		if(result == 0) {
+			printf("Timed out connecting to %s:%d\n", address, port);
+			socketClose(sock);
+			return INVALID_SOCKET;
+		}
+
+		//Find out if it connected or failed
+		socklen_t size = sizeof(error);
+		if(result < 0 || getsockopt(sock, SOL_SOCKET, SO_ERROR, (char*)&error, &size) == SOCKET_ERROR)
+			error = socketError();
+		if(error != 0) {
+			printf("Error %d occurred!\n",  error);
+			socketClose(sock);
+			return INVALID_SOCKET;
+		}
+	}
+
+	//Hand the socket back the way a plain connect would
+	if(!socketSetNonBlocking(sock, false)) {
+		socketClose(sock);
+		return INVALID_SOCKET;
+	}
+
+	return sock;
+}
+
+//Listens for connections on a port on every interface, returns
+//INVALID_SOCKET on failure
+SOCKET socketListen(int port)
+{
+	//Create the socket
+	SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if(sock == INVALID_SOCKET) {
+		printf("Error %d occurred!\n",  socketError());
+		return INVALID_SOCKET;
+	}
+
+#ifndef _WIN32
+	//A node restarted right after a run can take the port back straight away,
+	//Windows already allows this and its SO_REUSEADDR means something else
+	int reuse = 1;
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char*)&reuse, sizeof(reuse));
+#endif
+
+	//Bind the socket to the port
+	sockaddr_in anews;
+	memset(&anews, 0, sizeof(anews));
+	anews.sin_port = htons(port);
+	anews.sin_addr.s_addr = INADDR_ANY;
+	anews.sin_family = AF_INET;
+	if(bind(sock, (sockaddr*)&anews, sizeof(anews)) == SOCKET_ERROR) {
+		printf("Error %d occurred!\n",  socketError());
+		socketClose(sock);
+		return INVALID_SOCKET;
+	}
+
+	//Start listening for connections
+	if(listen(sock, SOMAXCONN) == SOCKET_ERROR) {
+		printf("Error %d occurred!\n",  socketError());
+		socketClose(sock);
+		return INVALID_SOCKET;
+	}
+
+	return sock;
+}
+
+//Waits for a connection on a listening socket, returns INVALID_SOCKET on
+//failure
+SOCKET socketAccept(SOCKET server)
+{
+	SOCKET sock = accept(server, NULL, NULL);
+	if(sock == INVALID_SOCKET)
+		printf("Error %d occurred!\n",  socketError());
+
+	return sock;
+}
+
+//Closes a socket
+void socketClose(SOCKET sock)
+{
+	if(sock == INVALID_SOCKET)
+		return;
+
+#ifdef _WIN32
+	closesocket(sock);
+#else
+	close(sock);
+#endif
+}
+
+//Applies options to a connected socket, returns false if any could not be set
+bool socketSetOptions(SOCKET sock, SocketOptions *options)
+{
+	bool set = true;
+
+	//Commands are written in small pieces and the node waits on each frame,
+	//so don't hold them back to fill a segment
+	if(options->no_delay) {
+		int no_delay = 1;
+		if(setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char*)&no_delay, sizeof(no_delay)) == SOCKET_ERROR) {
+			printf("Error %d turning off send coalescing\n", socketError());
+			set = false;
+		}
+	}
+
+	//Larger buffers keep a fast link full between sends, a send buffer of 0
+	//makes Windows send straight from the caller's memory
+	if(options->send_buffer != SOCKET_BUFFER_DEFAULT &&
+			setsockopt(sock, SOL_SOCKET, SO_SNDBUF, (char*)&options->send_buffer, sizeof(int)) == SOCKET_ERROR) {
+		printf("Error %d setting the send buffer to %d bytes\n", socketError(), options->send_buffer);
+		set = false;
+	}
+	if(options->receive_buffer != SOCKET_BUFFER_DEFAULT &&
+			setsockopt(sock, SOL_SOCKET, SO_RCVBUF, (char*)&options->receive_buffer, sizeof(int)) == SOCKET_ERROR) {
+		printf("Error %d setting the receive buffer to %d bytes\n", socketError(), options->receive_buffer);
+		set = false;
+	}
+
+	if(options->non_blocking && !socketSetNonBlocking(sock, true))
+		set = false;
+
+	return set;
+}
+
+//Makes calls on a socket return right away instead of waiting
+bool socketSetNonBlocking(SOCKET sock, bool enable)
+{
+#ifdef _WIN32
+	u_long mode = enable ? 1 : 0;
+	if(ioctlsocket(sock, FIONBIO, &mode) == SOCKET_ERROR) {
+#else
+	int flags = fcntl(sock, F_GETFL, 0);
+	if(flags < 0 || fcntl(sock, F_SETFL, enable ? flags | O_NONBLOCK : flags & ~O_NONBLOCK) < 0) {
+#endif
+		printf("Error %d making a socket non-blocking\n", socketError());
+		return false;
+	}
+
+	return true;
+}
+
+//Waits up to timeout milliseconds for a socket to become readable, or
+//writable if asked. Returns true if it did
+bool socketWait(SOCKET sock, bool write, unsigned int timeout)
+{
+#ifdef _WIN32
+	fd_set conn;
+	timeval wait;
+
+	FD_ZERO(&conn);
+	FD_SET(sock, &conn);
+	wait.tv_sec = timeout / 1000;
+	wait.tv_usec = (timeout % 1000) * 1000;
+	return select(0, write ? NULL : &conn, write ? &conn : NULL, NULL, &wait) > 0;
+#else
+	pollfd entry;
+
+	entry.fd = sock;
+	entry.events = write ? POLLOUT : POLLIN;
+	entry.revents = 0;
+	return poll(&entry, 1, (int)timeout) > 0;
+#endif
+}
+
+//Sends all of a buffer, waiting for space if the socket is non-blocking.
+//Returns the length sent or SOCKET_ERROR
+int socketSend(SOCKET sock, const char *buffer, unsigned int length)
+{
+	unsigned int sent = 0;
+	int result;
+	int flags = 0;
+
+#ifdef MSG_NOSIGNAL
+	//A node that went away fails the send instead of killing the process
+	flags = MSG_NOSIGNAL;
+#endif
+
+	while(sent < length) {
+		result = send(sock, buffer + sent, length - sent, flags);
+		if(result == SOCKET_ERROR) {
+			if(!socketWouldBlock())
+				return SOCKET_ERROR;
+			socketWait(sock, true, SOCKET_RETRY_WAIT);
+			continue;
+		}
+		sent += result;
+	}
+
+	return (int)sent;
+}
+
+//Receives exactly length bytes, waiting up to timeout milliseconds for them
+//if the socket is non-blocking. Returns the length, 0 if the other side
+//closed first, SOCKET_TIMEOUT or SOCKET_ERROR
+int socketReceive(SOCKET sock, char *buffer, unsigned int length, unsigned int timeout)
+{
+	unsigned int received = 0;
+	unsigned int waited = 0;
+	int result;
+
+	while(received < length) {
+		result = recv(sock, buffer + received, length - received, 0);
+		if(result == 0)
+			return 0;
+		if(result == SOCKET_ERROR) {
+			if(!socketWouldBlock())
+				return SOCKET_ERROR;
+			if(!socketWait(sock, false, SOCKET_RETRY_WAIT) && timeout != WAIT_FOREVER) {
+				waited += SOCKET_RETRY_WAIT;
+				if(waited >= timeout)
+					return SOCKET_TIMEOUT;
+			}
+			continue;
+		}
+		received += result;
+	}
+
+	return (int)received;
+}
+
+//Constructor
+GLPoller::GLPoller(int i_capacity)
+{
+	capacity = i_capacity;
+	sockets = new SOCKET[capacity];
+	for(int i = 0; i < capacity; i++)
+		sockets[i] = INVALID_SOCKET;
+	active = 0;
+
+#if defined(SOCKET_EPOLL)
+	epoll_fd = epoll_create(capacity > 0 ? capacity : 1);
+	if(epoll_fd < 0)
+		printf("Error %d creating an epoll instance\n", socketError());
+#elif !defined(_WIN32)
+	entries = new pollfd[capacity];
+	entry_keys = new int[capacity];
+	entry_count = 0;
+	entries_stale = false;
+#endif
+}
+
+//Destructor
+GLPoller::~GLPoller()
+{
+#if defined(SOCKET_EPOLL)
+	if(epoll_fd >= 0)
+		close(epoll_fd);
+#elif !defined(_WIN32)
+	delete[] entries;
+	delete[] entry_keys;
+#endif
+
+	delete[] sockets;
+}
+
+//Waits on a socket for data, wait returns key when it has some
+bool GLPoller::add(SOCKET sock, int key)
+{
+	if(key < 0 || key >= capacity || sockets[key] != INVALID_SOCKET)
+		return false;
+
+#if defined(SOCKET_EPOLL)
+	epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN | EPOLLRDHUP;
+	event.data.u32 = key;
+	if(epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &event) < 0) {
+		printf("Error %d adding a socket to epoll\n", socketError());
+		return false;
+	}
+#elif defined(_WIN32)
+	if(active == FD_SETSIZE) {
+		printf("Can't wait on more than %d sockets\n", FD_SETSIZE);
+		return false;
+	}
+#else
+	entries_stale = true;
+#endif
+
+	sockets[key] = sock;
+	active++;
+	return true;
+}
+
+//Stops waiting on the socket added with key
+void GLPoller::remove(int key)
+{
+	if(key < 0 || key >= capacity || sockets[key] == INVALID_SOCKET)
+		return;
+
+#if defined(SOCKET_EPOLL)
+	epoll_event event;
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, sockets[key], &event);
+#elif !defined(_WIN32)
+	entries_stale = true;
+#endif
+
+	sockets[key] = INVALID_SOCKET;
+	active--;
+}
+
+//Returns the number of sockets still being waited on
+int GLPoller::getCount()
+{
+	return active;
+}
+
+//Waits up to timeout milliseconds for sockets to become readable and fills
+//ready with their keys. Returns the number ready or -1 on error
+int GLPoller::wait(int *ready, int max, unsigned int timeout)
+{
+	int count = 0;
+
+#if defined(SOCKET_EPOLL)
+	//The kernel keeps the set, so only the ready sockets come back
+	epoll_event events[64];
+	if(max > 64)
+		max = 64;
+
+	int result = epoll_wait(epoll_fd, events, max, (int)timeout);
+	if(result < 0)
+		return errno == EINTR ? 0 : -1;
+
+	for(int i = 0; i < result; i++)
+		ready[count++] = (int)events[i].data.u32;
+#elif defined(_WIN32)
+	//Rebuild the set each time, select removes sockets that are not ready
+	fd_set conn;
+	timeval wait;
+
+	FD_ZERO(&conn);
+	for(int i = 0; i < capacity; i++) {
+		if(sockets[i] != INVALID_SOCKET)
+			FD_SET(sockets[i], &conn);
+	}
+
+	//select fails on an empty set, so just sleep out the timeout
+	if(conn.fd_count == 0) {
+		Sleep(timeout);
+		return 0;
+	}
+
+	wait.tv_sec = timeout / 1000;
+	wait.tv_usec = (timeout % 1000) * 1000;
+	int result = select(0, &conn, NULL, NULL, &wait);
+	if(result <= 0)
+		return result;
+
+	for(int i = 0; i < capacity && count < max; i++) {
+		if(sockets[i] != INVALID_SOCKET && FD_ISSET(sockets[i], &conn))
+			ready[count++] = i;
+	}
+#else
+	//Only rebuild the entries when the sockets change
+	if(entries_stale) {
+		entry_count = 0;
+		for(int i = 0; i < capacity; i++) {
+			if(sockets[i] == INVALID_SOCKET)
+				continue;
+			entries[entry_count].fd = sockets[i];
+			entries[entry_count].events = POLLIN;
+			entry_keys[entry_count++] = i;
+		}
+		entries_stale = false;
+	}
+
+	int result = poll(entries, entry_count, (int)timeout);
+	if(result < 0)
+		return errno == EINTR ? 0 : -1;
+
+	for(int i = 0; i < entry_count && count < max; i++) {
+		if(entries[i].revents)
+			ready[count++] = entry_keys[i];
+	}
+#endif
+
+	return count;
+}
@@ -0,0 +1,145 @@
+/*----------------------------------------------------------------------------*\
+|Sockets for the connections between the host and the nodes. Hides the        |
+|differences between Winsock and BSD sockets, and waits on many sockets with   |
+|epoll on Linux, poll on other POSIX systems and select on Windows.            |
+|                                                                              |
+|Stewart Hall                                                                  |
+|10/17/2026                                                                    |
+\*----------------------------------------------------------------------------*/
+
+#ifndef GLSOCKET_H
+#define GLSOCKET_H
+
+#include "GLThread.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+
+//Winsock names for the BSD socket types
+typedef int SOCKET;
+#define INVALID_SOCKET -1
+#define SOCKET_ERROR -1
+
+//Wait on many sockets with epoll where the kernel has it
+#ifdef __linux__
+#define SOCKET_EPOLL
+#endif
+#endif
+
+//Leaves a socket buffer at the size the OS picks when passed as its size
+#define SOCKET_BUFFER_DEFAULT -1
+
+//Returned by a receive that ran out of time
+#define SOCKET_TIMEOUT -2
+
+//How a connected socket is set up
+struct SocketOptions
+{
+	//Should sends go out right away instead of waiting to fill a segment
+	bool no_delay;
+
+	//Should calls return right away instead of waiting on the network
+	bool non_blocking;
+
+	//Bytes the OS buffers for sending and receiving, or SOCKET_BUFFER_DEFAULT
+	int send_buffer;
+	int receive_buffer;
+};
+
+//Sets up the OS socket library, returns false if it can't be used
+bool socketStartup();
+
+//Releases the OS socket library
+void socketCleanup();
+
+//Returns the error code of the last failed socket call
+int socketError();
+
+//Returns true if the last failed call would have had to wait
+bool socketWouldBlock();
+
+//Connects to a port on an address, giving up after timeout milliseconds.
+//Returns INVALID_SOCKET on failure
+SOCKET socketConnect(const char *address, int port, unsigned int timeout);
+
+//Listens for connections on a port on every interface, returns
+//INVALID_SOCKET on failure
+SOCKET socketListen(int port);
+
+//Waits for a connection on a listening socket, returns INVALID_SOCKET on
+//failure
+SOCKET socketAccept(SOCKET server);
+
+//Closes a socket
+void socketClose(SOCKET sock);
+
+//Applies options to a connected socket, returns false if any could not be set
+bool socketSetOptions(SOCKET sock, SocketOptions *options);
+
+//Makes calls on a socket return right away instead of waiting
+bool socketSetNonBlocking(SOCKET sock, bool enable);
+
+//Waits up to timeout milliseconds for a socket to become readable, or
+//writable if asked. Returns true if it did
+bool socketWait(SOCKET sock, bool write, unsigned int timeout);
+
+//Sends all of a buffer, waiting for space if the socket is non-blocking.
+//Returns the length sent or SOCKET_ERROR
+int socketSend(SOCKET sock, const char *buffer, unsigned int length);
+
+//Receives exactly length bytes, waiting up to timeout milliseconds for them
+//if the socket is non-blocking. Returns the length, 0 if the other side
+//closed first, SOCKET_TIMEOUT or SOCKET_ERROR
+int socketReceive(SOCKET sock, char *buffer, unsigned int length, unsigned int timeout);
+
+class GLPoller
+{
+private:
+	//Sockets being waited on, INVALID_SOCKET where one was removed
+	SOCKET *sockets;
+	int capacity;
+
+	//Number of sockets still being waited on
+	int active;
+
+#if defined(SOCKET_EPOLL)
+	//epoll instance the sockets are registered with
+	int epoll_fd;
+#elif !defined(_WIN32)
+	//poll entries, rebuilt when sockets are removed
+	struct pollfd *entries;
+	int *entry_keys;
+	int entry_count;
+	bool entries_stale;
+#endif
+
+public:
+	GLPoller(int i_capacity);
+	~GLPoller();
+
+	//Waits on a socket for data, wait returns key when it has some
+	bool add(SOCKET sock, int key);
+
+	//Stops waiting on the socket added with key
+	void remove(int key);
+
+	//Returns the number of sockets still being waited on
+	int getCount();
+
+	//Waits up to timeout milliseconds for sockets to become readable and
+	//fills ready with their keys. Returns the number ready or -1 on error
+	int wait(int *ready, int max, unsigned int timeout);
+};
+
+#endif
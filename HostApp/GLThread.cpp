@@ -0,0 +1,157 @@
+/*----------------------------------------------------------------------------*\
+|Threading primitives used by the pipes to send frames in the background. The  |
+|OS handles are kept opaque so this header does not pull in windows.h, which  |
+|the capture DLL cannot include.                                               |
+|                                                                              |
+|Stewart Hall                                                                  |
+|10/17/2026                                                                    |
+\*----------------------------------------------------------------------------*/
+
+#include <windows.h>
+
+#include "GLThread.h"
+
+//Atomically adds one to a value and returns the result
+long atomicIncrement(volatile long *value)
+{
+	return InterlockedIncrement(value);
+}
+
+//Atomically subtracts one from a value and returns the result
+long atomicDecrement(volatile long *value)
+{
+	return InterlockedDecrement(value);
+}
+
+//Reads a value written by another thread
+long atomicLoad(volatile long *value)
+{
+	return InterlockedCompareExchange(value, 0, 0);
+}
+
+//Writes a value so that earlier writes are visible to other threads first
+void atomicStore(volatile long *value, long new_value)
+{
+	InterlockedExchange(value, new_value);
+}
+
+//Returns a steady clock in microseconds, for measuring intervals
+unsigned long long timeMicroseconds()
+{
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER now;
+
+	if(frequency.QuadPart == 0)
+		QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&now);
+
+	//Split the division so the multiply can't overflow
+	return (unsigned long long)(now.QuadPart / frequency.QuadPart) * 1000000 +
+		(unsigned long long)(now.QuadPart % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+}
+
+//Thread entry point that hands control back to the GLThread
+static DWORD WINAPI ThreadShell(LPVOID param)
+{
+	((GLThread*)param)->run();
+	return 0;
+}
+
+//Constructor
+GLThread::GLThread(GLThreadFunc i_func, void *i_param)
+{
+	handle = NULL;
+	func = i_func;
+	param = i_param;
+}
+
+//Destructor
+GLThread::~GLThread()
+{
+	join();
+}
+
+//Starts running the thread
+bool GLThread::start()
+{
+	handle = CreateThread(NULL, 0, ThreadShell, this, 0, NULL);
+	return handle != NULL;
+}
+
+//Waits for the thread to exit
+void GLThread::join()
+{
+	if(handle) {
+		WaitForSingleObject(handle, INFINITE);
+		CloseHandle(handle);
+		handle = NULL;
+	}
+}
+
+//Runs the thread function, called on the new thread
+void GLThread::run()
+{
+	func(param);
+}
+
+//Constructor, creates an auto-reset event
+GLEvent::GLEvent()
+{
+	handle = CreateEvent(NULL, FALSE, FALSE, NULL);
+}
+
+//Destructor
+GLEvent::~GLEvent()
+{
+	CloseHandle(handle);
+}
+
+//Wakes up one waiting thread
+void GLEvent::signal()
+{
+	SetEvent(handle);
+}
+
+//Waits until the event is signalled, returns false on timeout
+bool GLEvent::wait(unsigned int timeout)
+{
+	return WaitForSingleObject(handle, timeout) == WAIT_OBJECT_0;
+}
+
+//Clears a signal nobody waited for
+void GLEvent::reset()
+{
+	ResetEvent(handle);
+}
+
+//Returns the OS handle so the event can be waited on with other handles
+void *GLEvent::getHandle()
+{
+	return handle;
+}
+
+//Constructor
+GLLock::GLLock()
+{
+	handle = new CRITICAL_SECTION;
+	InitializeCriticalSection((CRITICAL_SECTION*)handle);
+}
+
+//Destructor
+GLLock::~GLLock()
+{
+	DeleteCriticalSection((CRITICAL_SECTION*)handle);
+	delete (CRITICAL_SECTION*)handle;
+}
+
+//Waits for and takes ownership of the lock
+void GLLock::lock()
+{
+	EnterCriticalSection((CRITICAL_SECTION*)handle);
+}
+
+//Releases the lock
+void GLLock::unlock()
+{
+	LeaveCriticalSection((CRITICAL_SECTION*)handle);
+}
@@ -0,0 +1,148 @@
+/*----------------------------------------------------------------------------*\
+|Threading primitives used by the pipes to send frames in the background. The  |
+|OS handles are kept opaque so this header does not pull in windows.h, which  |
+|the capture DLL cannot include.                                               |
+|                                                                              |
+|Stewart Hall                                                                  |
+|10/17/2026                                                                    |
+\*----------------------------------------------------------------------------*/
+
+#ifndef GLTHREAD_H
+#define GLTHREAD_H
+
+//Wait forever when passed as a timeout
+#define WAIT_FOREVER 0xFFFFFFFF
+
+//Entry point for a thread
+typedef void (*GLThreadFunc)(void *param);
+
+//Atomically adds one to a value and returns the result
+long atomicIncrement(volatile long *value);
+
+//Atomically subtracts one from a value and returns the result
+long atomicDecrement(volatile long *value);
+
+//Reads a value written by another thread
+long atomicLoad(volatile long *value);
+
+//Writes a value so that earlier writes are visible to other threads first
+void atomicStore(volatile long *value, long new_value);
+
+//Returns a steady clock in microseconds, for measuring intervals
+unsigned long long timeMicroseconds();
+
+class GLThread
+{
+private:
+	//OS thread handle
+	void *handle;
+
+	//Function and parameter to run on the thread
+	GLThreadFunc func;
+	void *param;
+
+public:
+	GLThread(GLThreadFunc i_func, void *i_param);
+	~GLThread();
+
+	//Starts running the thread
+	bool start();
+
+	//Waits for the thread to exit
+	void join();
+
+	//Runs the thread function, called on the new thread
+	void run();
+};
+
+class GLEvent
+{
+private:
+	//OS event handle
+	void *handle;
+
+public:
+	GLEvent();
+	~GLEvent();
+
+	//Wakes up one waiting thread
+	void signal();
+
+	//Waits until the event is signalled, returns false on timeout
+	bool wait(unsigned int timeout);
+
+	//Clears a signal nobody waited for
+	void reset();
+
+	//Returns the OS handle so the event can be waited on with other handles
+	void *getHandle();
+};
+
+class GLLock
+{
+private:
+	//OS critical section
+	void *handle;
+
+public:
+	GLLock();
+	~GLLock();
+
+	//Waits for and takes ownership of the lock
+	void lock();
+
+	//Releases the lock
+	void unlock();
+};
+
+//Lock-free queue for one producer thread and one consumer thread
+template <class T, unsigned int SIZE>
+class GLRing
+{
+private:
+	T items[SIZE];
+
+	//Next slot to read, only written by the consumer
+	volatile long head;
+
+	//Next slot to write, only written by the producer
+	volatile long tail;
+
+public:
+	GLRing()
+	{
+		head = 0;
+		tail = 0;
+	}
+
+	//Adds an item, returns false if the ring is full
+	bool push(T item)
+	{
+		long next = (tail + 1) % SIZE;
+		if(next == atomicLoad(&head))
+			return false;
+
+		items[tail] = item;
+		atomicStore(&tail, next);
+		return true;
+	}
+
+	//Removes the oldest item, returns false if the ring is empty
+	bool pop(T *item)
+	{
+		if(head == atomicLoad(&tail))
+			return false;
+
+		*item = items[head];
+		atomicStore(&head, (head + 1) % SIZE);
+		return true;
+	}
+
+	//Number of items waiting in the ring
+	unsigned int count()
+	{
+		return (atomicLoad(&tail) - atomicLoad(&head) + SIZE) % SIZE;
+	}
+};
+
+#endif
@@ -6,8 +6,32 @@
 |11/26/2012                                                                    |
 \*----------------------------------------------------------------------------*/
 
+#include <math.h>
+
 #include "RGLInterface.h"
 
+//Entry point for the backchannel thread
+static void BackchannelShell(void *param)
+{
+	((RGLInterface*)param)->backchannelMain();
+}
+
+//A pipe connecting on a thread of its own during initialize
+struct PipeConnect
+{
+	GLPipe *pipe;
+	char *address;
+	int result;
+	GLThread *thread;
+};
+
+//Entry point for a connecting thread
+static void ConnectShell(void *param)
+{
+	PipeConnect *connect = (PipeConnect*)param;
+	connect->result = connect->pipe->connectPipe(connect->address);
+}
+
 //Initializes an interface with a config file
 RGLInterface::RGLInterface(char *configFile)
 {
@@ -28,8 +52,122 @@ RGLInterface::RGLInterface(char *configFile)
 
 	num_nodes = 0;
 	pipes = NULL;
-	buffer = NULL;
+	frame_pool = NULL;
+	frame = NULL;
 	buffer_pointer = 0;
+	batch_commands = FALSE;
+	zero_copy = FALSE;
+	shared_memory = TRUE;
+	shared_memory_size = SHARED_RING_SIZE;
+	completion_port = FALSE;
+	send_port = NULL;
+	tcp_no_delay = TRUE;
+	send_buffer_size = 0;
+	receive_buffer_size = 0;
+	connect_timeout = CONNECT_TIMEOUT;
+	connect_retries = CONNECT_RETRIES;
+	use_multicast = FALSE;
+	strcpy(multicast_group, "239.255.13.37");
+	multicast_port = 13400;
+	strcpy(multicast_interface, "0.0.0.0");
+	multicast_ttl = 1;
+	multicast_loopback = FALSE;
+	multicast_drop_rate = 0;
+	multicast = NULL;
+	backchannel = NULL;
+	backchannel_running = 0;
+	flush_watermark = FLUSH_WATERMARK;
+	frame_flushes = 0;
+	last_frame_flushes = 0;
+	frame_bytes = 0;
+	last_frame_bytes = 0;
+	protocol_revision = PROTOCOL_REVISION_1;
+	length_prefix = FALSE;
+	delta_frames = FALSE;
+	delta_keyframe = DELTA_KEYFRAME_INTERVAL;
+	capture = NULL;
+
+	swap_barrier = FALSE;
+	barrier_frame = 0;
+	barrier_pending = FALSE;
+	barrier_ready = 0;
+	barrier_event = NULL;
+	barrier_start = 0;
+	barrier_done = 0;
+	last_barrier_latency = 0;
+	last_barrier_wait = 0;
+	barrier_latency_total = 0;
+	barrier_wait_total = 0;
+	barrier_count = 0;
+
+	present_delay = 0;
+	present_frame = 0;
+	clock_probes = 0;
+	memset(probe_times, 0, sizeof(probe_times));
+	memset(present_records, 0, sizeof(present_records));
+	last_skew = 0;
+	worst_skew = 0;
+	skew_total = 0;
+	skew_frames = 0;
+	lateness_total = 0;
+
+	max_frames_in_flight = 0;
+	frames_sent = 0;
+	frames_done = NULL;
+	done_event = NULL;
+	sent_lock = NULL;
+	memset(sent_times, 0, sizeof(sent_times));
+	last_sync = 0;
+	done_latency = 0;
+	pacing_wait_total = 0;
+	pacing_latency_total = 0;
+	drop_frames = FALSE;
+	command_start = 0;
+	command_id = -1;
+	culling = FALSE;
+	batch_start = -1;
+	batch_color = -1;
+	batch_color_end = -1;
+	batch_empty = TRUE;
+	pack_vertices = FALSE;
+	packing = FALSE;
+	packed_mode = 0;
+	packed_vertices = NULL;
+	packed_count = 0;
+	packed_capacity = 0;
+	packed_colors = FALSE;
+	current_color[0] = 1.0f;
+	current_color[1] = 1.0f;
+	current_color[2] = 1.0f;
+	compact_vertices = FALSE;
+	compact_error_test = FALSE;
+	packed_steps = NULL;
+	compact_bytes = 0;
+	compact_vertex_count = 0;
+	use_geometry_cache = FALSE;
+	cache_slots = CACHE_SLOTS;
+	cache_bytes = CACHE_BYTES;
+	geometry_cache = NULL;
+	fold_transforms = FALSE;
+	matrix_dirty = TRUE;
+	node_matrix_known = FALSE;
+	transforms_folded = 0;
+	matrix_loads = 0;
+	use_peephole = FALSE;
+	peephole = NULL;
+	state_generation = 0;
+	use_instancing = FALSE;
+	instance_mode = 0;
+	instance_vertices = NULL;
+	instance_vertex_count = 0;
+	instance_vertex_capacity = 0;
+	instance_colors = FALSE;
+	instance_steps = NULL;
+	instance_matrices = NULL;
+	instance_count = 0;
+	instance_capacity = 0;
+	instances_sent = 0;
+	instanced_draws = 0;
 	FILE *fp = fopen(configFile, "r");
 
 	if(fp) {
@@ -50,8 +188,118 @@ RGLInterface::RGLInterface(char *configFile)
 			} else if(!strcmp(tag, "totalHeight")) {
 				number = strtok(NULL, " :");
 				sscanf(number, "%d", &height);
-			} else if(!strcmp(tag, "multiGPU")) {
+			} else if(!strcmp(tag, "multiGPU") || !strcmp(tag, "receiveThread") ||
+					!strcmp(tag, "spinBudget") || !strcmp(tag, "commandBudget") ||
+				!strcmp(tag, "postedReceives")) {
 				//ignore
+			} else if(!strcmp(tag, "batch")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &batch_commands);
+			} else if(!strcmp(tag, "flushWatermark")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%u", &flush_watermark);
+			} else if(!strcmp(tag, "zeroCopy")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &zero_copy);
+			} else if(!strcmp(tag, "sharedMemory")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &shared_memory);
+			} else if(!strcmp(tag, "sharedMemorySize")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%u", &shared_memory_size);
+			} else if(!strcmp(tag, "completionPort")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &completion_port);
+			} else if(!strcmp(tag, "tcpNoDelay")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &tcp_no_delay);
+			} else if(!strcmp(tag, "sendBuffer")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &send_buffer_size);
+			} else if(!strcmp(tag, "receiveBuffer")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &receive_buffer_size);
+			} else if(!strcmp(tag, "connectTimeout")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%u", &connect_timeout);
+			} else if(!strcmp(tag, "connectRetries")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &connect_retries);
+			} else if(!strcmp(tag, "protocol")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%u", &protocol_revision);
+			} else if(!strcmp(tag, "lengthPrefix")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &length_prefix);
+			} else if(!strcmp(tag, "deltaFrames")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &delta_frames);
+			} else if(!strcmp(tag, "deltaKeyframe")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%u", &delta_keyframe);
+			} else if(!strcmp(tag, "swapBarrier")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &swap_barrier);
+			} else if(!strcmp(tag, "presentDelay")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%u", &present_delay);
+			} else if(!strcmp(tag, "dropFrames")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &drop_frames);
+			} else if(!strcmp(tag, "maxFramesInFlight")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%u", &max_frames_in_flight);
+			} else if(!strcmp(tag, "packVertices")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &pack_vertices);
+			} else if(!strcmp(tag, "compactVertices")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &compact_vertices);
+			} else if(!strcmp(tag, "compactErrorTest")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &compact_error_test);
+			} else if(!strcmp(tag, "geometryCache")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &use_geometry_cache);
+			} else if(!strcmp(tag, "cacheSlots")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &cache_slots);
+			} else if(!strcmp(tag, "cacheSize")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%u", &cache_bytes);
+			} else if(!strcmp(tag, "foldTransforms")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &fold_transforms);
+			} else if(!strcmp(tag, "peephole")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &use_peephole);
+			} else if(!strcmp(tag, "instancing")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &use_instancing);
+			} else if(!strcmp(tag, "culling")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &culling);
+			} else if(!strcmp(tag, "multicast")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &use_multicast);
+			} else if(!strcmp(tag, "multicastGroup")) {
+				number = strtok(NULL, " :\r\n");
+				sscanf(number, "%31s", multicast_group);
+			} else if(!strcmp(tag, "multicastPort")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &multicast_port);
+			} else if(!strcmp(tag, "multicastInterface")) {
+				number = strtok(NULL, " :\r\n");
+				sscanf(number, "%31s", multicast_interface);
+			} else if(!strcmp(tag, "multicastTTL")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &multicast_ttl);
+			} else if(!strcmp(tag, "multicastLoopback")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &multicast_loopback);
+			} else if(!strcmp(tag, "multicastDropRate")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &multicast_drop_rate);
 			} else if(!strcmp(tag, "nodes")) {
 				number = strtok(NULL, " :");
 				sscanf(number, "%d", &num_nodes);
@@ -142,6 +390,34 @@ RGLInterface::RGLInterface(char *configFile)
 		printf("Error opening config file\n");
 	}
 
+	if(protocol_revision < PROTOCOL_REVISION_1 || protocol_revision > PROTOCOL_REVISION) {
+		printf("Unknown protocol revision %u, using %u\n", protocol_revision, PROTOCOL_REVISION);
+		protocol_revision = PROTOCOL_REVISION;
+	}
+
+	//Leave room for the largest command past the watermark
+	if(flush_watermark > BUFFER_SIZE - MAX_COMMAND_SIZE)
+		flush_watermark = BUFFER_SIZE - MAX_COMMAND_SIZE;
+
+	//Every node gets the same multicast datagrams so nothing can be skipped
+	if(culling && use_multicast) {
+		printf("Culling is not available with multicast, disabling it\n");
+		culling = FALSE;
+	}
+
+	//Tell each pipe which bit of a cull mask is its own
+	for(int i = 0; i < nodes_read; i++)
+		pipes[i]->setIndex(i);
+
+	if(use_peephole)
+		peephole = new GLPeephole();
+
+	//Copies are whole packed runs under matrices known here
+	if(use_instancing && (!pack_vertices || !fold_transforms)) {
+		printf("Instancing needs packVertices and foldTransforms, drawing every copy on its own\n");
+		use_instancing = FALSE;
+	}
+
 	delete line;
 }
 
@@ -151,93 +427,1374 @@ RGLInterface::~RGLInterface()
 	if(pipes)
 		delete[] pipes;
 
-	if(buffer)
-		delete buffer;
+	if(geometry_cache)
+		delete geometry_cache;
+
+	if(peephole)
+		delete peephole;
+
+	if(frame)
+		frame->release();
+
+	if(frame_pool)
+		delete frame_pool;
+
+	if(packed_vertices)
+		delete[] packed_vertices;
+
+	if(packed_steps)
+		delete[] packed_steps;
+
+	if(instance_vertices)
+		delete[] instance_vertices;
+
+	if(instance_steps)
+		delete[] instance_steps;
+
+	if(instance_matrices)
+		delete[] instance_matrices;
+
+	if(barrier_event)
+		delete barrier_event;
+
+	if(frames_done)
+		delete[] frames_done;
+
+	if(done_event)
+		delete done_event;
+
+	if(sent_lock)
+		delete sent_lock;
 }
 
 //Called to set up a connection to the nodes
 int RGLInterface::initialize(char *address)
 {
-	WSADATA wsaData;
-	int starterr = WSAStartup(MAKEWORD(2,2), &wsaData);
+	if(!socketStartup())
+		return -1;
+
+	//One thread can send for every pipe if the OS has completion ports
+	if(completion_port && !use_multicast) {
+		send_port = new GLSendPort(num_nodes);
+		if(!send_port->open()) {
+			printf("Sending from a thread per node instead\n");
+			delete send_port;
+			send_port = NULL;
+		}
+	}
 
-	//Error checking
-	if(starterr != 0) {
-		printf("Error %d occurred!\n",  WSAGetLastError());
-		WSACleanup();
+	//Connect to every node at once, so startup takes as long as the slowest
+	//node instead of the sum over all of them
+	unsigned long long startup = timeMicroseconds();
+	unsigned long long sequential = 0;
+	int failed = 0;
+	PipeConnect *connects = new PipeConnect[num_nodes];
+	for(int i = 0; i < num_nodes; i++) {
+		pipes[i]->setSendPort(send_port);
+		pipes[i]->setConnectTimeout(connect_timeout, connect_retries);
+		pipes[i]->setZeroCopy(zero_copy);
+		pipes[i]->setSocketOptions(tcp_no_delay, send_buffer_size > 0 ? send_buffer_size : SOCKET_BUFFER_DEFAULT,
+			receive_buffer_size > 0 ? receive_buffer_size : SOCKET_BUFFER_DEFAULT);
+		pipes[i]->setSharedMemory(shared_memory && !use_multicast, shared_memory_size);
+		pipes[i]->setDeltaKeyframe(delta_keyframe);
+
+		//Edits are made per node, so the shared multicast stream can't have
+		//them, and the node has to know where each chunk ends
+		pipes[i]->requestFeatures((compact_vertices ? FEATURE_COMPACT_VERTICES : 0) |
+			(length_prefix ? FEATURE_LENGTH_PREFIX : 0) |
+			(use_geometry_cache ? FEATURE_GEOMETRY_CACHE : 0) |
+			(use_instancing ? FEATURE_INSTANCING : 0) |
+			(delta_frames && length_prefix && !use_multicast ? FEATURE_DELTA_FRAMES : 0));
+		pipes[i]->requestRevision(protocol_revision);
+
+		connects[i].pipe = pipes[i];
+		connects[i].address = address;
+		connects[i].result = -1;
+		connects[i].thread = new GLThread(ConnectShell, &connects[i]);
+		if(!connects[i].thread->start()) {
+			//Connect this one here if it can't have a thread
+			delete connects[i].thread;
+			connects[i].thread = NULL;
+			connects[i].result = pipes[i]->connectPipe(address);
+		}
+	}
+
+	//Wait for every node to connect or give up
+	for(int i = 0; i < num_nodes; i++) {
+		if(connects[i].thread) {
+			connects[i].thread->join();
+			delete connects[i].thread;
+		}
+		if(connects[i].result < 0)
+			failed++;
+		sequential += pipes[i]->getConnectTime();
+	}
+	delete[] connects;
+
+	printf("Startup timeline:\n");
+	for(int i = 0; i < num_nodes; i++)
+		pipes[i]->printTimeline(startup);
+	printf("\t%d nodes connected in %.1fms, %.1fms one at a time\n", num_nodes - failed,
+		(timeMicroseconds() - startup) / 1000.0, sequential / 1000.0);
+
+	if(failed > 0) {
+		printf("%d pipes could not connect. Exiting.\n", failed);
+		socketCleanup();
+		return -1;
+	}
+
+	if(send_port && !send_port->start()) {
+		socketCleanup();
 		return -1;
 	}
 
-	//Iterate through each pipe and establish connection
+	//Commands go to every node, so use a revision every node understands
+	for(int i = 0; i < num_nodes; i++) {
+		if(pipes[i]->getRevision() < protocol_revision) {
+			printf("Node %s only understands protocol revision %u\n", pipes[i]->getName(), pipes[i]->getRevision());
+			protocol_revision = pipes[i]->getRevision();
+		}
+	}
+
+	//Compact runs go to every node, so every node has to accept them
+	for(int i = 0; i < num_nodes; i++) {
+		if(compact_vertices && !(pipes[i]->getFeatures() & FEATURE_COMPACT_VERTICES)) {
+			printf("Node %s does not accept compact vertices, sending floats\n", pipes[i]->getName());
+			compact_vertices = FALSE;
+		}
+	}
+
+	//So do cache stores, every node has to keep the same blocks
+	for(int i = 0; i < num_nodes; i++) {
+		if(use_geometry_cache && !(pipes[i]->getFeatures() & FEATURE_GEOMETRY_CACHE)) {
+			printf("Node %s has no geometry cache, sending every block\n", pipes[i]->getName());
+			use_geometry_cache = FALSE;
+		}
+	}
+	createGeometryCache();
+
+	//And instanced draws
 	for(int i = 0; i < num_nodes; i++) {
-		if(pipes[i]->connectPipe(address) < 0) {
-			printf("A pipe could not connect. Exiting.\n");
-			WSACleanup();
+		if(use_instancing && !(pipes[i]->getFeatures() & FEATURE_INSTANCING)) {
+			printf("Node %s does not draw instances, sending every copy\n", pipes[i]->getName());
+			use_instancing = FALSE;
+		}
+	}
+
+	//Set up the multicast group that carries the command stream
+	if(use_multicast) {
+		multicast = new GLMulticast(multicast_group, multicast_port, multicast_interface,
+			multicast_ttl, multicast_loopback, multicast_drop_rate);
+		if(multicast->open() < 0) {
+			printf("The multicast group could not be set up. Exiting.\n");
+			socketCleanup();
 			return -1;
 		}
 	}
 
-	//Create the command buffer
-	buffer = new char[BUFFER_SIZE];
+	//Scheduled presents need no round trip per frame, so they take over
+	if(present_delay && swap_barrier) {
+		printf("Presenting at scheduled times instead of using the swap barrier\n");
+		swap_barrier = FALSE;
+	}
+
+	//Every node has to get the whole frame when one datagram reaches them all
+	//or when they all wait for each other to swap anyway
+	if(drop_frames && (use_multicast || swap_barrier)) {
+		printf("Frames can't be dropped with multicast or the swap barrier, sending every frame\n");
+		drop_frames = FALSE;
+	}
+	for(int i = 0; i < num_nodes; i++)
+		pipes[i]->setDropFrames(drop_frames, protocol_revision);
+
+	//Ready reports come in on the backchannel thread
+	if(swap_barrier)
+		barrier_event = new GLEvent();
+
+	//So do the frames each node has finished
+	if(max_frames_in_flight > PACING_WINDOW)
+		max_frames_in_flight = PACING_WINDOW;
+	frames_done = new volatile long[num_nodes];
+	for(int i = 0; i < num_nodes; i++)
+		frames_done[i] = 0;
+	done_event = new GLEvent();
+	sent_lock = new GLLock();
+
+	//Start reading messages sent back by the nodes
+	backchannel_running = 1;
+	backchannel = new GLThread(BackchannelShell, this);
+	if(!backchannel->start()) {
+		printf("Could not start backchannel thread\n");
+		socketCleanup();
+		return -1;
+	}
+
+	//Create the frames to encode into, a frame never grows past the watermark
+	//by more than one command
+	frame_pool = new GLFramePool(flush_watermark + MAX_COMMAND_SIZE);
+	frame = frame_pool->acquire();
 
 	return 0;
 }
 
+//Sets up the interface without nodes, sent commands are appended to a capture
+//frame. Used to measure how commands are encoded
+void RGLInterface::initializeCapture(unsigned int revision, GLFrame *i_capture)
+{
+	protocol_revision = revision;
+	capture = i_capture;
+
+	//There are no pipes to cull for or nodes to wait for
+	culling = FALSE;
+	swap_barrier = FALSE;
+	present_delay = 0;
+	max_frames_in_flight = 0;
+	drop_frames = FALSE;
+
+	//Start each capture with empty caches so it doesn't lean on the last one
+	createGeometryCache();
+	matrix_dirty = TRUE;
+	node_matrix_known = FALSE;
+	if(peephole)
+		peephole->reset();
+	instance_count = 0;
+
+	if(!frame_pool) {
+		frame_pool = new GLFramePool(flush_watermark + MAX_COMMAND_SIZE);
+		frame = frame_pool->acquire();
+	}
+}
+
 //Called to close all connections
 void RGLInterface::cleanUp()
 {
+	//Send anything left in the multicast queue
+	if(multicast) {
+		multicast->close();
+		multicast->printStatus();
+		delete multicast;
+		multicast = NULL;
+	}
+
+	//Stop reading from the nodes
+	if(backchannel) {
+		atomicStore(&backchannel_running, 0);
+		backchannel->join();
+		delete backchannel;
+		backchannel = NULL;
+	}
+
+	//Send what the pipes still have queued
+	if(send_port) {
+		send_port->close();
+		send_port->printStats();
+		delete send_port;
+		send_port = NULL;
+	}
+
 	//Iterate through each pipe and close connection
 	for(int i = 0; i < num_nodes; i++) {
 		pipes[i]->closePipe();
 	}
 }
 
+//Reads messages from the nodes until clean up, runs on its own thread
+void RGLInterface::backchannelMain()
+{
+	BackchannelMessage message;
+	GLPoller poller(num_nodes);
+	int *ready = new int[num_nodes];
+	int count;
+
+	//Each node's socket is known by its index
+	for(int i = 0; i < num_nodes; i++)
+		poller.add(pipes[i]->getSocket(), i);
+
+	while(atomicLoad(&backchannel_running)) {
+		//Wake up regularly to check for clean up
+		if((count = poller.wait(ready, num_nodes, 100)) <= 0)
+			continue;
+
+		for(int i = 0; i < count; i++) {
+			if(pipes[ready[i]]->receiveMessage(&message, WAIT_FOREVER) < 0) {
+				printf(" on node %d\n", ready[i]);
+				poller.remove(ready[i]);
+				continue;
+			}
+
+			handleMessage(ready[i], &message);
+		}
+	}
+
+	delete[] ready;
+}
+
+//Handles a message sent back by a node
+void RGLInterface::handleMessage(int node, BackchannelMessage *message)
+{
+	switch(message->type) {
+	case BACKCHANNEL_NACK:
+		if(multicast)
+			multicast->retransmit(message->args[0], message->args[1]);
+		break;
+	case BACKCHANNEL_FRAME_READY:
+		//Reports for frames already released are stale
+		if(barrier_event && (long)message->args[0] == atomicLoad(&barrier_frame) &&
+				atomicIncrement(&barrier_ready) == num_nodes) {
+			barrier_done = timeMicroseconds();
+			barrier_event->signal();
+		}
+		break;
+	case BACKCHANNEL_CLOCK:
+		pipes[node]->addClockSample(probe_times[message->args[0] % CLOCK_PROBE_TIMES],
+			joinHalves(message->args[1], message->args[2]), timeMicroseconds());
+		break;
+	case BACKCHANNEL_PRESENTED:
+		presentReceived(node, message->args[0], joinHalves(message->args[1], message->args[2]));
+		break;
+	case BACKCHANNEL_FRAME_DONE:
+		frameDone(node, message->args[0]);
+		break;
+	case BACKCHANNEL_KEYFRAME:
+		printf("Node %s asked for a keyframe\n", pipes[node]->getName());
+		pipes[node]->requestKeyframe();
+		break;
+	default:
+		printf("Unknown message %u from node %d\n", message->type, node);
+		break;
+	}
+}
+
 //Pushes a command to the buffer
-void RGLInterface::pushCommand(int id)
+void RGLInterface::pushCommand(GLOpcode id)
 {
-	memcpy(&buffer[buffer_pointer], &id, sizeof(int));
+	//Copies waiting for more are drawn before anything after them
+	flushInstances();
+
+	//The last command ends where this one starts
+	closeCommand();
+
+	//Nothing of the next frame can go out before the last one is swapped
+	if(barrier_pending)
+		releaseBarrier();
+
+	command_start = buffer_pointer;
+	command_id = id;
+
+	if(protocol_revision >= PROTOCOL_REVISION_2) {
+		frame->data[buffer_pointer++] = (char)id;
+		return;
+	}
+
+	int value = id;
+	memcpy(&frame->data[buffer_pointer], &value, sizeof(int));
 	buffer_pointer += sizeof(int);
 }
 
 //Pushes a GLFloat value to the buffer
 void RGLInterface::pushGLfloat(GLfloat value)
 {
-	memcpy(&buffer[buffer_pointer], &value, sizeof(GLfloat));
+	memcpy(&frame->data[buffer_pointer], &value, sizeof(GLfloat));
 	buffer_pointer += sizeof(GLfloat);
 }
 
 //Pushes a GLBitfield value to the buffer
 void RGLInterface::pushGLbitfield(GLbitfield value)
 {
-	memcpy(&buffer[buffer_pointer], &value, sizeof(GLbitfield));
+	if(protocol_revision >= PROTOCOL_REVISION_2) {
+		unsigned char packed = packClearMask(value);
+		frame->data[buffer_pointer++] = (char)packed;
+		if(packed == CLEAR_MASK_RAW)
+			buffer_pointer += encodeVarint(&frame->data[buffer_pointer], value);
+		return;
+	}
+
+	memcpy(&frame->data[buffer_pointer], &value, sizeof(GLbitfield));
 	buffer_pointer += sizeof(GLbitfield);
 }
 
-//Pushes a GLenum value to the buffer
-void RGLInterface::pushGLenum(GLenum value)
+//Pushes a GLuint or GLenum value to the buffer
+void RGLInterface::pushGLuint(GLuint value)
 {
-	memcpy(&buffer[buffer_pointer], &value, sizeof(GLenum));
-	buffer_pointer += sizeof(GLenum);
+	if(protocol_revision >= PROTOCOL_REVISION_2) {
+		buffer_pointer += encodeVarint(&frame->data[buffer_pointer], value);
+		return;
+	}
+
+	memcpy(&frame->data[buffer_pointer], &value, sizeof(GLuint));
+	buffer_pointer += sizeof(GLuint);
 }
 
+//Pushes a command and its fixed arguments, push_<name> for each command
+#define GL_COMMAND_PUSH(opcode, name, masks, integers, floats, flags, handler, role, state, joinable) \
+void RGLInterface::push_##name(GL_SHAPE(GL_PARAMETERS, masks, integers, floats)) \
+{ \
+	pushCommand(OPCODE_##name); \
+	GL_SHAPE(GL_PUSH, masks, integers, floats) \
+}
+GL_COMMANDS(GL_COMMAND_PUSH)
+
 //Sends data in the buffer over all pipes
 void RGLInterface::sendCommand()
 {
-	//Iterate through each pipe and send the command
-	for(int i = 0; i < num_nodes; i++) {
-		if(pipes[i]->sendCommand(buffer, buffer_pointer) < 0)
-			printf(" on node %d\n", i);
-	}
+	closeCommand();
+
+	//Take out what changes nothing on the nodes before it goes out
+	frame->length = buffer_pointer;
+	if(peephole)
+		peephole->optimize(frame, protocol_revision);
+
+	frame_bytes += frame->length;
+	queueFrame(frame);
+
+	//Encode the following commands into a fresh frame
+	frame->release();
+	frame = frame_pool->acquire();
 
 	//Reset pointer
 	buffer_pointer = 0;
+
+	//A batch can't be culled once part of it has been sent
+	batch_start = -1;
 }
 
-//Sends a syncronization packet telling the nodes to swap buffers
-void RGLInterface::sendSync()
+//Sends a frame to every node, or to the capture frame
+void RGLInterface::queueFrame(GLFrame *sent)
 {
-	pushCommand(0);
+	sent->generation = state_generation;
+
+	if(capture) {
+		//Keep the commands to look at later instead of sending them
+		capture->reserve(capture->length + sent->length);
+		memcpy(&capture->data[capture->length], sent->data, sent->length);
+		capture->length += sent->length;
+	} else if(multicast) {
+		//One copy of the frame reaches every node through the group
+		multicast->queueFrame(sent);
+	} else {
+		//Iterate through each pipe and queue the frame, all pipes share it
+		for(int i = 0; i < num_nodes; i++) {
+			if(pipes[i]->queueFrame(sent) < 0)
+				printf("Pipe to node %d has failed\n", i);
+		}
+
+		//Every pipe's send goes out from one wake up of the port
+		if(send_port)
+			send_port->wake();
+	}
+}
+
+//Waits for every node to draw the last frame and tells them to swap
+void RGLInterface::releaseBarrier()
+{
+	unsigned long long start = timeMicroseconds();
+	unsigned long long done;
+	unsigned int waited;
+	BOOL ready = TRUE;
+
+	//The count decides, a report that raced with arming the barrier can
+	//still leave the event signalled
+	barrier_pending = FALSE;
+	while(atomicLoad(&barrier_ready) < num_nodes) {
+		waited = (unsigned int)((timeMicroseconds() - start) / 1000);
+		if(waited >= SWAP_BARRIER_TIMEOUT || !barrier_event->wait(SWAP_BARRIER_TIMEOUT - waited)) {
+			ready = FALSE;
+			break;
+		}
+	}
+
+	if(!ready) {
+		printf("Only %ld of %d nodes drew frame %ld in time, swapping anyway\n",
+			atomicLoad(&barrier_ready), num_nodes, atomicLoad(&barrier_frame));
+		done = timeMicroseconds();
+	} else {
+		done = barrier_done;
+	}
+
+	last_barrier_latency = (unsigned int)(done - barrier_start);
+	last_barrier_wait = (unsigned int)(timeMicroseconds() - start);
+	barrier_latency_total += last_barrier_latency;
+	barrier_wait_total += last_barrier_wait;
+	barrier_count++;
+
+	//The swap goes out in a frame of its own so the frame being encoded,
+	//which may have space reserved in it, is left alone
+	GLFrame *encoding = frame;
+	unsigned int encoding_length = buffer_pointer;
+	frame = frame_pool->acquire();
+	buffer_pointer = 0;
+	push_Swap(atomicLoad(&barrier_frame));
+	closeCommand();
+	frame->length = buffer_pointer;
+	frame_bytes += buffer_pointer;
+	queueFrame(frame);
+	frame->release();
+	frame = encoding;
+	buffer_pointer = encoding_length;
+}
+
+//Probes the nodes' clocks and sends them the offsets found so far
+void RGLInterface::sendClock()
+{
+	long long offset;
+
+	//Probe every frame at first, then only often enough to follow drift
+	if(present_frame >= CLOCK_STARTUP_PROBES && present_frame % CLOCK_PROBE_INTERVAL != 0)
+		return;
+
+	//Every node sees every offset and takes the one with its index
+	for(int i = 0; i < num_nodes; i++) {
+		if(!pipes[i]->getClockOffset(&offset))
+			continue;
+
+		push_ClockOffset(i, (GLuint)offset, (GLuint)((unsigned long long)offset >> 32));
+		endCommand();
+	}
+
+	push_ClockProbe(clock_probes);
+	probe_times[clock_probes % CLOCK_PROBE_TIMES] = timeMicroseconds();
+	clock_probes++;
+	endCommand();
+}
+
+//Records when a node presented a frame
+void RGLInterface::presentReceived(int node, unsigned int frame, unsigned long long presented)
+{
+	PresentRecord *record = &present_records[frame % PRESENT_WINDOW];
+
+	//Reports too late to be tracked are dropped
+	if(record->frame != frame)
+		return;
+
+	if(record->count == 0 || presented < record->first)
+		record->first = presented;
+	if(record->count == 0 || presented > record->last)
+		record->last = presented;
+
+	if(++record->count == num_nodes) {
+		last_skew = (unsigned int)(record->last - record->first);
+		if(last_skew > worst_skew)
+			worst_skew = last_skew;
+		skew_total += last_skew;
+		skew_frames++;
+		lateness_total += (long long)(record->last - record->target);
+	}
+}
+
+//Returns the number of frames every node has finished
+unsigned int RGLInterface::slowestFramesDone()
+{
+	unsigned int slowest = frames_sent;
+
+	for(int i = 0; i < num_nodes; i++) {
+		unsigned int done = (unsigned int)atomicLoad(&frames_done[i]);
+		if(done < slowest)
+			slowest = done;
+	}
+
+	return slowest;
+}
+
+//Returns the number of frames finished by the nodes that pace the host,
+//every node, or only the fastest when slow nodes drop frames instead
+unsigned int RGLInterface::pacingFramesDone()
+{
+	if(!drop_frames)
+		return slowestFramesDone();
+
+	unsigned int fastest = 0;
+	for(int i = 0; i < num_nodes; i++) {
+		unsigned int done = (unsigned int)atomicLoad(&frames_done[i]);
+		if(done > fastest)
+			fastest = done;
+	}
+
+	return fastest;
+}
+
+//Records that a node finished frames
+void RGLInterface::frameDone(int node, unsigned int done)
+{
+	unsigned int before = pacingFramesDone();
+
+	atomicStore(&frames_done[node], done);
+
+	//Time the frame the pacing nodes just finished and let sendSync go on
+	unsigned int after = pacingFramesDone();
+	if(after > before) {
+		//Without a limit on frames in flight the frame's slot may already
+		//hold a newer frame, it isn't timed then
+		sent_lock->lock();
+		if(frames_sent - after < PACING_WINDOW)
+			atomicStore(&done_latency, (long)(timeMicroseconds() - sent_times[after % PACING_WINDOW]));
+		sent_lock->unlock();
+		done_event->signal();
+	}
+}
+
+//Sends all queued commands to the nodes
+void RGLInterface::flush()
+{
+	if(buffer_pointer == 0)
+		return;
+
 	sendCommand();
+	frame_flushes++;
+}
+
+//Marks the last command pushed in the frame if it only draws or ends a frame,
+//so pipes know what they can drop and where delta frames end
+void RGLInterface::closeCommand()
+{
+	if(command_id < 0)
+		return;
+
+	unsigned int length = buffer_pointer - command_start;
+	if(drop_frames && (gl_commands[command_id].flags & COMMAND_DROPPABLE))
+		frame->addDroppableRange(command_start, length);
+	if(gl_commands[command_id].flags & COMMAND_FRAME_END) {
+		frame->frame_end = command_start;
+		frame->frame_end_length = length;
+	}
+
+	command_id = -1;
+}
+
+//Called after each command is pushed to flush it if needed
+void RGLInterface::endCommand()
+{
+	//Keep a batch in one frame until glEnd so it can be culled as a whole
+	if(batch_start >= 0) {
+		frame->length = buffer_pointer;
+		frame->reserve(buffer_pointer + MAX_COMMAND_SIZE);
+		return;
+	}
+
+	if(!batch_commands || buffer_pointer >= flush_watermark)
+		flush();
+}
+
+//Works out which nodes can see the finished batch and marks it as culled for
+//the rest
+void RGLInterface::cullBatch()
+{
+	int words = (num_nodes + 31) / 32;
+	unsigned int *mask = new unsigned int[words];
+
+	if(cullBox(&modelview, mask) > 0) {
+		if(batch_color < 0) {
+			frame->addCulledRange(batch_start, buffer_pointer - batch_start, mask, words);
+		} else {
+			//The current color outlives the batch so its last change is kept
+			if(batch_color > batch_start)
+				frame->addCulledRange(batch_start, batch_color - batch_start, mask, words);
+			frame->addCulledRange(batch_color_end, buffer_pointer - batch_color_end, mask, words);
+		}
+	}
+
+	delete[] mask;
+}
+
+//Sets the bit of each node that can't see the batch's bounding box under a
+//matrix, returns the number of those nodes
+int RGLInterface::cullBox(const GLMatrix *matrix, unsigned int *mask)
+{
+	float corners[32];
+	int words = (num_nodes + 31) / 32;
+	int culled = 0;
+
+	//Move the corners of the bounding box into eye space
+	for(int i = 0; i < 8; i++) {
+		matrix->transform(&corners[i * 4],
+			(i & 1) ? batch_max[0] : batch_min[0],
+			(i & 2) ? batch_max[1] : batch_min[1],
+			(i & 4) ? batch_max[2] : batch_min[2],
+			1.0f);
+	}
+
+	for(int i = 0; i < words; i++)
+		mask[i] = 0;
+
+	for(int i = 0; i < num_nodes; i++) {
+		if(!pipes[i]->canSee(corners)) {
+			mask[i / 32] |= 1u << (i % 32);
+			culled++;
+		}
+	}
+
+	return culled;
+}
+
+//Grows the bounding box of the batch to hold a vertex
+void RGLInterface::growBatch(GLfloat x, GLfloat y, GLfloat z)
+{
+	if(batch_empty) {
+		batch_min[0] = batch_max[0] = x;
+		batch_min[1] = batch_max[1] = y;
+		batch_min[2] = batch_max[2] = z;
+		batch_empty = FALSE;
+	} else {
+		if(x < batch_min[0]) batch_min[0] = x;
+		if(x > batch_max[0]) batch_max[0] = x;
+		if(y < batch_min[1]) batch_min[1] = y;
+		if(y > batch_max[1]) batch_max[1] = y;
+		if(z < batch_min[2]) batch_min[2] = z;
+		if(z > batch_max[2]) batch_max[2] = z;
+	}
+}
+
+//Turns a color channel into a byte
+static unsigned char quantizeColor(GLfloat value)
+{
+	if(value <= 0.0f)
+		return 0;
+	if(value >= 1.0f)
+		return 255;
+	return (unsigned char)(value * 255.0f + 0.5f);
+}
+
+//Writes the packed run as a compact block
+void RGLInterface::pushCompactVertices()
+{
+	GLuint flags = packed_colors ? PACKED_VERTICES_COLORS : 0;
+	GLfloat scale[3], inverse[3];
+	unsigned int start = buffer_pointer;
+
+	//Quantize positions to steps across the bounding box
+	for(int axis = 0; axis < 3; axis++) {
+		scale[axis] = (batch_max[axis] - batch_min[axis]) / COMPACT_POSITION_STEPS;
+		inverse[axis] = scale[axis] > 0.0f ? 1.0f / scale[axis] : 0.0f;
+	}
+	for(unsigned int i = 0; i < packed_count; i++) {
+		for(int axis = 0; axis < 3; axis++) {
+			GLfloat steps = (packed_vertices[i * 6 + axis] - batch_min[axis]) * inverse[axis] + 0.5f;
+			packed_steps[i * 3 + axis] = steps >= COMPACT_POSITION_STEPS ? COMPACT_POSITION_STEPS : (unsigned short)steps;
+		}
+	}
+
+	//Use deltas if their varints take less than the 16 bit planes
+	char scratch[VARINT_MAX_SIZE];
+	unsigned int delta_size = 0;
+	for(unsigned int i = 3; i < packed_count * 3; i++)
+		delta_size += encodeVarint(scratch, encodeZigzag((int)packed_steps[i] - (int)packed_steps[i - 3]));
+	if(delta_size < 3 * sizeof(unsigned short) * (packed_count - 1) && delta_size < 1U << (32 - COMPACT_DELTA_SHIFT))
+		flags |= COMPACT_VERTICES_DELTA | delta_size << COMPACT_DELTA_SHIFT;
+
+	//Make room for the whole block in the current frame
+	unsigned int size = compactDataSize(packed_count, flags);
+	frame->length = buffer_pointer;
+	frame->reserve(buffer_pointer + 4 * sizeof(int) + 6 * sizeof(GLfloat) + size + MAX_COMMAND_SIZE);
+
+	GLfloat box[6] = {batch_min[0], batch_min[1], batch_min[2], scale[0], scale[1], scale[2]};
+	push_glDrawCompactVertices(packed_mode, packed_count, flags, box);
+
+	char *data = &frame->data[buffer_pointer];
+	if(flags & COMPACT_VERTICES_DELTA) {
+		//The first vertex, then a plane of deltas for each axis
+		memcpy(data, packed_steps, 3 * sizeof(unsigned short));
+		data += 3 * sizeof(unsigned short);
+		for(int axis = 0; axis < 3; axis++) {
+			for(unsigned int i = 1; i < packed_count; i++)
+				data += encodeVarint(data, encodeZigzag((int)packed_steps[i * 3 + axis] - (int)packed_steps[(i - 1) * 3 + axis]));
+		}
+	} else {
+		//A plane of steps for each axis
+		for(int axis = 0; axis < 3; axis++) {
+			for(unsigned int i = 0; i < packed_count; i++) {
+				memcpy(data, &packed_steps[i * 3 + axis], sizeof(unsigned short));
+				data += sizeof(unsigned short);
+			}
+		}
+	}
+
+	if(flags & PACKED_VERTICES_COLORS) {
+		data = &frame->data[buffer_pointer + size - 4 * packed_count];
+		for(unsigned int i = 0; i < packed_count; i++) {
+			*data++ = quantizeColor(packed_vertices[i * 6 + 3]);
+			*data++ = quantizeColor(packed_vertices[i * 6 + 4]);
+			*data++ = quantizeColor(packed_vertices[i * 6 + 5]);
+			*data++ = (char)255;
+		}
+	}
+
+	buffer_pointer += size;
+	compact_bytes += buffer_pointer - start;
+	compact_vertex_count += packed_count;
+
+	if(compact_error_test)
+		reportCompactError(flags, batch_min, scale, buffer_pointer - start);
+}
+
+//Prints how far the compact run is from the packed one
+void RGLInterface::reportCompactError(unsigned int flags, GLfloat *min, GLfloat *scale, unsigned int size)
+{
+	GLfloat position_error = 0.0f;
+	GLfloat color_error = 0.0f;
+
+	for(unsigned int i = 0; i < packed_count; i++) {
+		for(int axis = 0; axis < 3; axis++) {
+			GLfloat error = fabs(min[axis] + packed_steps[i * 3 + axis] * scale[axis] - packed_vertices[i * 6 + axis]);
+			if(error > position_error)
+				position_error = error;
+		}
+
+		if(flags & PACKED_VERTICES_COLORS) {
+			for(int channel = 3; channel < 6; channel++) {
+				GLfloat error = fabs(quantizeColor(packed_vertices[i * 6 + channel]) / 255.0f - packed_vertices[i * 6 + channel]);
+				if(error > color_error)
+					color_error = error;
+			}
+		}
+	}
+
+	printf("Compact run: %u vertices, %s positions, %.2f bytes per vertex, max position error %g, max color error %g\n",
+		packed_count, (flags & COMPACT_VERTICES_DELTA) ? "delta" : "16 bit", (float)size / packed_count,
+		position_error, color_error);
+}
+
+//Sends the packed run as a single command
+void RGLInterface::sendPackedVertices()
+{
+	unsigned int start = buffer_pointer;
+
+	//Copies of a run are held back to go out together
+	if(use_instancing && packed_count > 0) {
+		queueInstance();
+		return;
+	}
+
+	if(packed_count > 0)
+		start = encodePackedRun();
+
+	if(packed_count > 0 && culling) {
+		batch_start = start;
+		batch_color = -1;
+		cullBatch();
+		batch_start = -1;
+	}
+
+	//Drawing with a color array leaves the current color undefined, so the
+	//color the run ended with is set again outside of the culled block
+	if(packed_colors) {
+		push_glColor3f(current_color[0], current_color[1], current_color[2]);
+	}
+
+	endCommand();
+}
+
+//Encodes the packed run, returns where the command drawing it starts
+unsigned int RGLInterface::encodePackedRun()
+{
+	GLuint flags = packed_colors ? PACKED_VERTICES_COLORS : 0;
+	unsigned int floats = packedVertexFloats(flags);
+	unsigned int start = buffer_pointer;
+
+	if(compact_vertices) {
+		pushCompactVertices();
+	} else {
+		//Make room for the whole block in the current frame
+		frame->length = buffer_pointer;
+		frame->reserve(buffer_pointer + 4 * sizeof(int) + packed_count * floats * sizeof(GLfloat) + MAX_COMMAND_SIZE);
+
+		push_glDrawVertices(packed_mode, packed_count, flags);
+
+		if(packed_colors) {
+			memcpy(&frame->data[buffer_pointer], packed_vertices, packed_count * 6 * sizeof(GLfloat));
+			buffer_pointer += packed_count * 6 * sizeof(GLfloat);
+		} else {
+			//Every vertex has the current color so only positions are sent
+			for(unsigned int i = 0; i < packed_count; i++) {
+				memcpy(&frame->data[buffer_pointer], &packed_vertices[i * 6], 3 * sizeof(GLfloat));
+				buffer_pointer += 3 * sizeof(GLfloat);
+			}
+		}
+	}
+
+	//Blocks the nodes already have go out as their slot
+	if(geometry_cache)
+		start = cacheBlock(start);
+
+	return start;
+}
+
+//Starts over with empty geometry caches if they are in use
+void RGLInterface::createGeometryCache()
+{
+	if(geometry_cache) {
+		delete geometry_cache;
+		geometry_cache = NULL;
+	}
+
+	if(!use_geometry_cache)
+		return;
+
+	//Blocks are only whole when glBegin/glEnd runs are packed
+	if(!pack_vertices) {
+		printf("The geometry cache needs packVertices, sending every block\n");
+		use_geometry_cache = FALSE;
+		return;
+	}
+
+	if(cache_slots < 1)
+		cache_slots = 1;
+	if(cache_slots > CACHE_MAX_SLOTS)
+		cache_slots = CACHE_MAX_SLOTS;
+	geometry_cache = new GLGeometryCache(cache_slots, cache_bytes);
+}
+
+//Forgets the cache slots and state the nodes are thought to hold when a node
+//asked for a keyframe, so the keyframe needs nothing it skipped. A node that
+//lost track of the stream skips CacheStore commands and state the peephole
+//pass takes out later. The cache and the peephole state are shared by every
+//node, so every node gets the blocks again and stale slots are stored over
+//before they are drawn
+void RGLInterface::forgetNodeState()
+{
+	BOOL requested = FALSE;
+
+	if(capture)
+		return;
+
+	for(int i = 0; i < num_nodes; i++) {
+		if(pipes[i]->keyframeRequested())
+			requested = TRUE;
+	}
+	if(!requested)
+		return;
+
+	if(geometry_cache)
+		geometry_cache->clear();
+	if(peephole)
+		peephole->reset();
+
+	//The keyframe starts at the first frame encoded from here on
+	state_generation++;
+	for(int i = 0; i < num_nodes; i++)
+		pipes[i]->startKeyframe(state_generation);
+}
+
+//Replaces the block encoded at start with a draw from the geometry cache,
+//storing it first if the nodes don't have it. Returns where the draw starts
+unsigned int RGLInterface::cacheBlock(unsigned int start)
+{
+	unsigned int length = buffer_pointer - start;
+	char header[MAX_COMMAND_SIZE];
+	int slot;
+
+	if(length < CACHE_MIN_BLOCK)
+		return start;
+
+	//The store and draw commands go where the block is, make sure they fit
+	frame->length = buffer_pointer;
+	frame->reserve(buffer_pointer + 2 * MAX_COMMAND_SIZE);
+
+	if(geometry_cache->lookup(&frame->data[start], length, &slot)) {
+		//The nodes have it, so only the slot goes out
+		buffer_pointer = start;
+		command_id = -1;
+	} else if(slot >= 0) {
+		//Encode the store after the block, then move it in front of it
+		command_id = -1;
+		push_CacheStore(slot);
+
+		unsigned int header_length = buffer_pointer - (start + length);
+		memcpy(header, &frame->data[start + length], header_length);
+		memmove(&frame->data[start + header_length], &frame->data[start], length);
+		memcpy(&frame->data[start], header, header_length);
+
+		//The store and the block are one command that every node needs
+		command_start = start;
+	} else {
+		//Too big for the cache
+		return start;
+	}
+
+	unsigned int draw = buffer_pointer;
+	push_CacheDraw(slot);
+
+	return draw;
+}
+
+//Returns how well the geometry cache is doing, all zero without it
+CacheStats RGLInterface::getCacheStats()
+{
+	CacheStats stats;
+
+	if(geometry_cache)
+		return geometry_cache->getStats();
+
+	memset(&stats, 0, sizeof(stats));
+	return stats;
+}
+
+//Sends a syncronization packet telling the nodes to swap buffers, waits
+//first if too many frames are in flight. Returns how frames are paced
+FramePacing RGLInterface::sendSync()
+{
+	FramePacing pacing;
+	unsigned long long start = timeMicroseconds();
+
+	//Hold the frame back until the slowest node has room for it, a node that
+	//drops frames catches up on its own
+	if(max_frames_in_flight && frames_done) {
+		while(frames_sent - pacingFramesDone() >= max_frames_in_flight) {
+			if(!done_event->wait(FLOW_CONTROL_TIMEOUT)) {
+				printf("No node finished a frame in %dms, sending anyway\n", FLOW_CONTROL_TIMEOUT);
+				break;
+			}
+		}
+	}
+
+	unsigned long long now = timeMicroseconds();
+	pacing.wait = (unsigned int)(now - start);
+	pacing.interval = last_sync ? (unsigned int)(now - last_sync) : 0;
+	if(sent_lock)
+		sent_lock->lock();
+	sent_times[++frames_sent % PACING_WINDOW] = now;
+	if(sent_lock)
+		sent_lock->unlock();
+
+	if(present_delay) {
+		sendClock();
+
+		//Give every node time to get and draw the frame, then present it
+		//on all of them at once
+		unsigned long long target = timeMicroseconds() + present_delay;
+		PresentRecord *record = &present_records[++present_frame % PRESENT_WINDOW];
+		record->count = 0;
+		record->target = target;
+		record->frame = present_frame;
+
+		push_PresentAt(present_frame, (GLuint)target, (GLuint)(target >> 32));
+		flush();
+	} else if(swap_barrier) {
+		//Nodes report when they have drawn the frame, the swap is released
+		//before the first command of the next one. Pushing the command
+		//releases the last barrier if it is still pending, so the frame only
+		//moves on after it. Late reports for the last frame stop matching
+		//before the count starts over, and a signal they left is cleared
+		push_SwapBarrier(barrier_frame + 1);
+		atomicStore(&barrier_frame, barrier_frame + 1);
+		atomicStore(&barrier_ready, 0);
+		barrier_event->reset();
+		barrier_start = timeMicroseconds();
+		flush();
+		barrier_pending = TRUE;
+	} else {
+		push_Sync();
+		flush();
+	}
+
+	//The node may reset its matrices between frames, the first draw of the
+	//next one loads the matrix again
+	matrix_dirty = TRUE;
+	node_matrix_known = FALSE;
+
+	//Nothing of the next frame has been encoded yet, so it can start over
+	forgetNodeState();
+
+	//Start counting flushes for the next frame
+	last_frame_flushes = frame_flushes;
+	frame_flushes = 0;
+	last_frame_bytes = frame_bytes;
+	frame_bytes = 0;
+
+	pacing.frame = frames_sent;
+	pacing.in_flight = frames_done ? frames_sent - pacingFramesDone() : 0;
+	pacing.latency = (unsigned int)atomicLoad(&done_latency);
+	pacing_wait_total += pacing.wait;
+	pacing_latency_total += pacing.latency;
+	last_sync = timeMicroseconds();
+
+	return pacing;
+}
+
+//Returns the number of flushes it took to send the last frame
+unsigned int RGLInterface::getFrameFlushes()
+{
+	return last_frame_flushes;
+}
+
+//Returns the number of bytes it took to send the last frame
+unsigned int RGLInterface::getFrameBytes()
+{
+	return last_frame_bytes;
+}
+
+//Returns the microseconds from ending the last released frame until every
+//node had drawn it
+unsigned int RGLInterface::getBarrierLatency()
+{
+	return last_barrier_latency;
+}
+
+//Returns the microseconds the next frame was held up releasing the last
+//barrier
+unsigned int RGLInterface::getBarrierWait()
+{
+	return last_barrier_wait;
+}
+
+//Returns the microseconds between the first and last node presenting the
+//last frame every node reported
+unsigned int RGLInterface::getPresentSkew()
+{
+	return last_skew;
+}
+
+//Prints out statistics about how frames are being sent
+void RGLInterface::printStats()
+{
+	printf("Last frame took %u flushes and %u bytes\n", last_frame_flushes, last_frame_bytes);
+
+	if(swap_barrier && barrier_count > 0)
+		printf("Swap barrier: last frame ready after %uus and held up %uus, %.0fus and %.0fus on average\n",
+			last_barrier_latency, last_barrier_wait, (double)barrier_latency_total / barrier_count,
+			(double)barrier_wait_total / barrier_count);
+
+	if(frames_done && frames_sent > 0)
+		printf("Pacing: %u frames in flight, %.0fus average wait for a node and %.0fus from sending to finishing a frame\n",
+			frames_sent - pacingFramesDone(), (double)pacing_wait_total / frames_sent,
+			(double)pacing_latency_total / frames_sent);
+
+	if(present_delay) {
+		for(int i = 0; i < num_nodes; i++)
+			pipes[i]->printClock();
+
+		if(skew_frames > 0)
+			printf("Scheduled present: %uus skew on the last frame, %.0fus average and %uus worst, last node %.0fus after the target on average\n",
+				last_skew, (double)skew_total / skew_frames, worst_skew, (double)lateness_total / skew_frames);
+	}
+
+	if(multicast)
+		multicast->printStats();
+
+	if(send_port)
+		send_port->printStats();
+
+	if(culling) {
+		for(int i = 0; i < num_nodes; i++)
+			pipes[i]->printStats();
+	}
+
+	if(drop_frames) {
+		for(int i = 0; i < num_nodes; i++)
+			pipes[i]->printDrops();
+	}
+
+	if(delta_frames) {
+		for(int i = 0; i < num_nodes; i++)
+			pipes[i]->printDelta();
+	}
+
+	if(compact_vertex_count > 0)
+		printf("Compact runs: %.2f bytes per vertex\n", (double)compact_bytes / (double)compact_vertex_count);
+
+	if(geometry_cache)
+		geometry_cache->printStats();
+
+	if(fold_transforms)
+		printf("Transforms: %u folded into %u matrix loads\n", transforms_folded, matrix_loads);
+
+	if(peephole)
+		peephole->printStats();
+
+	if(use_instancing)
+		printf("Instancing: %u copies drawn with %u instanced draws\n", instances_sent, instanced_draws);
+}
+
+//Sends the folded transforms as one matrix load before something is drawn with
+//them
+void RGLInterface::flushMatrix()
+{
+	if(!matrix_dirty)
+		return;
+	matrix_dirty = FALSE;
+
+	if(sendMatrix(&modelview))
+		endCommand();
+}
+
+//Loads a matrix on the nodes unless they already have it. Returns TRUE if a
+//command was pushed
+BOOL RGLInterface::sendMatrix(const GLMatrix *matrix)
+{
+	//The transforms ended up where the nodes already are
+	if(node_matrix_known && !memcmp(node_modelview.m, matrix->m, sizeof(matrix->m)))
+		return FALSE;
+
+	node_modelview = *matrix;
+	node_matrix_known = TRUE;
+	matrix_loads++;
+
+	if(matrix->isIdentity()) {
+		push_glLoadIdentity();
+		return TRUE;
+	}
+
+	push_glLoadMatrixf(matrix->m);
+	return TRUE;
+}
+
+//Swaps the packed run with the one waiting for copies
+void RGLInterface::swapInstanceRun()
+{
+	GLenum mode = packed_mode;
+	packed_mode = instance_mode;
+	instance_mode = mode;
+
+	GLfloat *vertices = packed_vertices;
+	packed_vertices = instance_vertices;
+	instance_vertices = vertices;
+
+	unsigned int count = packed_count;
+	packed_count = instance_vertex_count;
+	instance_vertex_count = count;
+
+	unsigned int capacity = packed_capacity;
+	packed_capacity = instance_vertex_capacity;
+	instance_vertex_capacity = capacity;
+
+	BOOL colors = packed_colors;
+	packed_colors = instance_colors;
+	instance_colors = colors;
+
+	unsigned short *steps = packed_steps;
+	packed_steps = instance_steps;
+	instance_steps = steps;
+
+	for(int axis = 0; axis < 3; axis++) {
+		float bound = batch_min[axis];
+		batch_min[axis] = instance_min[axis];
+		instance_min[axis] = bound;
+
+		bound = batch_max[axis];
+		batch_max[axis] = instance_max[axis];
+		instance_max[axis] = bound;
+	}
+}
+
+//Adds the packed run as a copy of the run waiting for copies, or sends those
+//copies and has the packed run wait instead
+void RGLInterface::queueInstance()
+{
+	//Any other run ends the copies of the last one
+	if(instance_count == 0 || packed_mode != instance_mode || packed_count != instance_vertex_count ||
+			packed_colors != instance_colors || memcmp(current_color, instance_color, sizeof(instance_color)) ||
+			memcmp(packed_vertices, instance_vertices, packed_count * 6 * sizeof(GLfloat))) {
+		flushInstances();
+		swapInstanceRun();
+		memcpy(instance_color, current_color, sizeof(instance_color));
+	}
+
+	if(instance_count == instance_capacity) {
+		unsigned int capacity = instance_capacity ? instance_capacity * 2 : 64;
+		GLMatrix *grown = new GLMatrix[capacity];
+		for(unsigned int i = 0; i < instance_count; i++)
+			grown[i] = instance_matrices[i];
+		if(instance_matrices)
+			delete[] instance_matrices;
+		instance_matrices = grown;
+		instance_capacity = capacity;
+	}
+
+	instance_matrices[instance_count++] = modelview;
+}
+
+//Sends the copies waiting to be drawn
+void RGLInterface::flushInstances()
+{
+	if(instance_count == 0)
+		return;
+
+	//Commands pushed from here on don't come back here
+	unsigned int count = instance_count;
+	instance_count = 0;
+
+	//Encode from the run that was waiting, the packed buffers are put back
+	//at the end
+	swapInstanceRun();
+
+	int words = (num_nodes + 31) / 32;
+	unsigned int *mask = new unsigned int[words];
+	unsigned int *copy_mask = new unsigned int[words];
+	unsigned int visible = 0;
+	BOOL any_culled = FALSE;
+
+	//Copies no node can see are left out, the rest are culled for the nodes
+	//that can see none of them
+	for(int i = 0; i < words; i++)
+		mask[i] = ~0u;
+	for(unsigned int i = 0; i < count; i++) {
+		if(culling) {
+			if(cullBox(&instance_matrices[i], copy_mask) == num_nodes)
+				continue;
+			for(int j = 0; j < words; j++)
+				mask[j] &= copy_mask[j];
+		}
+		instance_matrices[visible++] = instance_matrices[i];
+	}
+	for(int i = 0; i < words; i++) {
+		if(culling && mask[i])
+			any_culled = TRUE;
+	}
+
+	unsigned int start = buffer_pointer;
+	if(visible == 1) {
+		//A single copy is sent like any other run
+		sendMatrix(&instance_matrices[0]);
+		start = encodePackedRun();
+	} else if(visible > 1) {
+		//Matrices take 12 floats if none of them project
+		GLuint flags = INSTANCES_AFFINE;
+		for(unsigned int i = 0; i < visible; i++) {
+			if(!instance_matrices[i].isAffine())
+				flags = 0;
+		}
+		unsigned int floats = instanceMatrixFloats(flags);
+
+		//Encode the block first, with its cache store in front of it if it
+		//needs one, so the draw can be wrapped in the instanced draw
+		start = encodePackedRun();
+		command_id = -1;
+		unsigned int draw_length = buffer_pointer - start;
+
+		//Move the draw past where the instanced draw's arguments go
+		char varint[VARINT_MAX_SIZE];
+		unsigned int header = visible * floats * sizeof(GLfloat);
+		if(protocol_revision >= PROTOCOL_REVISION_2)
+			header += 1 + encodeVarint(varint, visible) + encodeVarint(varint, flags);
+		else
+			header += 3 * sizeof(int);
+
+		frame->length = buffer_pointer;
+		frame->reserve(buffer_pointer + header + MAX_COMMAND_SIZE);
+		memmove(&frame->data[start + header], &frame->data[start], draw_length);
+
+		buffer_pointer = start;
+		push_DrawInstances(visible, flags);
+		for(unsigned int i = 0; i < visible; i++) {
+			for(int column = 0; column < 4; column++) {
+				for(unsigned int row = 0; row < floats / 4; row++)
+					pushGLfloat(instance_matrices[i].m[column * 4 + row]);
+			}
+		}
+		buffer_pointer += draw_length;
+		instanced_draws++;
+	}
+	instances_sent += visible;
+
+	if(visible > 0 && any_culled)
+		frame->addCulledRange(start, buffer_pointer - start, mask, words);
+
+	//Drawing with a color array leaves the current color undefined
+	if(visible > 0 && packed_colors) {
+		push_glColor3f(instance_color[0], instance_color[1], instance_color[2]);
+	}
+
+	swapInstanceRun();
+	delete[] mask;
+	delete[] copy_mask;
 }
 
 //------------------------------------------------------------------------------
@@ -246,91 +1803,204 @@ void RGLInterface::sendSync()
 //1: glClearColor  specify clear values for the color buffers
 void RGLInterface::glClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha)
 {
-	pushCommand(1);
-	pushGLfloat(red);
-	pushGLfloat(green);
-	pushGLfloat(blue);
-	pushGLfloat(alpha);
-	sendCommand();
+	push_glClearColor(red, green, blue, alpha);
+	endCommand();
 }
 
 //2: glClear  clear buffers to preset values
 void RGLInterface::glClear(GLbitfield mask)
 {
-	pushCommand(2);
-	pushGLbitfield(mask);
-	sendCommand();
+	push_glClear(mask);
+	endCommand();
 }
 
 //3: glLoadIdentity  replace the current matrix with the identity matrix
 void RGLInterface::glLoadIdentity()
 {
-	pushCommand(3);
-	sendCommand();
+	modelview.identity();
+
+	//Sent as part of the next matrix load
+	if(fold_transforms) {
+		matrix_dirty = TRUE;
+		transforms_folded++;
+		return;
+	}
+
+	push_glLoadIdentity();
+	endCommand();
 }
 
 //4: glTranslatef  multiply the current matrix by a translation matrix
 void RGLInterface::glTranslatef(GLfloat x, GLfloat y, GLfloat z)
 {
-	pushCommand(4);
-	pushGLfloat(x);
-	pushGLfloat(y);
-	pushGLfloat(z);
-	sendCommand();
+	modelview.translate(x, y, z);
+
+	if(fold_transforms) {
+		matrix_dirty = TRUE;
+		transforms_folded++;
+		return;
+	}
+
+	push_glTranslatef(x, y, z);
+	endCommand();
 }
 
 //5: glBegin  delimit the vertices of a primitive or a group of like primitives
 void RGLInterface::glBegin(GLenum mode)
 {
-	pushCommand(5);
-	pushGLenum(mode);
-	sendCommand();
+	//The nodes need the transforms before anything is drawn with them,
+	//copies are sent with their own matrices
+	if(!use_instancing)
+		flushMatrix();
+
+	//Gather the run into one block that is sent at glEnd
+	if(pack_vertices) {
+		packing = TRUE;
+		packed_mode = mode;
+		packed_count = 0;
+		packed_colors = FALSE;
+		batch_empty = TRUE;
+		return;
+	}
+
+	//Start tracking the batch before the command so it isn't flushed early
+	if(culling) {
+		batch_start = buffer_pointer;
+		batch_color = -1;
+		batch_empty = TRUE;
+	}
+
+	push_glBegin(mode);
+	endCommand();
 }
 
 //6: glEnd  delimit the vertices of a primitive or a group of like primitives
 void RGLInterface::glEnd()
 {
-	pushCommand(6);
-	sendCommand();
+	if(packing) {
+		packing = FALSE;
+		sendPackedVertices();
+		return;
+	}
+
+	push_glEnd();
+
+	if(batch_start >= 0) {
+		if(!batch_empty)
+			cullBatch();
+		batch_start = -1;
+	}
+
+	endCommand();
 }
 
 //7: glVertex3f  Specifies a vertex
 void RGLInterface::glVertex3f(GLfloat x, GLfloat y, GLfloat z)
 {
-	pushCommand(7);
-	pushGLfloat(x);
-	pushGLfloat(y);
-	pushGLfloat(z);
-	sendCommand();
+	if(packing) {
+		//Make room for the vertex
+		if(packed_count == packed_capacity) {
+			unsigned int capacity = packed_capacity ? packed_capacity * 2 : 1024;
+			GLfloat *grown = new GLfloat[capacity * 6];
+			if(packed_vertices) {
+				memcpy(grown, packed_vertices, packed_count * 6 * sizeof(GLfloat));
+				delete[] packed_vertices;
+			}
+			packed_vertices = grown;
+			packed_capacity = capacity;
+
+			//Quantized positions are only needed while encoding
+			if(packed_steps)
+				delete[] packed_steps;
+			packed_steps = new unsigned short[capacity * 3];
+		}
+
+		GLfloat *vertex = &packed_vertices[packed_count * 6];
+		vertex[0] = x;
+		vertex[1] = y;
+		vertex[2] = z;
+		vertex[3] = current_color[0];
+		vertex[4] = current_color[1];
+		vertex[5] = current_color[2];
+		packed_count++;
+
+		growBatch(x, y, z);
+		return;
+	}
+
+	push_glVertex3f(x, y, z);
+
+	if(batch_start >= 0)
+		growBatch(x, y, z);
+
+	endCommand();
 }
 
 //8: glColor3f  Sets the current color
 void RGLInterface::glColor3f(GLfloat red, GLfloat green, GLfloat blue)
 {
-	pushCommand(8);
-	pushGLfloat(red);
-	pushGLfloat(green);
-	pushGLfloat(blue);
-	sendCommand();
+	current_color[0] = red;
+	current_color[1] = green;
+	current_color[2] = blue;
+
+	//Inside a packed run the color goes out with the vertices
+	if(packing) {
+		packed_colors = TRUE;
+		return;
+	}
+
+	if(batch_start >= 0)
+		batch_color = buffer_pointer;
+
+	push_glColor3f(red, green, blue);
+
+	if(batch_start >= 0)
+		batch_color_end = buffer_pointer;
+
+	endCommand();
 }
 
 //9: glRotatef  multiply the current matrix by a rotation matrix
 void RGLInterface::glRotatef(GLfloat angle, GLfloat x, GLfloat y, GLfloat z)
 {
-	pushCommand(9);
-	pushGLfloat(angle);
-	pushGLfloat(x);
-	pushGLfloat(y);
-	pushGLfloat(z);
-	sendCommand();
+	modelview.rotate(angle, x, y, z);
+
+	if(fold_transforms) {
+		matrix_dirty = TRUE;
+		transforms_folded++;
+		return;
+	}
+
+	push_glRotatef(angle, x, y, z);
+	endCommand();
 }
 
 //10: glScalef - multiply the current matrix by a general scaling matrix
 void RGLInterface::glScalef(GLfloat x, GLfloat y, GLfloat z)
 {
-	pushCommand(10);
-	pushGLfloat(x);
-	pushGLfloat(y);
-	pushGLfloat(z);
-	sendCommand();
+	modelview.scale(x, y, z);
+
+	if(fold_transforms) {
+		matrix_dirty = TRUE;
+		transforms_folded++;
+		return;
+	}
+
+	push_glScalef(x, y, z);
+	endCommand();
+}
+
+//21: glLoadMatrixf - replace the current matrix with the specified matrix
+void RGLInterface::glLoadMatrixf(const GLfloat *m)
+{
+	modelview.load(m);
+
+	if(fold_transforms) {
+		matrix_dirty = TRUE;
+		transforms_folded++;
+		return;
+	}
+
+	push_glLoadMatrixf(m);
+	endCommand();
 }
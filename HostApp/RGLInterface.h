@@ -9,6 +9,9 @@
 #define _CRT_SECURE_NO_WARNINGS
 
 #include "GLPipe.h"
+#include "GLMulticast.h"
+#include "GLGeometryCache.h"
+#include "GLPeephole.h"
 
 #ifndef CAPTUREDLL
 #include <gl\gl.h>
@@ -17,9 +20,68 @@
 #include "dummy_gl.h"
 #endif
 
-//The size of the buffer to hold command and arguments
+//The largest number of command bytes that can be queued before a flush
 #define BUFFER_SIZE 10485760
 
+//Largest number of bytes a single command and its arguments can take
+#define MAX_COMMAND_SIZE 128
+
+//Default number of queued bytes that forces a flush in batched mode
+#define FLUSH_WATERMARK 65536
+
+//Milliseconds to wait for every node to be ready before swapping anyway
+#define SWAP_BARRIER_TIMEOUT 1000
+
+//Frames between clock probes once the offsets have settled
+#define CLOCK_PROBE_INTERVAL 30
+
+//Frames at the start that each carry a probe so the offsets settle quickly
+#define CLOCK_STARTUP_PROBES 16
+
+//Number of probes whose send times are kept for their answers
+#define CLOCK_PROBE_TIMES 64
+
+//Number of frames whose present times are tracked at once
+#define PRESENT_WINDOW 64
+
+//Number of frames whose send times are kept to time their acknowledgements,
+//also the most frames that can be in flight
+#define PACING_WINDOW 64
+
+//Milliseconds to wait for a node to finish a frame before sending anyway
+#define FLOW_CONTROL_TIMEOUT 1000
+
+//How the last frame was paced, returned by sendSync
+struct FramePacing {
+	//Number of frames sent so far
+	unsigned int frame;
+
+	//Frames sent that the slowest node hasn't finished yet
+	unsigned int in_flight;
+
+	//Microseconds sendSync waited for a node to finish a frame
+	unsigned int wait;
+
+	//Microseconds since the previous sendSync
+	unsigned int interval;
+
+	//Microseconds from sending the slowest node's last finished frame until
+	//it was finished
+	unsigned int latency;
+};
+
+//When the nodes presented a frame ended by PresentAt
+struct PresentRecord {
+	//Frame number and the host time it was meant to be presented at
+	unsigned int frame;
+	unsigned long long target;
+
+	//Nodes that reported it and the earliest and latest of their times
+	int count;
+	unsigned long long first;
+	unsigned long long last;
+};
+
 class RGLInterface
 {
 private:
@@ -29,8 +91,11 @@ private:
 	//Pipes for each node
 	GLPipe **pipes;
 
-	//The buffer that holds queued data
-	char *buffer;
+	//Frames to encode commands into
+	GLFramePool *frame_pool;
+
+	//The frame that holds queued data
+	GLFrame *frame;
 
 	//Buffer pointer for pushing data
 	unsigned int buffer_pointer;
@@ -38,6 +103,364 @@ private:
 	//Total dimensions of host application
 	int width, height;
 
+	//Should commands be queued until a flush instead of sent one at a time
+	BOOL batch_commands;
+
+	//Number of queued bytes that forces a flush in batched mode
+	unsigned int flush_watermark;
+
+	//Should pipes send frames without copying them into socket buffers
+	BOOL zero_copy;
+
+	//Should nodes on this machine get the stream through shared memory, and
+	//the bytes of each ring
+	BOOL shared_memory;
+	unsigned int shared_memory_size;
+
+	//Should one thread send for every pipe through a completion port instead
+	//of each pipe sending from its own thread
+	BOOL completion_port;
+
+	//Port the pipes send through, or NULL
+	GLSendPort *send_port;
+
+	//Should small sends go out right away instead of being coalesced, and the
+	//socket buffer sizes to ask for, 0 leaves them to the OS
+	BOOL tcp_no_delay;
+	int send_buffer_size;
+	int receive_buffer_size;
+
+	//Milliseconds a connect attempt and a handshake may take, and how many
+	//times a failed connect is tried again
+	unsigned int connect_timeout;
+	int connect_retries;
+
+	//Should the command stream be sent once through a multicast group
+	BOOL use_multicast;
+
+	//Multicast group settings
+	char multicast_group[32];
+	int multicast_port;
+	char multicast_interface[32];
+	int multicast_ttl;
+	BOOL multicast_loopback;
+	int multicast_drop_rate;
+
+	//Sends frames to the multicast group
+	GLMulticast *multicast;
+
+	//Thread reading messages sent back by the nodes
+	GLThread *backchannel;
+
+	//Non-zero while the backchannel thread should keep running
+	volatile long backchannel_running;
+
+	//Handles a message sent back by a node
+	void handleMessage(int node, BackchannelMessage *message);
+
+	//Number of flushes in the frame being built and in the last full frame
+	unsigned int frame_flushes;
+	unsigned int last_frame_flushes;
+
+	//Bytes sent for the frame being built and for the last full frame
+	unsigned int frame_bytes;
+	unsigned int last_frame_bytes;
+
+	//Protocol revision asked for in the config, then the one every node uses
+	unsigned int protocol_revision;
+
+	//Should frames be sent with their length so nodes can parse them whole
+	BOOL length_prefix;
+
+	//Should each node get frames as edits of the last frame it got, and the
+	//frames between keyframes
+	BOOL delta_frames;
+	unsigned int delta_keyframe;
+
+	//When set, commands are appended here instead of being sent to nodes
+	GLFrame *capture;
+
+	//Called after each command is pushed to flush it if needed
+	void endCommand();
+
+	//Should batches be skipped on nodes whose part of the view they miss
+	BOOL culling;
+
+	//The modelview matrix built by the commands sent so far
+	GLMatrix modelview;
+
+	//Should transforms be folded into the modelview matrix here and sent as
+	//one matrix load before the next draw
+	BOOL fold_transforms;
+
+	//Set when transforms were folded since the last matrix load
+	BOOL matrix_dirty;
+
+	//The matrix the nodes have, valid until the end of the frame
+	GLMatrix node_modelview;
+	BOOL node_matrix_known;
+
+	//Transforms folded and matrix loads sent for them
+	unsigned int transforms_folded;
+	unsigned int matrix_loads;
+
+	//Sends the folded transforms as one matrix load before something is
+	//drawn with them
+	void flushMatrix();
+
+	//Loads a matrix on the nodes unless they already have it. Returns TRUE
+	//if a command was pushed
+	BOOL sendMatrix(const GLMatrix *matrix);
+
+	//Should each frame be passed over to take out commands that change
+	//nothing on the nodes before it is sent
+	BOOL use_peephole;
+
+	//Pass run over each frame, or NULL
+	GLPeephole *peephole;
+
+	//Offset of the glBegin of the batch being built, or -1 outside a batch
+	int batch_start;
+
+	//Offset of the last color command in the batch, or -1 if there is none,
+	//and the offset just past it
+	int batch_color;
+	int batch_color_end;
+
+	//Bounding box of the vertices in the batch
+	float batch_min[3];
+	float batch_max[3];
+	BOOL batch_empty;
+
+	//Works out which nodes can see the finished batch and marks it as
+	//culled for the rest
+	void cullBatch();
+
+	//Sets the bit of each node that can't see the batch's bounding box under
+	//a matrix, returns the number of those nodes
+	int cullBox(const GLMatrix *matrix, unsigned int *mask);
+
+	//Grows the bounding box of the batch to hold a vertex
+	void growBatch(GLfloat x, GLfloat y, GLfloat z);
+
+	//Should glBegin/glEnd runs be sent as one packed block of vertices
+	BOOL pack_vertices;
+
+	//TRUE between glBegin and glEnd while vertices are being packed
+	BOOL packing;
+
+	//Primitive mode of the run being packed
+	GLenum packed_mode;
+
+	//Vertices of the run being packed, each x, y, z, r, g, b
+	GLfloat *packed_vertices;
+	unsigned int packed_count;
+	unsigned int packed_capacity;
+
+	//Set if the color changed during the run so colors have to be sent
+	BOOL packed_colors;
+
+	//The color set by the last glColor3f
+	GLfloat current_color[3];
+
+	//Sends the packed run as a single command
+	void sendPackedVertices();
+
+	//Encodes the packed run, returns where the command drawing it starts
+	unsigned int encodePackedRun();
+
+	//Should packed runs be sent with quantized attributes when every node
+	//accepts them
+	BOOL compact_vertices;
+
+	//Should the error of every compact run be printed
+	BOOL compact_error_test;
+
+	//Positions of the packed run in quantization steps, x, y, z per vertex
+	unsigned short *packed_steps;
+
+	//Bytes and vertices sent in compact runs
+	unsigned long long compact_bytes;
+	unsigned long long compact_vertex_count;
+
+	//Writes the packed run as a compact block
+	void pushCompactVertices();
+
+	//Should packed runs the nodes already have be sent as a cache slot, and
+	//how many blocks and bytes each node keeps
+	BOOL use_geometry_cache;
+	int cache_slots;
+	unsigned int cache_bytes;
+
+	//Blocks the nodes have in their caches, or NULL
+	GLGeometryCache *geometry_cache;
+
+	//Starts over with empty geometry caches if they are in use
+	void createGeometryCache();
+
+	//Times the host has forgotten what the nodes hold, stamped on each frame
+	unsigned int state_generation;
+
+	//Forgets the cache slots and state the nodes are thought to hold when a
+	//node asked for a keyframe, so the keyframe needs nothing it skipped
+	void forgetNodeState();
+
+	//Replaces the block encoded at start with a draw from the geometry cache,
+	//storing it first if the nodes don't have it. Returns where the draw starts
+	unsigned int cacheBlock(unsigned int start);
+
+	//Should copies of a packed run that only differ in their matrix be sent
+	//as one instanced draw
+	BOOL use_instancing;
+
+	//The run waiting for more copies. It is kept here while the next run is
+	//gathered in the packed buffers, and swapped back to be sent
+	GLenum instance_mode;
+	GLfloat *instance_vertices;
+	unsigned int instance_vertex_count;
+	unsigned int instance_vertex_capacity;
+	BOOL instance_colors;
+	unsigned short *instance_steps;
+	float instance_min[3];
+	float instance_max[3];
+
+	//The color the run ended with, set again after it if it has colors
+	GLfloat instance_color[3];
+
+	//Matrix of each copy waiting to be drawn
+	GLMatrix *instance_matrices;
+	unsigned int instance_count;
+	unsigned int instance_capacity;
+
+	//Copies drawn and instanced draws sent for them
+	unsigned int instances_sent;
+	unsigned int instanced_draws;
+
+	//Swaps the packed run with the one waiting for copies
+	void swapInstanceRun();
+
+	//Adds the packed run as a copy of the run waiting for copies, or sends
+	//those copies and has the packed run wait instead
+	void queueInstance();
+
+	//Sends the copies waiting to be drawn
+	void flushInstances();
+
+	//Should nodes swap together once every node has drawn the frame
+	BOOL swap_barrier;
+
+	//Number of the last frame ended with sendSync
+	volatile long barrier_frame;
+
+	//Set after a frame is ended until its swap is released
+	BOOL barrier_pending;
+
+	//Nodes that reported the barrier frame ready
+	volatile long barrier_ready;
+
+	//Signalled when the last node reports the barrier frame ready
+	GLEvent *barrier_event;
+
+	//When the barrier frame was ended and when the last node was ready
+	unsigned long long barrier_start;
+	volatile unsigned long long barrier_done;
+
+	//Microseconds from ending the last frame to every node being ready, and
+	//how long releasing it held up the next frame
+	unsigned int last_barrier_latency;
+	unsigned int last_barrier_wait;
+
+	//Totals over every barrier, for the average
+	unsigned long long barrier_latency_total;
+	unsigned long long barrier_wait_total;
+	unsigned int barrier_count;
+
+	//Waits for every node to draw the last frame and tells them to swap
+	void releaseBarrier();
+
+	//Sends a frame to every node, or to the capture frame
+	void queueFrame(GLFrame *sent);
+
+	//Microseconds after a frame is ended that nodes present it at, 0 to
+	//present as soon as it arrives
+	unsigned int present_delay;
+
+	//Number of the last frame ended with PresentAt
+	unsigned int present_frame;
+
+	//Number of clock probes sent and when each recent one was sent
+	unsigned int clock_probes;
+	unsigned long long probe_times[CLOCK_PROBE_TIMES];
+
+	//Present times reported for recent frames
+	PresentRecord present_records[PRESENT_WINDOW];
+
+	//Microseconds between the first and last node presenting the last whole
+	//frame, the worst and the total for the average
+	unsigned int last_skew;
+	unsigned int worst_skew;
+	unsigned long long skew_total;
+	unsigned int skew_frames;
+
+	//Total microseconds the last node presented after the target
+	long long lateness_total;
+
+	//Probes the nodes' clocks and sends them the offsets found so far
+	void sendClock();
+
+	//Records when a node presented a frame
+	void presentReceived(int node, unsigned int frame, unsigned long long presented);
+
+	//Most frames sent that the slowest node hasn't finished, 0 for no limit
+	unsigned int max_frames_in_flight;
+
+	//Frames sent, and frames each node has finished
+	unsigned int frames_sent;
+	volatile long *frames_done;
+
+	//Signalled when the slowest node finishes a frame
+	GLEvent *done_event;
+
+	//When each recent frame was sent and when the last sendSync returned
+	unsigned long long sent_times[PACING_WINDOW];
+
+	//Guards frames_sent and sent_times, read by the backchannel thread
+	GLLock *sent_lock;
+	unsigned long long last_sync;
+
+	//Latency of the slowest node's last finished frame
+	volatile long done_latency;
+
+	//Totals over every frame for the averages
+	unsigned long long pacing_wait_total;
+	unsigned long long pacing_latency_total;
+
+	//Returns the number of frames every node has finished
+	unsigned int slowestFramesDone();
+
+	//Records that a node finished frames
+	void frameDone(int node, unsigned int done);
+
+	//Should pipes drop whole frames for nodes that fall behind, keeping only
+	//the commands that change state, instead of holding up the other nodes
+	BOOL drop_frames;
+
+	//Offset and opcode of the last command pushed while its extent isn't
+	//known yet, command_id is -1 when there is none
+	unsigned int command_start;
+	int command_id;
+
+	//Marks the last command pushed in the frame if it only draws or ends a
+	//frame, so pipes know what they can drop
+	void closeCommand();
+
+	//Returns the number of frames finished by the nodes that pace the host,
+	//every node, or only the fastest when slow nodes drop frames instead
+	unsigned int pacingFramesDone();
+
+	//Prints how far the compact run is from the packed one
+	void reportCompactError(unsigned int flags, GLfloat *min, GLfloat *scale, unsigned int size);
+
 public:
 	RGLInterface(char *configFile);
 	~RGLInterface();
@@ -45,11 +468,18 @@ public:
 	//Called to set up a connection to the nodes
 	int initialize(char *address);
 
+	//Sets up the interface without nodes, sent commands are appended to a
+	//capture frame. Used to measure how commands are encoded
+	void initializeCapture(unsigned int revision, GLFrame *i_capture);
+
 	//Called to close connections to nodes and clean up
 	void cleanUp();
 
+	//Reads messages from the nodes until clean up, runs on its own thread
+	void backchannelMain();
+
 	//Pushes a command to the buffer
-	void pushCommand(int id);
+	void pushCommand(GLOpcode id);
 
 	//Pushes a GLFloat value to the buffer
 	void pushGLfloat(GLfloat value);
@@ -57,14 +487,48 @@ public:
 	//Pushes a GLBitfield value to the buffer
 	void pushGLbitfield(GLbitfield value);
 
-	//Pushes a GLenum value to the buffer
-	void pushGLenum(GLenum value);
+	//Pushes a GLuint or GLenum value to the buffer
+	void pushGLuint(GLuint value);
+
+	//Pushes a command and its fixed arguments, push_<name> for each command
+	//in GL_COMMANDS. Variable data and endCommand are left to the caller
+#define GL_COMMAND_PUSH_DECLARATION(opcode, name, masks, integers, floats, flags, handler, role, state, joinable) \
+	void push_##name(GL_SHAPE(GL_PARAMETERS, masks, integers, floats));
+	GL_COMMANDS(GL_COMMAND_PUSH_DECLARATION)
 
 	//Sends data in the buffer over all pipes
 	void sendCommand();
 
-	//Sends a syncronization packet telling the nodes to swap buffers
-	void sendSync();
+	//Sends all queued commands to the nodes
+	void flush();
+
+	//Sends a syncronization packet telling the nodes to swap buffers, waits
+	//first if too many frames are in flight. Returns how frames are paced
+	FramePacing sendSync();
+
+	//Returns the number of flushes it took to send the last frame
+	unsigned int getFrameFlushes();
+
+	//Returns the number of bytes it took to send the last frame
+	unsigned int getFrameBytes();
+
+	//Returns the microseconds from ending the last released frame until every
+	//node had drawn it
+	unsigned int getBarrierLatency();
+
+	//Returns the microseconds the next frame was held up releasing the last
+	//barrier
+	unsigned int getBarrierWait();
+
+	//Returns the microseconds between the first and last node presenting the
+	//last frame every node reported
+	unsigned int getPresentSkew();
+
+	//Returns how well the geometry cache is doing, all zero without it
+	CacheStats getCacheStats();
+
+	//Prints out statistics about how frames are being sent
+	void printStats();
 
 	//----------------
 	//OpenGL functions
@@ -79,4 +543,5 @@ public:
 	void glColor3f(GLfloat red, GLfloat green, GLfloat blue);
 	void glRotatef(GLfloat angle, GLfloat x, GLfloat y, GLfloat z);
 	void glScalef(GLfloat x, GLfloat y, GLfloat z);
+	void glLoadMatrixf(const GLfloat *m);
 };
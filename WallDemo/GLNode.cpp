@@ -14,6 +14,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <emmintrin.h>
 
 //Array used to keep track of keyboard input
 bool	keys[256];
@@ -21,21 +22,104 @@ bool	keys[256];
 //Window active flag
 bool	active=TRUE;
 
-//OpenGL function handlers
+//OpenGL function handlers, indexed by opcode
 typedef void (GLNode::*GLFHandler)();
-GLFHandler handlers[] = {NULL,
-	&GLNode::_glClearColor,
-	&GLNode::_glClear,
-	&GLNode::_glLoadIdentity,
-	&GLNode::_glTranslatef,
-	&GLNode::_glBegin,
-	&GLNode::_glEnd,
-	&GLNode::_glVertex3f,
-	&GLNode::_glColor3f,
-	&GLNode::_glRotatef,
-	&GLNode::_glScalef
+#define GL_COMMAND_HANDLER(opcode, name, masks, integers, floats, flags, handler, role, state, joinable) &GLNode::_##name,
+static const GLFHandler handlers[OPCODE_COUNT] = {
+	GL_COMMANDS(GL_COMMAND_HANDLER)
 };
 
+//Decodes planes of 16 bit positions into x, y, z, w floats, 4 at a time
+static void decodePositions(GLfloat *out, const unsigned short *planes, unsigned int count, const GLfloat *min, const GLfloat *scale)
+{
+	const unsigned short *xs = planes;
+	const unsigned short *ys = planes + count;
+	const unsigned short *zs = planes + 2 * count;
+	__m128 min_x = _mm_set1_ps(min[0]), min_y = _mm_set1_ps(min[1]), min_z = _mm_set1_ps(min[2]);
+	__m128 scale_x = _mm_set1_ps(scale[0]), scale_y = _mm_set1_ps(scale[1]), scale_z = _mm_set1_ps(scale[2]);
+	__m128i zero = _mm_setzero_si128();
+	unsigned int i = 0;
+
+	for(; i + 4 <= count; i += 4) {
+		__m128 x = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)&xs[i]), zero));
+		__m128 y = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)&ys[i]), zero));
+		__m128 z = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)&zs[i]), zero));
+		__m128 w = _mm_setzero_ps();
+
+		x = _mm_add_ps(_mm_mul_ps(x, scale_x), min_x);
+		y = _mm_add_ps(_mm_mul_ps(y, scale_y), min_y);
+		z = _mm_add_ps(_mm_mul_ps(z, scale_z), min_z);
+
+		//Turn the planes into one vertex per register
+		_MM_TRANSPOSE4_PS(x, y, z, w);
+		_mm_storeu_ps(&out[i * 4], x);
+		_mm_storeu_ps(&out[i * 4 + 4], y);
+		_mm_storeu_ps(&out[i * 4 + 8], z);
+		_mm_storeu_ps(&out[i * 4 + 12], w);
+	}
+
+	for(; i < count; i++) {
+		out[i * 4] = min[0] + xs[i] * scale[0];
+		out[i * 4 + 1] = min[1] + ys[i] * scale[1];
+		out[i * 4 + 2] = min[2] + zs[i] * scale[2];
+		out[i * 4 + 3] = 0.0f;
+	}
+}
+
+//Reads a zigzag varint delta without going past end, returns false if it
+//doesn't fit
+static bool readDelta(const char **in, const char *end, int *delta)
+{
+	unsigned int value = 0;
+	unsigned int shift = 0;
+	unsigned char byte;
+
+	do {
+		if(*in >= end || shift >= 7 * VARINT_MAX_SIZE)
+			return false;
+		byte = (unsigned char)*(*in)++;
+		value |= (unsigned int)(byte & 0x7F) << shift;
+		shift += 7;
+	} while(byte & 0x80);
+
+	*delta = decodeZigzag(value);
+	return true;
+}
+
+//Decodes a first 16 bit position and planes of varint deltas, length bytes of
+//them, into x, y, z, w floats. The deltas are unpacked into the output as
+//integers first, then summed and scaled a vertex at a time. Returns false if
+//the planes don't take exactly length bytes
+static bool decodeDeltas(GLfloat *out, const unsigned short *first, const char *planes, unsigned int length, unsigned int count, const GLfloat *min, const GLfloat *scale)
+{
+	const char *end = planes + length;
+	int delta;
+
+	for(int axis = 0; axis < 3; axis++) {
+		for(unsigned int i = 1; i < count; i++) {
+			if(!readDelta(&planes, end, &delta))
+				return false;
+			memcpy(&out[i * 4 + axis], &delta, sizeof(int));
+		}
+	}
+	if(planes != end)
+		return false;
+
+	__m128 min_xyz = _mm_setr_ps(min[0], min[1], min[2], 0.0f);
+	__m128 scale_xyz = _mm_setr_ps(scale[0], scale[1], scale[2], 0.0f);
+	__m128i run = _mm_setr_epi32(first[0], first[1], first[2], 0);
+	__m128i xyz = _mm_setr_epi32(-1, -1, -1, 0);
+
+	_mm_storeu_ps(out, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(run), scale_xyz), min_xyz));
+	for(unsigned int i = 1; i < count; i++) {
+		//w was never written, so it is masked off the deltas
+		run = _mm_add_epi32(run, _mm_and_si128(_mm_loadu_si128((const __m128i*)&out[i * 4]), xyz));
+		_mm_storeu_ps(&out[i * 4], _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(run), scale_xyz), min_xyz));
+	}
+
+	return true;
+}
+
 //Constructor for the GLNode
 GLNode::GLNode(char *i_configFile, char *i_nodeIndentifier)
 {
@@ -53,6 +137,89 @@ GLNode::GLNode(char *i_configFile, char *i_nodeIndentifier)
 	buffer = new char[BUFFER_SIZE];
 	buffer_pointer = 0;
 
+	receive_buffer = new char[RECEIVE_BUFFER_SIZE];
+	receive_capacity = RECEIVE_BUFFER_SIZE;
+	receive_start = 0;
+	receive_end = 0;
+	framed = FALSE;
+	receive_thread = 0;
+	receiver = NULL;
+	receiving = 0;
+	ready_event = NULL;
+	space_event = NULL;
+	queued_frame = NULL;
+	multicast_taken = FALSE;
+
+	spin_budget = DEFAULT_SPIN_BUDGET;
+	command_budget = DEFAULT_COMMAND_BUDGET;
+	network_event = WSA_INVALID_EVENT;
+	shared_ring = NULL;
+	posted_receives = 0;
+	tcp_no_delay = 1;
+	send_buffer_size = 0;
+	receive_buffer_size = 0;
+	posted = NULL;
+	next_posted = 0;
+	sync_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+	QueryPerformanceFrequency(&counter_frequency);
+	loop_start.QuadPart = 0;
+	spin_ticks = 0;
+	block_ticks = 0;
+	wakeups = 0;
+	wake_ticks = 0;
+	wake_max_ticks = 0;
+	wake_pending = FALSE;
+	wake_time.QuadPart = 0;
+	barrier_time = 0;
+	barrier_swaps = 0;
+	barrier_wait_total = 0;
+	send_lock = new GLLock();
+	node_index = 0;
+	clock_offset = 0;
+	clock_valid = FALSE;
+	present_pending = FALSE;
+	present_frame = 0;
+	frames_skipped = 0;
+	frame_data = NULL;
+	frame_length = 0;
+	frame_received = 0;
+	delta = NULL;
+	delta_skipped = 0;
+	args = buffer;
+	protocol_revision = PROTOCOL_REVISION_1;
+
+	vertex_data = NULL;
+	vertex_capacity = 0;
+	compact_data = NULL;
+	compact_capacity = 0;
+
+	cache_blocks = NULL;
+	cache_capacity = 0;
+	use_buffers = FALSE;
+	cache_stores = 0;
+	cache_draws = 0;
+	cache_replaced = 0;
+	cache_bytes = 0;
+
+	instance_data = NULL;
+	instance_capacity = 0;
+	instanced_draws = 0;
+	instances_drawn = 0;
+
+	multicast = 0;
+	strcpy(multicast_group, "239.255.13.37");
+	multicast_port = 13400;
+	strcpy(multicast_interface, "0.0.0.0");
+	multicast_sock = INVALID_SOCKET;
+	multicast_frames = NULL;
+	next_frame = 0;
+	highest_frame = 0;
+	frame_active = FALSE;
+	frame_pointer = 0;
+	datagrams_received = 0;
+	nacks_sent = 0;
+	frames_received = 0;
+
 	//Read configuration from file into members
 	readConfiguration();
 }
@@ -61,6 +228,37 @@ GLNode::GLNode(char *i_configFile, char *i_nodeIndentifier)
 GLNode::~GLNode()
 {
 	delete buffer;
+	delete[] receive_buffer;
+	CloseHandle(sync_event);
+	delete send_lock;
+
+	if(vertex_data)
+		delete[] vertex_data;
+
+	if(compact_data)
+		delete[] compact_data;
+
+	if(instance_data)
+		delete[] instance_data;
+
+	delete delta;
+
+	//Buffer objects go with the rendering context
+	if(cache_blocks) {
+		for(int i = 0; i < cache_capacity; i++) {
+			if(cache_blocks[i].data)
+				delete[] cache_blocks[i].data;
+		}
+		delete[] cache_blocks;
+	}
+
+	if(multicast_frames) {
+		for(int i = 0; i < MULTICAST_WINDOW; i++) {
+			delete[] multicast_frames[i].data;
+			delete[] multicast_frames[i].have;
+		}
+		delete[] multicast_frames;
+	}
 }
 
 //Reads data from the configuration file into this node's properties
@@ -94,6 +292,39 @@ void GLNode::readConfiguration()
 			} else if(!strcmp(tag, "multiGPU")) {
 				number = strtok(NULL, " :");
 				sscanf(number, "%d", &multiGPU);
+			} else if(!strcmp(tag, "multicast")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &multicast);
+			} else if(!strcmp(tag, "multicastGroup")) {
+				number = strtok(NULL, " :\r\n");
+				sscanf(number, "%31s", multicast_group);
+			} else if(!strcmp(tag, "multicastPort")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &multicast_port);
+			} else if(!strcmp(tag, "multicastInterface")) {
+				number = strtok(NULL, " :\r\n");
+				sscanf(number, "%31s", multicast_interface);
+			} else if(!strcmp(tag, "receiveThread")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &receive_thread);
+			} else if(!strcmp(tag, "postedReceives")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &posted_receives);
+			} else if(!strcmp(tag, "tcpNoDelay")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &tcp_no_delay);
+			} else if(!strcmp(tag, "sendBuffer")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &send_buffer_size);
+			} else if(!strcmp(tag, "receiveBuffer")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &receive_buffer_size);
+			} else if(!strcmp(tag, "spinBudget")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &spin_budget);
+			} else if(!strcmp(tag, "commandBudget")) {
+				number = strtok(NULL, " :");
+				sscanf(number, "%d", &command_budget);
 			} else if(!strcmp(tag, nodeIdentifier)) {
 				//Read this node's properties
 				while(!feof(fp)) {
@@ -158,200 +389,1202 @@ void GLNode::printStatus()
 	printf("\tFullscreen: %d\n", fullscreen);
 	printf("\tUse graphics device: %d\n", device_id);
 	printf("\tListen on port: %d\n", port);
+	if(multicast)
+		printf("\tMulticast group: %s:%d on %s\n", multicast_group, multicast_port, multicast_interface);
+	printf("\tReceive thread: %d\n", receive_thread);
+	printf("\tPosted receives: %d\n", posted_receives);
+	printf("\tNo delay: %d, send buffer: %d, receive buffer: %d\n", tcp_no_delay, send_buffer_size, receive_buffer_size);
+	printf("\tSpin budget: %dus, command budget: %dus\n", spin_budget, command_budget);
 }
 
 //Sets up socket to listen and waits for connections
 void GLNode::startListening()
 {
-	//Start winsock
-	WSADATA wsaData;
-	int starterr = WSAStartup(MAKEWORD(2,2), &wsaData);
+	SocketOptions options;
 
-	//Error checking
-	if(starterr != 0) {
-		printf("Error %d occurred!\n",  WSAGetLastError());
-		WSACleanup();
+	//Start the socket library
+	if(!socketStartup())
+		return;
+
+	//Listen on the port from the config file
+	SOCKET server_sock = socketListen(port);
+	if(server_sock == INVALID_SOCKET) {
+		socketCleanup();
+		return;
+	}
+
+	//Accept a connection
+	node_sock = socketAccept(server_sock);
+	if(node_sock == INVALID_SOCKET) {
+		socketClose(server_sock);
+		socketCleanup();
+		return;
+	}
+
+	//Backchannel messages are tiny and the host waits on them, so send them
+	//right away. The loop never blocks on the socket, it waits on it instead
+	options.no_delay = tcp_no_delay != 0;
+	options.non_blocking = true;
+	options.send_buffer = send_buffer_size > 0 ? send_buffer_size : SOCKET_BUFFER_DEFAULT;
+	options.receive_buffer = receive_buffer_size > 0 ? receive_buffer_size : SOCKET_BUFFER_DEFAULT;
+	socketSetOptions(node_sock, &options);
+
+	//Start connection handling code
+	acceptConnection();
+
+	//Clean up and exit
+	printf("Cleaning up and exiting from listen code\n");
+	if(multicast_sock != INVALID_SOCKET) {
+		printf("Multicast: %u datagrams received, %u NACKs sent\n", datagrams_received, nacks_sent);
+		socketClose(multicast_sock);
+	}
+	socketClose(node_sock);
+	socketClose(server_sock);
+
+	socketCleanup();
+	return;
+}
+
+//Accepts a connection by setting up a window and starting the main loop
+void GLNode::acceptConnection()
+{
+	char *buffer = new char[HANDSHAKE_SIZE];
+	int length = 0;
+
+	//Receive node name from host to make sure connection is valid
+	if((length = socketReceive(node_sock, buffer, HANDSHAKE_SIZE, WAIT_FOREVER)) != HANDSHAKE_SIZE) {
+		if(length == 0)
+			printf("Connection was terminated unexpectedly\n");
+		else
+			printf("Error %d occurred!\n",  socketError());
+		return;
+	}
+
+	if(strcmp(buffer, nodeIdentifier) != 0) {
+		printf("Incorrect node identifier sent by the host. Terminating connection.\n");
+		return;
+	}
+
+	//Accept the features the host asked for that this node knows about and
+	//the newest revision both understand
+	HandshakeFeatures offer;
+	BackchannelMessage reply;
+	memcpy(&offer, &buffer[HANDSHAKE_FEATURES_OFFSET], sizeof(offer));
+	memset(&reply, 0, sizeof(reply));
+	reply.type = BACKCHANNEL_FEATURES;
+	if(offer.magic == HANDSHAKE_MAGIC) {
+		reply.args[0] = offer.features & NODE_FEATURES;
+		if(offer.revision > PROTOCOL_REVISION)
+			protocol_revision = PROTOCOL_REVISION;
+		else if(offer.revision > PROTOCOL_REVISION_1)
+			protocol_revision = offer.revision;
+		node_index = offer.node;
+	}
+
+	//The host made a ring for the stream if it is on this machine
+	if(reply.args[0] & FEATURE_SHARED_MEMORY) {
+		char name[64];
+		sprintf(name, SHARED_RING_NAME, port, offer.ring);
+		shared_ring = new GLSharedRing();
+		if(shared_ring->open(name)) {
+			printf("Receiving through shared memory\n");
+		} else {
+			delete shared_ring;
+			shared_ring = NULL;
+			reply.args[0] &= ~FEATURE_SHARED_MEMORY;
+		}
+	}
+	//Delta frames are expanded one length prefixed chunk at a time, and the
+	//multicast stream is shared by every node
+	if(multicast || !(reply.args[0] & FEATURE_LENGTH_PREFIX))
+		reply.args[0] &= ~FEATURE_DELTA_FRAMES;
+	reply.args[1] = protocol_revision;
+	if(sendMessage(&reply) < 0) {
+		printf("Could not answer the handshake. Terminating connection.\n");
 		return;
 	}
+
+	//Multicast always delivers whole frames
+	framed = multicast || (reply.args[0] & FEATURE_LENGTH_PREFIX);
+	if(reply.args[0] & FEATURE_DELTA_FRAMES)
+		delta = new GLDeltaDecoder();
+
+	//Commands arrive through the multicast group instead of the socket
+	if(multicast && openMulticast() < 0) {
+		printf("Could not join the multicast group. Terminating connection.\n");
+		return;
+	}
+
+	//Keep receives posted on the socket so the stream arrives without a call
+	//per read
+	if(posted_receives && !multicast && !shared_ring)
+		startPostedReceives();
+
+	//Frames can only be received ahead when they arrive whole
+	if(receive_thread) {
+		if(framed)
+			startReceiver();
+		else
+			printf("Receive thread needs length prefixed frames, receiving on the render thread\n");
+	}
+
+	//Without a receive thread the loop waits on the socket itself, this makes
+	//the socket non-blocking. The ring and posted receives have handles of
+	//their own
+	if(!receiver && !shared_ring && !posted) {
+		network_event = WSACreateEvent();
+		if(WSAEventSelect(multicast ? multicast_sock : node_sock, network_event, FD_READ | FD_CLOSE) == SOCKET_ERROR) {
+			printf("Error %d occurred!\n",  WSAGetLastError());
+			WSACloseEvent(network_event);
+			network_event = WSA_INVALID_EVENT;
+		}
+	}
+
+	//Create the OpenGL window
+	if(createWindow(nodeIdentifier, win_width, win_height, 24)) {
+		//Start looping and waiting for OpenGL commands from the host
+		mainLoop();
+	}
+
+	stopReceiver();
+	printLoopStats();
+
+	if(network_event != WSA_INVALID_EVENT) {
+		WSAEventSelect(multicast ? multicast_sock : node_sock, NULL, 0);
+		WSACloseEvent(network_event);
+		network_event = WSA_INVALID_EVENT;
+	}
+
+	if(shared_ring) {
+		delete shared_ring;
+		shared_ring = NULL;
+	}
+
+	stopPostedReceives();
+
+	if(delta) {
+		delete delta;
+		delta = NULL;
+	}
+
+	//Kill the window
+	KillGLWindow();
+
+	delete buffer;
+
+	return;
+}
+
+//Handles messages and relays commands from the host
+void GLNode::mainLoop()
+{
+	MSG msg;
+
+	//False while main loop still running
+	done = FALSE;
+	QueryPerformanceCounter(&loop_start);
 	
-	//Create the socket
-	SOCKET server_sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-	if(server_sock == INVALID_SOCKET) {
+	while(!done) {
+		//Check if a message is ready
+		if(PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
+			if(msg.message == WM_QUIT) {
+				done = TRUE;
+			} else {
+				TranslateMessage(&msg);
+				DispatchMessage(&msg);
+			}
+		} else {
+			if(keys[VK_ESCAPE])
+				done=TRUE;
+			
+			if(sync) {
+				sync = FALSE;
+
+				//If associated context is used, blit to the visible context
+				if(associated_hRC) {
+					glBindFramebuffer(GL_DRAW_FRAMEBUFFER, nRemoteDataFBO);
+
+					//Release semaphore and wait for blit to finish
+					ReleaseSemaphore(hSemaphore, 1, NULL);
+
+					WaitForSingleObject(hSemaphore2, INFINITE);
+
+					//Break binding to render to screen
+					glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+					//Render buffer to screen using a fullscreen quad
+					glMatrixMode(GL_PROJECTION);
+					glLoadIdentity();
+					glMatrixMode(GL_MODELVIEW);
+					glLoadIdentity();
+					glBindTexture(GL_TEXTURE_2D, textureId);
+					glBegin(GL_QUADS);
+					glTexCoord2f(0.0f, 0.0f);
+					glVertex3f(-1.0f,-1.0f, -1.0f);
+					glTexCoord2f(1.0f, 0.0f);
+					glVertex3f( 1.0f,-1.0f, -1.0f);
+					glTexCoord2f(1.0f, 1.0f);
+					glVertex3f( 1.0f, 1.0f, -1.0f);
+					glTexCoord2f(0.0f, 1.0f);
+					glVertex3f(-1.0f, 1.0f, -1.0f);
+					glEnd();
+					glBindTexture(GL_TEXTURE_2D, 0);
+				}
+
+				SwapBuffers(hDC);
+
+				if(present_pending)
+					reportPresent();
+
+				//Let the host send another frame
+				BackchannelMessage done_message;
+				memset(&done_message, 0, sizeof(done_message));
+				done_message.type = BACKCHANNEL_FRAME_DONE;
+				done_message.args[0] = frames_received;
+				sendMessage(&done_message);
+			}
+		}
+
+		//Run the commands waiting from the host, go to sleep if there were none
+		if(!associated_hRC) {
+			if(runCommands(&sync) == 0 && !sync)
+				waitForCommands(TRUE);
+		} else if(!sync) {
+			//The offscreen thread runs the commands, wait for its frame
+			MsgWaitForMultipleObjectsEx(1, &sync_event, NODE_WAIT_TIMEOUT, QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+		}
+	}
+}
+
+//Runs commands until none are ready, stop is set or the command budget is
+//used, returns how many ran
+unsigned int GLNode::runCommands(BOOL *stop)
+{
+	LARGE_INTEGER start, now;
+	LONGLONG budget = counter_frequency.QuadPart * command_budget / 1000000;
+	unsigned int count = 0;
+
+	QueryPerformanceCounter(&start);
+	while(!done && !*stop && commandReady()) {
+		//Time from waking up to running what woke us
+		if(wake_pending) {
+			LONGLONG latency = start.QuadPart - wake_time.QuadPart;
+			wake_ticks += latency;
+			if(latency > wake_max_ticks)
+				wake_max_ticks = latency;
+			wakeups++;
+			wake_pending = FALSE;
+		}
+
+		if(framed)
+			runFrame();
+		else if(receiveCommand() < 0)
+			break;
+		count++;
+
+		//Give the window a turn once the budget is used
+		QueryPerformanceCounter(&now);
+		if(now.QuadPart - start.QuadPart >= budget)
+			break;
+	}
+
+	return count;
+}
+
+//Returns the handle that is signalled when commands may be ready
+HANDLE GLNode::commandHandle()
+{
+	if(receiver)
+		return (HANDLE)ready_event->getHandle();
+	if(shared_ring)
+		return (HANDLE)shared_ring->getDataHandle();
+	if(posted)
+		return (HANDLE)posted[next_posted].overlapped.hEvent;
+	return (HANDLE)network_event;
+}
+
+//Spins for the spin budget, then blocks until commands may be ready or,
+//with messages, a window message arrives
+void GLNode::waitForCommands(BOOL messages)
+{
+	LARGE_INTEGER start, now;
+	LONGLONG budget = counter_frequency.QuadPart * spin_budget / 1000000;
+	HANDLE handle = commandHandle();
+	DWORD timeout = multicast ? MULTICAST_NACK_INTERVAL : NODE_WAIT_TIMEOUT;
+	DWORD result;
+
+	//Commands often follow closely, spinning briefly saves a wakeup
+	QueryPerformanceCounter(&start);
+	now = start;
+	while(now.QuadPart - start.QuadPart < budget) {
+		if(commandReady() || (messages && GetQueueStatus(QS_ALLINPUT))) {
+			QueryPerformanceCounter(&now);
+			spin_ticks += now.QuadPart - start.QuadPart;
+			return;
+		}
+		QueryPerformanceCounter(&now);
+	}
+	spin_ticks += now.QuadPart - start.QuadPart;
+
+	//Without a handle to wait on fall back to waiting in select
+	if(handle == WSA_INVALID_EVENT) {
+		socketReadable(1);
+		return;
+	}
+
+	//Reset the event before the last check so nothing arriving after it is
+	//missed, Winsock sets it again for data that arrives later. The ring's
+	//writer only signals it once asked to
+	if(shared_ring && !receiver)
+		shared_ring->prepareWait();
+	else if(!receiver && !posted)
+		WSAResetEvent(network_event);
+	if(commandReady())
+		return;
+
+	start = now;
+	if(messages)
+		result = MsgWaitForMultipleObjectsEx(1, &handle, timeout, QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+	else
+		result = WaitForSingleObject(handle, timeout);
+	QueryPerformanceCounter(&now);
+	block_ticks += now.QuadPart - start.QuadPart;
+
+	if(result == WAIT_OBJECT_0) {
+		wake_pending = TRUE;
+		wake_time = now;
+	}
+
+	//Missing multicast fragments are asked for again even while idle
+	if(multicast && !receiver)
+		pumpMulticast(0);
+}
+
+//Prints how long the loop was idle and how quickly it woke up
+void GLNode::printLoopStats()
+{
+	LARGE_INTEGER now;
+	double frequency = (double)counter_frequency.QuadPart;
+
+	if(loop_start.QuadPart == 0)
+		return;
+
+	QueryPerformanceCounter(&now);
+	double total = (double)(now.QuadPart - loop_start.QuadPart);
+	if(total <= 0.0)
+		return;
+
+	printf("Loop: %.1f%% blocked, %.1f%% spinning", 100.0 * block_ticks / total, 100.0 * spin_ticks / total);
+	if(wakeups > 0)
+		printf(", %u wakeups, %.1fus average and %.1fus worst wake to execute", wakeups,
+			1000000.0 * wake_ticks / wakeups / frequency, 1000000.0 * wake_max_ticks / frequency);
+	if(barrier_swaps > 0)
+		printf(", %.1fus average wait at the swap barrier", (double)barrier_wait_total / barrier_swaps);
+	if(frames_skipped > 0)
+		printf(", %u frames skipped", frames_skipped);
+	if(delta_skipped > 0)
+		printf(", %u delta frames skipped", delta_skipped);
+	if(cache_stores > 0)
+		printf(", %u blocks cached (%u replaced, %u bytes held), %u cached draws", cache_stores, cache_replaced, cache_bytes, cache_draws);
+	if(instanced_draws > 0)
+		printf(", %u instanced draws of %u copies", instanced_draws, instances_drawn);
+	printf("\n");
+}
+
+//Receives an OpenGL command and runs it
+int GLNode::receiveCommand()
+{
+	int id = readOpcode();
+	if(id < 0)
+		return -1;
+
+	//Call the correct handler
+	(this->*handlers[id])();
+
+	return 0;
+}
+
+//Reads the ID of the next command, returns -1 if it can't be read or is
+//unknown
+int GLNode::readOpcode()
+{
+	int id;
+	
+	//Grab the command ID
+	if(protocol_revision >= PROTOCOL_REVISION_2) {
+		unsigned char small_id;
+		if(readStream((char*)(&small_id), 1) < 0)
+			return -1;
+		id = small_id;
+	} else if(readStream((char*)(&id), sizeof(int)) < 0) {
+		return -1;
+	}
+
+	//A command this node doesn't know means the stream can't be followed
+	if((unsigned int)id >= OPCODE_COUNT) {
+		printf("Unknown command %d from the host\n", id);
+		return -1;
+	}
+
+	return id;
+}
+
+//Returns TRUE if a command from the host is ready to be received
+BOOL GLNode::commandReady()
+{
+	if(framed) {
+		if(frame_active || nextFrame())
+			return TRUE;
+
+		//The receive thread does the reading
+		if(receiver)
+			return FALSE;
+
+		//Read whatever has arrived and check again, one readiness event is
+		//usually enough for a whole frame
+		if(multicast) {
+			pumpMulticast(0);
+		} else {
+			if(!socketReadable(0))
+				return FALSE;
+			if(receiveData() < 0)
+				return FALSE;
+		}
+
+		return nextFrame();
+	}
+
+	//Commands may already be waiting in the receive buffer
+	if(receive_start < receive_end)
+		return TRUE;
+
+	return socketReadable(0);
+}
+
+//Returns TRUE if data from the host can be read without blocking, waiting up
+//to timeout milliseconds for it
+BOOL GLNode::socketReadable(unsigned int wait)
+{
+	if(shared_ring)
+		return shared_ring->waitReadable(wait);
+	if(posted)
+		return postedReady(wait);
+
+	return socketWait(node_sock, false, wait);
+}
+
+//Reads what the socket has into the receive buffer
+int GLNode::receiveData()
+{
+	unsigned int needed = 0;
+	int recv_length;
+
+	//Move unread data to the front so frames stay in one piece
+	if(receive_start > 0) {
+		memmove(receive_buffer, &receive_buffer[receive_start], receive_end - receive_start);
+		receive_end -= receive_start;
+		receive_start = 0;
+	}
+
+	//Grow the buffer for frames larger than it
+	if(framed && receive_end >= sizeof(unsigned int)) {
+		memcpy(&needed, receive_buffer, sizeof(unsigned int));
+		needed += sizeof(unsigned int);
+	}
+	if(needed > receive_capacity) {
+		char *grown = new char[needed];
+		memcpy(grown, receive_buffer, receive_end);
+		delete[] receive_buffer;
+		receive_buffer = grown;
+		receive_capacity = needed;
+	}
+
+	if((recv_length = receiveSocket(&receive_buffer[receive_end], receive_capacity - receive_end)) < 0)
+		return -1;
+
+	receive_end += recv_length;
+	return 0;
+}
+
+//Receives from the socket, waiting for data if it is non-blocking
+int GLNode::receiveSocket(char *data, unsigned int length)
+{
+	int recv_length;
+
+	//The ring returns nothing until data arrives and -1 once the host closes it
+	if(shared_ring) {
+		while((recv_length = shared_ring->read(data, length)) == 0) {
+			if(done)
+				return -1;
+			shared_ring->waitReadable(NODE_WAIT_TIMEOUT);
+		}
+
+		if(recv_length < 0)
+			printf("Connection was terminated unexpectedly\n");
+		return recv_length;
+	}
+
+	//Posted receives are filled in the background, take from the oldest
+	if(posted) {
+		while(!postedReady(NODE_WAIT_TIMEOUT)) {
+			if(done)
+				return -1;
+		}
+		return takePosted(data, length);
+	}
+
+	while((recv_length = recv(node_sock, data, length, 0)) == SOCKET_ERROR && socketWouldBlock()) {
+		if(done)
+			return -1;
+		socketReadable(NODE_WAIT_TIMEOUT);
+	}
+
+	if(recv_length <= 0) {
+		if(recv_length == 0)
+			printf("Connection was terminated unexpectedly\n");
+		else
+			printf("Error %d occurred!\n",  socketError());
+		return -1;
+	}
+
+	return recv_length;
+}
+
+//Posts all the receives, falls back to recv if the socket won't take them
+void GLNode::startPostedReceives()
+{
+	posted = new PostedReceive[NODE_POSTED_RECEIVES];
+	for(int i = 0; i < NODE_POSTED_RECEIVES; i++) {
+		memset(&posted[i].overlapped, 0, sizeof(WSAOVERLAPPED));
+		posted[i].overlapped.hEvent = WSACreateEvent();
+		posted[i].data = new char[NODE_POSTED_SIZE];
+		posted[i].complete = TRUE;
+	}
+	next_posted = 0;
+
+	for(int i = 0; i < NODE_POSTED_RECEIVES; i++) {
+		if(postReceive(&posted[i]) < 0) {
+			printf("Receiving with recv instead of posted receives\n");
+			stopPostedReceives();
+			return;
+		}
+	}
+}
+
+//Cancels the posted receives and frees them
+void GLNode::stopPostedReceives()
+{
+	DWORD received, flags;
+
+	if(!posted)
+		return;
+
+	//The buffers can only go once the socket is done with them
+	CancelIo((HANDLE)node_sock);
+	for(int i = 0; i < NODE_POSTED_RECEIVES; i++) {
+		if(!posted[i].complete)
+			WSAGetOverlappedResult(node_sock, &posted[i].overlapped, &received, TRUE, &flags);
+		WSACloseEvent(posted[i].overlapped.hEvent);
+		delete[] posted[i].data;
+	}
+
+	delete[] posted;
+	posted = NULL;
+}
+
+//Posts a receive again once everything in it was taken
+int GLNode::postReceive(PostedReceive *receive)
+{
+	WSABUF buffer;
+	DWORD received, flags = 0;
+
+	buffer.buf = receive->data;
+	buffer.len = NODE_POSTED_SIZE;
+	receive->length = 0;
+	receive->offset = 0;
+	receive->complete = FALSE;
+	WSAResetEvent(receive->overlapped.hEvent);
+
+	//Finishing at once still signals the event, it is picked up like any other
+	if(WSARecv(node_sock, &buffer, 1, &received, &flags, &receive->overlapped, NULL) == SOCKET_ERROR &&
+		WSAGetLastError() != WSA_IO_PENDING) {
 		printf("Error %d occurred!\n",  WSAGetLastError());
-		WSACleanup();
+		receive->complete = TRUE;
+		return -1;
+	}
+
+	return 0;
+}
+
+//Returns TRUE if the oldest posted receive is complete, waiting up to wait
+//milliseconds for it
+BOOL GLNode::postedReady(unsigned int wait)
+{
+	PostedReceive *oldest = &posted[next_posted];
+	DWORD received, flags;
+
+	if(oldest->complete)
+		return TRUE;
+
+	if(WaitForSingleObject(oldest->overlapped.hEvent, wait) != WAIT_OBJECT_0)
+		return FALSE;
+
+	//A failed or closed connection completes with nothing in it
+	if(!WSAGetOverlappedResult(node_sock, &oldest->overlapped, &received, FALSE, &flags)) {
+		printf("Error %d occurred!\n",  WSAGetLastError());
+		received = 0;
+	}
+
+	oldest->length = received;
+	oldest->offset = 0;
+	oldest->complete = TRUE;
+	return TRUE;
+}
+
+//Takes bytes out of the oldest complete receive, returns how many or -1 once
+//the connection has closed
+int GLNode::takePosted(char *data, unsigned int length)
+{
+	PostedReceive *oldest = &posted[next_posted];
+
+	if(oldest->length == 0) {
+		printf("Connection was terminated unexpectedly\n");
+		return -1;
+	}
+
+	unsigned int chunk = oldest->length - oldest->offset;
+	if(chunk > length)
+		chunk = length;
+	memcpy(data, &oldest->data[oldest->offset], chunk);
+	oldest->offset += chunk;
+
+	//Hand the buffer back to the socket once it is used up
+	if(oldest->offset == oldest->length) {
+		if(postReceive(oldest) < 0)
+			oldest->complete = TRUE;
+		next_posted = (next_posted + 1) % NODE_POSTED_RECEIVES;
+	}
+
+	return (int)chunk;
+}
+
+//Finds the next whole frame that has arrived from the host
+BOOL GLNode::takeFrame(char **data, unsigned int *length)
+{
+	if(multicast)
+		return nextMulticastFrame(data, length);
+
+	//Frames on the socket start with their length
+	if(receive_end - receive_start < sizeof(unsigned int))
+		return FALSE;
+
+	memcpy(length, &receive_buffer[receive_start], sizeof(unsigned int));
+	if(receive_end - receive_start - sizeof(unsigned int) < *length)
+		return FALSE;
+
+	*data = &receive_buffer[receive_start + sizeof(unsigned int)];
+	return TRUE;
+}
+
+//Frees the space of a frame found by takeFrame
+void GLNode::releaseFrame(unsigned int length)
+{
+	if(multicast) {
+		//Free its slot for a later frame
+		MulticastFrame *current = &multicast_frames[next_frame % MULTICAST_WINDOW];
+		current->active = FALSE;
+		current->nack_time = 0;
+		multicast_taken = FALSE;
+		next_frame++;
+	} else {
+		receive_start += sizeof(unsigned int) + length;
+	}
+}
+
+//Makes the next whole frame from the host current if it has arrived
+BOOL GLNode::nextFrame()
+{
+	if(receiver) {
+		//Take the oldest frame the receive thread has queued
+		if(!ready_frames.pop(&queued_frame))
+			return FALSE;
+
+		frame_data = queued_frame->data;
+		frame_length = queued_frame->length;
+	} else if(!takeFrame(&frame_data, &frame_length)) {
+		return FALSE;
+	}
+
+	frame_received = frame_length;
+	frame_pointer = 0;
+	frame_active = TRUE;
+
+	if(delta)
+		expandFrame();
+	return TRUE;
+}
+
+//Turns the current frame from a delta chunk into its commands, skipping it if
+//it can't be expanded
+void GLNode::expandFrame()
+{
+	BOOL lost = delta->isLost();
+	BOOL frame_end = frame_length > 0 && (frame_data[0] & DELTA_FRAME_END);
+
+	if(delta->decode(frame_data, frame_length, &frame_data, &frame_length))
 		return;
+
+	//None of the chunk can run. The host is asked once for a keyframe, the
+	//chunks until it arrives are skipped as well
+	frame_length = 0;
+	delta_skipped++;
+
+	//The frame the chunk ended still counts, or the host's count of frames in
+	//flight would stay ahead of this node for good
+	if(frame_end)
+		countSkippedFrame();
+	if(!lost) {
+		BackchannelMessage request;
+
+		printf("Could not apply a delta frame, asking for a keyframe\n");
+		memset(&request, 0, sizeof(request));
+		request.type = BACKCHANNEL_KEYFRAME;
+		sendMessage(&request);
 	}
+}
+
+//Counts a frame that wasn't drawn as done so the host keeps pacing by this
+//node correctly
+void GLNode::countSkippedFrame()
+{
+	frames_received++;
+
+	BackchannelMessage done_message;
+	memset(&done_message, 0, sizeof(done_message));
+	done_message.type = BACKCHANNEL_FRAME_DONE;
+	done_message.args[0] = frames_received;
+	sendMessage(&done_message);
+}
+
+//Frees the current frame once all of its commands have run
+void GLNode::finishFrame()
+{
+	if(receiver) {
+		//Hand the buffer back to the receive thread
+		free_frames.push(queued_frame);
+		space_event->signal();
+	} else {
+		releaseFrame(frame_received);
+	}
+
+	frame_active = FALSE;
+}
+
+//Entry point for the receive thread
+static void ReceiverShell(void *param)
+{
+	((GLNode*)param)->receiverMain();
+}
+
+//Starts the thread that receives frames while the current one is rendered
+void GLNode::startReceiver()
+{
+	for(int i = 0; i < NODE_FRAME_QUEUE; i++) {
+		NodeFrame *queued = new NodeFrame;
+		queued->capacity = RECEIVE_BUFFER_SIZE;
+		queued->data = new char[queued->capacity];
+		queued->length = 0;
+		free_frames.push(queued);
+	}
+
+	ready_event = new GLEvent();
+	space_event = new GLEvent();
+	receiving = 1;
+	receiver = new GLThread(ReceiverShell, this);
+	if(!receiver->start()) {
+		printf("Could not start receive thread, receiving on the render thread\n");
+		delete receiver;
+		receiver = NULL;
+	}
+}
+
+//Stops the receive thread and frees its frames
+void GLNode::stopReceiver()
+{
+	NodeFrame *queued;
+
+	if(!receiver)
+		return;
+
+	atomicStore(&receiving, 0);
+	space_event->signal();
+	receiver->join();
+	delete receiver;
+	receiver = NULL;
+
+	if(frame_active)
+		free_frames.push(queued_frame);
+	frame_active = FALSE;
+
+	while(ready_frames.pop(&queued))
+		free_frames.push(queued);
+	while(free_frames.pop(&queued)) {
+		delete[] queued->data;
+		delete queued;
+	}
+
+	delete ready_event;
+	delete space_event;
+}
+
+//Receives whole frames and queues them for the render thread
+void GLNode::receiverMain()
+{
+	NodeFrame *queued = NULL;
+	char *data;
+	unsigned int length;
+
+	while(atomicLoad(&receiving)) {
+		//Wait for a frame to arrive, waking up regularly to check for shut down
+		if(!takeFrame(&data, &length)) {
+			if(multicast) {
+				pumpMulticast(MULTICAST_NACK_INTERVAL);
+			} else if(socketReadable(MULTICAST_NACK_INTERVAL) && receiveData() < 0) {
+				//Let the render thread know nothing more is coming
+				printf("Receive thread stopping\n");
+				atomicStore(&receiving, 0);
+				ready_event->signal();
+				break;
+			}
+			continue;
+		}
+
+		//Wait for the render thread to give back a buffer
+		while(!queued && !free_frames.pop(&queued)) {
+			if(!atomicLoad(&receiving))
+				return;
+			space_event->wait(MULTICAST_NACK_INTERVAL);
+		}
+
+		if(length > queued->capacity) {
+			delete[] queued->data;
+			queued->capacity = length;
+			queued->data = new char[queued->capacity];
+		}
+		memcpy(queued->data, data, length);
+		queued->length = length;
+		releaseFrame(length);
+
+		//There is always room, only NODE_FRAME_QUEUE buffers exist
+		ready_frames.push(queued);
+		ready_event->signal();
+		queued = NULL;
+	}
+
+	if(queued)
+		free_frames.push(queued);
+}
+
+//Runs every command in the current frame
+void GLNode::runFrame()
+{
+	while(frame_active && frame_pointer < frame_length) {
+		if(receiveCommand() < 0)
+			return;
+	}
+
+	if(frame_active)
+		finishFrame();
+}
+
+//Reads bytes of the command stream from the host
+int GLNode::readStream(char *data, unsigned int length)
+{
+	unsigned int received = 0;
+	unsigned int chunk;
+	int recv_length;
+
+	if(!framed) {
+		while(received < length) {
+			//Take what has already been read
+			if(receive_start < receive_end) {
+				chunk = receive_end - receive_start;
+				if(chunk > length - received)
+					chunk = length - received;
+
+				memcpy(data + received, &receive_buffer[receive_start], chunk);
+				received += chunk;
+				receive_start += chunk;
+				continue;
+			}
+
+			//Large reads go straight into the caller's buffer, small ones read
+			//whatever else has arrived along with them
+			if(length - received >= receive_capacity) {
+				if((recv_length = receiveSocket(data + received, length - received)) < 0)
+					return -1;
+				received += recv_length;
+			} else if(receiveData() < 0) {
+				return -1;
+			}
+		}
+
+		return 0;
+	}
+
+	while(received < length) {
+		//Move on once the current frame has been used up
+		if(frame_active && frame_pointer == frame_length)
+			finishFrame();
+
+		//Wait for the rest of the next frame to arrive
+		if(!frame_active && !nextFrame()) {
+			if(done)
+				return -1;
+
+			if(receiver) {
+				if(!atomicLoad(&receiving))
+					return -1;
+				ready_event->wait(MULTICAST_NACK_INTERVAL);
+			} else if(multicast)
+				pumpMulticast(MULTICAST_NACK_INTERVAL);
+			else if(receiveData() < 0)
+				return -1;
+			continue;
+		}
+
+		chunk = frame_length - frame_pointer;
+		if(chunk > length - received)
+			chunk = length - received;
+
+		memcpy(data + received, &frame_data[frame_pointer], chunk);
+		received += chunk;
+		frame_pointer += chunk;
+	}
+
+	return 0;
+}
+
+//Joins the multicast group
+int GLNode::openMulticast()
+{
+	multicast_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if(multicast_sock == INVALID_SOCKET) {
+		printf("Error %d occurred!\n",  WSAGetLastError());
+		return -1;
+	}
+
+	//Nodes sharing a machine all listen on the group's port
+	BOOL reuse = TRUE;
+	setsockopt(multicast_sock, SOL_SOCKET, SO_REUSEADDR, (char*)&reuse, sizeof(reuse));
+
+	//Give fragments room to queue up while a frame is being rendered
+	int size = MULTICAST_RECV_BUFFER;
+	setsockopt(multicast_sock, SOL_SOCKET, SO_RCVBUF, (char*)&size, sizeof(size));
 
-	//Bind the socket to the port from the config file
 	sockaddr_in anews;
-	anews.sin_port = htons(port);
+	anews.sin_port = htons(multicast_port);
 	anews.sin_addr.s_addr = INADDR_ANY;
 	anews.sin_family = AF_INET;
-	if(bind(server_sock, (sockaddr*)&anews, sizeof(anews)) == SOCKET_ERROR) {
+	if(bind(multicast_sock, (sockaddr*)&anews, sizeof(anews)) == SOCKET_ERROR) {
 		printf("Error %d occurred!\n",  WSAGetLastError());
-		WSACleanup();
-		return;
+		return -1;
 	}
 
-	//Start listening for connections
-	if(listen(server_sock, SOMAXCONN) == SOCKET_ERROR) {
-		printf("Error %d occurred!\n",  WSAGetLastError());
-		WSACleanup();
-		return;
-	}
+	ip_mreq membership;
+	membership.imr_multiaddr.s_addr = inet_addr(multicast_group);
+	membership.imr_interface.s_addr = inet_addr(multicast_interface);
+	if(setsockopt(multicast_sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char*)&membership, sizeof(membership)) == SOCKET_ERROR) {
+		printf("Error %d occurred!\n",  WSAGetLastError());
+		return -1;
+	}
+
+	//Set up the reassembly window
+	multicast_frames = new MulticastFrame[MULTICAST_WINDOW];
+	memset(multicast_frames, 0, MULTICAST_WINDOW * sizeof(MulticastFrame));
+
+	return 0;
+}
+
+//Receives waiting datagrams, waiting up to timeout milliseconds for one
+void GLNode::pumpMulticast(unsigned int timeout)
+{
+	char datagram[sizeof(MulticastHeader) + MULTICAST_PAYLOAD_SIZE];
+	fd_set conn;
+	timeval wait;
+	int length;
+
+	wait.tv_sec = timeout / 1000;
+	wait.tv_usec = (timeout % 1000) * 1000;
+
+	for(int i = 0; i < MULTICAST_PUMP_LIMIT; i++) {
+		FD_ZERO(&conn);
+		FD_SET(multicast_sock, &conn);
+		if(select(0, &conn, NULL, NULL, &wait) <= 0)
+			break;
 
-	//Accept a connection
-	node_sock = accept(server_sock, NULL, NULL);
-	if(node_sock == INVALID_SOCKET) {
-		printf("Error %d occurred!\n",  WSAGetLastError());
-		WSACleanup();
-		return;
-	}
+		if((length = recvfrom(multicast_sock, datagram, sizeof(datagram), 0, NULL, NULL)) == SOCKET_ERROR) {
+			printf("Error %d occurred!\n",  WSAGetLastError());
+			break;
+		}
 
-	//Start connection handling code
-	acceptConnection();
+		receiveFragment(datagram, length);
 
-	//Clean up and exit
-	printf("Cleaning up and exiting from listen code\n");
-	closesocket(node_sock);
-	closesocket(server_sock);
+		//Only wait for the first datagram, then take what is already there
+		wait.tv_sec = 0;
+		wait.tv_usec = 0;
+	}
 
-	WSACleanup();
-	return;
+	requestMissing();
 }
 
-//Accepts a connection by setting up a window and starting the main loop
-void GLNode::acceptConnection()
+//Stores a received fragment in its frame
+void GLNode::receiveFragment(char *datagram, int length)
 {
-	char *buffer = new char[256];
-	int length = 0;
+	MulticastHeader header;
+	MulticastFrame *slot;
+	unsigned int payload;
 
-	//Receive node name from host to make sure connection is valid
-	if((length = recv(node_sock, buffer, 256, 0)) != 256) {
-		if(length == 0)
-			printf("Connection was terminated unexpectedly\n");
-		else
-			printf("Error %d occurred!\n",  WSAGetLastError());
+	if(length < (int)sizeof(MulticastHeader))
 		return;
-	}
 
-	if(strcmp(buffer, nodeIdentifier) != 0) {
-		printf("Incorrect node identifier sent by the host. Terminating connection.\n");
+	memcpy(&header, datagram, sizeof(MulticastHeader));
+	if(header.magic != MULTICAST_MAGIC || header.fragment >= header.fragments ||
+		header.fragments != multicastFragments(header.length))
 		return;
-	}
 
-	//Create the OpenGL window
-	if(createWindow(nodeIdentifier, win_width, win_height, 24)) {
-		//Start looping and waiting for OpenGL commands from the host
-		mainLoop();
+	//Skip frames that were already executed or don't fit in the window yet
+	if(header.frame - next_frame >= MULTICAST_WINDOW)
+		return;
+
+	//The frame being executed is already complete
+	if(header.frame == next_frame && multicast_taken)
+		return;
+
+	datagrams_received++;
+	if((int)(header.frame - highest_frame) > 0)
+		highest_frame = header.frame;
+
+	//First fragment of this frame, set up its slot
+	slot = &multicast_frames[header.frame % MULTICAST_WINDOW];
+	if(!slot->active || slot->frame != header.frame) {
+		if(slot->capacity < header.length) {
+			delete[] slot->data;
+			slot->data = new char[header.length];
+			slot->capacity = header.length;
+		}
+
+		if(slot->have_capacity < header.fragments) {
+			delete[] slot->have;
+			slot->have = new unsigned char[header.fragments];
+			slot->have_capacity = header.fragments;
+		}
+
+		memset(slot->have, 0, header.fragments);
+		slot->active = TRUE;
+		slot->frame = header.frame;
+		slot->fragments = header.fragments;
+		slot->received = 0;
+		slot->length = header.length;
+		slot->nack_time = GetTickCount() + MULTICAST_NACK_INTERVAL;
 	}
 
-	//Kill the window
-	KillGLWindow();
+	//Drop duplicates and fragments that don't match the frame
+	if(header.length != slot->length || slot->have[header.fragment])
+		return;
 
-	delete buffer;
+	payload = slot->length - header.fragment * MULTICAST_PAYLOAD_SIZE;
+	if(payload > MULTICAST_PAYLOAD_SIZE)
+		payload = MULTICAST_PAYLOAD_SIZE;
+	if(length - sizeof(MulticastHeader) != payload)
+		return;
 
-	return;
+	memcpy(&slot->data[header.fragment * MULTICAST_PAYLOAD_SIZE], datagram + sizeof(MulticastHeader), payload);
+	slot->have[header.fragment] = 1;
+	slot->received++;
 }
 
-//Handles messages and relays commands from the host
-void GLNode::mainLoop()
+//Asks the host again for fragments that have not arrived
+void GLNode::requestMissing()
 {
-	MSG msg;
+	BackchannelMessage message;
+	MulticastFrame *slot;
+	DWORD now = GetTickCount();
 
-	//Create fd_set for checking socket status
-	fd_set conn;
-	FD_ZERO(&conn);
-	FD_SET(node_sock, &conn);
+	//Nothing to compare against until the first datagram arrives
+	if(datagrams_received == 0)
+		return;
 
-	//Timeout for select operation
-	timeval timeout;
-	timeout.tv_sec = 0;
-	timeout.tv_usec = 0;
+	message.type = BACKCHANNEL_NACK;
+	message.args[2] = 0;
 
-	//False while main loop still running
-	done = FALSE;
-	
-	while(!done) {
-		//Check if a message is ready
-		if(PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
-			if(msg.message == WM_QUIT) {
-				done = TRUE;
-			} else {
-				TranslateMessage(&msg);
-				DispatchMessage(&msg);
-			}
-		} else {
-			if(keys[VK_ESCAPE])
-				done=TRUE;
-			
-			if(sync) {
-				sync = FALSE;
+	for(unsigned int frame = next_frame; (int)(highest_frame - frame) >= 0; frame++) {
+		slot = &multicast_frames[frame % MULTICAST_WINDOW];
 
-				//If associated context is used, blit to the visible context
-				if(associated_hRC) {
-					glBindFramebuffer(GL_DRAW_FRAMEBUFFER, nRemoteDataFBO);
+		//Complete frames and the frame being executed need nothing
+		if((slot->active && slot->received == slot->fragments) || (frame == next_frame && multicast_taken))
+			continue;
 
-					//Release semaphore and wait for blit to finish
-					ReleaseSemaphore(hSemaphore, 1, NULL);
+		//Give fragments of a newly noticed gap a chance to arrive out of order
+		if(slot->nack_time == 0) {
+			slot->nack_time = now + MULTICAST_NACK_INTERVAL;
+			continue;
+		}
 
-					WaitForSingleObject(hSemaphore2, INFINITE);
+		if((int)(now - slot->nack_time) < 0)
+			continue;
 
-					//Break binding to render to screen
-					glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		slot->nack_time = now + MULTICAST_NACK_INTERVAL;
+		message.args[0] = frame;
 
-					//Render buffer to screen using a fullscreen quad
-					glMatrixMode(GL_PROJECTION);
-					glLoadIdentity();
-					glMatrixMode(GL_MODELVIEW);
-					glLoadIdentity();
-					glBindTexture(GL_TEXTURE_2D, textureId);
-					glBegin(GL_QUADS);
-					glTexCoord2f(0.0f, 0.0f);
-					glVertex3f(-1.0f,-1.0f, -1.0f);
-					glTexCoord2f(1.0f, 0.0f);
-					glVertex3f( 1.0f,-1.0f, -1.0f);
-					glTexCoord2f(1.0f, 1.0f);
-					glVertex3f( 1.0f, 1.0f, -1.0f);
-					glTexCoord2f(0.0f, 1.0f);
-					glVertex3f(-1.0f, 1.0f, -1.0f);
-					glEnd();
-					glBindTexture(GL_TEXTURE_2D, 0);
-				}
+		//Ask for the whole frame if nothing or most of it is missing
+		if(!slot->active || slot->fragments - slot->received > MULTICAST_NACK_LIMIT) {
+			message.args[1] = MULTICAST_ALL_FRAGMENTS;
+			sendMessage(&message);
+			continue;
+		}
 
-				SwapBuffers(hDC);
+		for(unsigned int i = 0; i < slot->fragments; i++) {
+			if(!slot->have[i]) {
+				message.args[1] = i;
+				sendMessage(&message);
 			}
 		}
-
-		//Check if there is a command waiting from the host and accept it
-		if(!associated_hRC && select(0, &conn, NULL, NULL, &timeout) > 0)
-			receiveCommand();
 	}
 }
 
-//Receives an OpenGL command and runs it
-int GLNode::receiveCommand()
+//Takes the next frame if it has been reassembled
+BOOL GLNode::nextMulticastFrame(char **data, unsigned int *length)
 {
-	int id;
-	int length;
-	
-	//Grab the command ID
-	if((length = recv(node_sock, (char*)(&id), sizeof(int), 0)) != sizeof(int)) {
-		if(length == 0)
-			printf("Connection was terminated unexpectedly\n");
-		else
-			printf("Error %d occurred!\n",  WSAGetLastError());
+	MulticastFrame *slot = &multicast_frames[next_frame % MULTICAST_WINDOW];
+
+	if(!slot->active || slot->frame != next_frame || slot->received < slot->fragments)
+		return FALSE;
+
+	*data = slot->data;
+	*length = slot->length;
+	multicast_taken = TRUE;
+	return TRUE;
+}
+
+//Sends a message back to the host over the socket
+int GLNode::sendMessage(BackchannelMessage *message)
+{
+	int sent;
+
+	//The socket is non-blocking, messages are small so a full send buffer
+	//clears quickly
+	send_lock->lock();
+	sent = socketSend(node_sock, (char*)message, sizeof(BackchannelMessage));
+	send_lock->unlock();
+
+	if(sent != sizeof(BackchannelMessage)) {
+		printf("Error %d occurred!\n",  socketError());
 		return -1;
 	}
 
-	if(id == 0) {
-		//This is a syncronize message, signal the window to swap buffers
-		sync = TRUE;
-		sync2 = TRUE;
-	} else {
-		//Call the correct handler
-		(this->*handlers[id])();
-	}
+	if(message->type == BACKCHANNEL_NACK)
+		nacks_sent++;
 
 	return 0;
 }
@@ -359,42 +1592,102 @@ int GLNode::receiveCommand()
 //Prepares the internal buffer for arguments
 void GLNode::prepareBuffer(unsigned int length)
 {
-	int recv_length;
-	
-	//Grab the command arguments
-	if((recv_length = recv(node_sock, buffer, length, 0)) != length) {
-		if(recv_length == 0)
-			printf("Connection was terminated unexpectedly\n");
-		else
-			printf("Error %d occurred!\n",  WSAGetLastError());
+	//Revision 2 arguments have no fixed size, the getters read them from the
+	//stream as they go
+	if(protocol_revision >= PROTOCOL_REVISION_2)
 		return;
-	}
 
 	//Reset pointer
 	buffer_pointer = 0;
+
+	//Use the arguments where they are if the whole frame is in memory
+	if(framed && frame_active && frame_length - frame_pointer >= length) {
+		args = &frame_data[frame_pointer];
+		frame_pointer += length;
+		return;
+	}
+
+	//Grab the command arguments
+	args = buffer;
+	readStream(buffer, length);
 }
 
 //Gets a GLfloat from the buffer
 void GLNode::getGLfloat(GLfloat *value)
 {
-	memcpy(value, &buffer[buffer_pointer], sizeof(GLfloat));
+	if(protocol_revision >= PROTOCOL_REVISION_2) {
+		readStream((char*)value, sizeof(GLfloat));
+		return;
+	}
+
+	memcpy(value, &args[buffer_pointer], sizeof(GLfloat));
 	buffer_pointer += sizeof(GLfloat);
 }
 
 //Gets a GLbitfield from the buffer
 void GLNode::getGLbitfield(GLbitfield *value)
 {
-	memcpy(value, &buffer[buffer_pointer], sizeof(GLbitfield));
+	if(protocol_revision >= PROTOCOL_REVISION_2) {
+		unsigned char packed = 0;
+		readStream((char*)&packed, 1);
+		if(packed == CLEAR_MASK_RAW)
+			readVarint(value);
+		else
+			*value = unpackClearMask(packed);
+		return;
+	}
+
+	memcpy(value, &args[buffer_pointer], sizeof(GLbitfield));
 	buffer_pointer += sizeof(GLbitfield);
 }
 
 //Gets a GLenum value from the buffer
 void GLNode::getGLenum(GLenum *value)
 {
-	memcpy(value, &buffer[buffer_pointer], sizeof(GLenum));
+	if(protocol_revision >= PROTOCOL_REVISION_2) {
+		readVarint(value);
+		return;
+	}
+
+	memcpy(value, &args[buffer_pointer], sizeof(GLenum));
 	buffer_pointer += sizeof(GLenum);
 }
 
+//Gets a GLuint value from the buffer
+void GLNode::getGLuint(GLuint *value)
+{
+	if(protocol_revision >= PROTOCOL_REVISION_2) {
+		readVarint(value);
+		return;
+	}
+
+	memcpy(value, &args[buffer_pointer], sizeof(GLuint));
+	buffer_pointer += sizeof(GLuint);
+}
+
+//Reads a revision 2 varint from the command stream
+void GLNode::readVarint(unsigned int *value)
+{
+	char bytes[VARINT_MAX_SIZE];
+	unsigned int size = 0;
+
+	//Decode straight from the frame when the longest varint fits in it
+	if(framed && frame_active && frame_length - frame_pointer >= VARINT_MAX_SIZE) {
+		frame_pointer += decodeVarint(&frame_data[frame_pointer], value);
+		return;
+	}
+
+	//Read up to the byte without a continuation bit
+	do {
+		if(readStream(&bytes[size], 1) < 0) {
+			*value = 0;
+			return;
+		}
+	} while((bytes[size++] & 0x80) && size < VARINT_MAX_SIZE);
+
+	decodeVarint(bytes, value);
+}
+
 /*  This Code Creates Our OpenGL Window.  Parameters Are:                   *
  *  title           - Title To Appear At The Top Of The Window              *
  *  width           - Width Of The GL Window Or Fullscreen Mode             *
@@ -630,9 +1923,9 @@ GLvoid GLNode::ReSizeGLScene(GLsizei width, GLsizei height)
 	glLoadIdentity();									// Reset The Projection Matrix
 
 	//Calculate the correct frustum for this portion of the host application
-	float near_clip = 0.1f;
-	float far_clip = 100.0f;
-	float fov = 45.0f;
+	float near_clip = VIEW_NEAR_CLIP;
+	float far_clip = VIEW_FAR_CLIP;
+	float fov = VIEW_FOV;
 	float aspect = (float)host_width / (float)host_height;
 	float full_width = 2.0f * tan(fov * PI / 180.0f) * near_clip;
 	float full_height = full_width / aspect;
@@ -705,16 +1998,6 @@ void GLNode::OffscreenThreadMain()
 	glDepthFunc(GL_LEQUAL);
 	glHint(GL_PERSPECTIVE_CORRECTION_HINT, GL_NICEST);
 
-	//Create fd_set for checking socket status
-	fd_set conn;
-	FD_ZERO(&conn);
-	FD_SET(node_sock, &conn);
-
-	//Timeout for select operation
-	timeval timeout;
-	timeout.tv_sec = 0;
-	timeout.tv_usec = 0;
-
 	sync2 = FALSE;
 
 	//Loop while not exiting
@@ -749,8 +2032,9 @@ void GLNode::OffscreenThreadMain()
 			glDeleteSync(remoteFence);
 		}
 
-		if(select(0, &conn, NULL, NULL, &timeout) > 0)
-			receiveCommand();
+		//Run the commands waiting from the host, go to sleep if there were none
+		if(runCommands(&sync2) == 0 && !sync2)
+			waitForCommands(FALSE);
 	}
 
 	//Clean up context
@@ -857,6 +2141,9 @@ int GLNode::InitGL(GLvoid)
 	glEnable(GL_TEXTURE_2D);
 	glDepthFunc(GL_LEQUAL);
 	glHint(GL_PERSPECTIVE_CORRECTION_HINT, GL_NICEST);
+
+	//Cached blocks stay on the card where buffer objects are supported
+	use_buffers = GLEW_VERSION_1_5 ? TRUE : FALSE;
 	return TRUE;
 }
 
@@ -926,100 +2213,479 @@ LRESULT CALLBACK WndProc(	HWND	hWnd,			// Handle For This Window
 //------------------------------------------------------------------------------
 //Implementations of OpenGL functions
 //------------------------------------------------------------------------------
-//1: glClearColor  specify clear values for the color buffers
-void GLNode::_glClearColor()
+//Commands with a GL handler read their fixed arguments and pass them to the
+//OpenGL function of the same name, the rest are written out below
+#define GL_HANDLER_GL(name, masks, integers, floats) \
+void GLNode::_##name() \
+{ \
+	prepareBuffer(ARGS_##name); \
+	GL_SHAPE(GL_READ, masks, integers, floats) \
+	name(GL_SHAPE(GL_ARGUMENTS, masks, integers, floats)); \
+}
+#define GL_HANDLER_NODE(name, masks, integers, floats)
+#define GL_COMMAND_DEFINITION(opcode, name, masks, integers, floats, flags, handler, role, state, joinable) \
+	GL_HANDLER_##handler(name, masks, integers, floats)
+GL_COMMANDS(GL_COMMAND_DEFINITION)
+
+//0: Sync  the host finished a frame
+void GLNode::_Sync()
+{
+	//Signal the window to swap buffers
+	sync = TRUE;
+	sync2 = TRUE;
+
+	//Wake the window if it is waiting for the offscreen thread
+	if(associated_hRC)
+		SetEvent(sync_event);
+
+	//Periodically report how the stream is arriving
+	if(++frames_received % STATS_INTERVAL == 0) {
+		if(multicast)
+			printf("Frame %u: %u datagrams received, %u NACKs sent\n", frames_received, datagrams_received, nacks_sent);
+		printLoopStats();
+	}
+}
+
+//11: a glBegin/glEnd run packed into one block, drawn with a vertex array
+void GLNode::_glDrawVertices()
+{
+	VertexBlock block;
+
+	if(readVertexBlock(OPCODE_glDrawVertices, &block))
+		drawVertexBlock(&block);
+}
+
+//12: a packed run with quantized positions and RGBA8 colors
+void GLNode::_glDrawCompactVertices()
+{
+	VertexBlock block;
+
+	if(readVertexBlock(OPCODE_glDrawCompactVertices, &block))
+		drawVertexBlock(&block);
+}
+
+//Reads the block of a packed or compact run, returns FALSE if there is nothing
+//to draw
+BOOL GLNode::readVertexBlock(int id, VertexBlock *block)
+{
+	GLuint flags;
+
+	if(id == OPCODE_glDrawVertices) {
+		prepareBuffer(ARGS_glDrawVertices);
+		getGLenum(&block->mode);
+		getGLuint(&block->count);
+		getGLuint(&flags);
+
+		unsigned int floats = packedVertexFloats(flags);
+		GLsizei stride = floats * sizeof(GLfloat);
+
+		//Make room for the block
+		if(block->count * floats > vertex_capacity) {
+			if(vertex_data)
+				delete[] vertex_data;
+			vertex_capacity = block->count * floats;
+			vertex_data = new GLfloat[vertex_capacity];
+		}
+
+		if(readStream((char*)vertex_data, block->count * stride) < 0)
+			return FALSE;
+
+		block->positions = vertex_data;
+		block->position_stride = stride;
+		block->color_size = 0;
+		if(flags & PACKED_VERTICES_COLORS) {
+			block->colors = &vertex_data[3];
+			block->color_size = 3;
+			block->color_type = GL_FLOAT;
+			block->color_stride = stride;
+		}
+		return TRUE;
+	}
+
+	if(id != OPCODE_glDrawCompactVertices) {
+		printf("Command %d is not a vertex block\n", id);
+		return FALSE;
+	}
+
+	GLfloat min[3], scale[3];
+	prepareBuffer(ARGS_glDrawCompactVertices);
+	getGLenum(&block->mode);
+	getGLuint(&block->count);
+	getGLuint(&flags);
+	for(int i = 0; i < 3; i++)
+		getGLfloat(&min[i]);
+	for(int i = 0; i < 3; i++)
+		getGLfloat(&scale[i]);
+
+	unsigned int count = block->count;
+	unsigned int size = compactDataSize(count, flags);
+	if(size == 0)
+		return FALSE;
+
+	//Make room for the block and the decoded positions
+	if(size > compact_capacity) {
+		if(compact_data)
+			delete[] compact_data;
+		compact_capacity = size;
+		compact_data = new char[compact_capacity];
+	}
+	if(count * 4 > vertex_capacity) {
+		if(vertex_data)
+			delete[] vertex_data;
+		vertex_capacity = count * 4;
+		vertex_data = new GLfloat[vertex_capacity];
+	}
+
+	if(readStream(compact_data, size) < 0)
+		return FALSE;
+
+	if(flags & COMPACT_VERTICES_DELTA) {
+		if(!decodeDeltas(vertex_data, (unsigned short*)compact_data, &compact_data[3 * sizeof(unsigned short)],
+				flags >> COMPACT_DELTA_SHIFT, count, min, scale)) {
+			printf("Compact block deltas don't fit the block\n");
+			return FALSE;
+		}
+	} else
+		decodePositions(vertex_data, (unsigned short*)compact_data, count, min, scale);
+
+	block->positions = vertex_data;
+	block->position_stride = 4 * sizeof(GLfloat);
+
+	//Colors are drawn straight from the block
+	block->color_size = 0;
+	if(flags & PACKED_VERTICES_COLORS) {
+		block->colors = &compact_data[size - 4 * count];
+		block->color_size = 4;
+		block->color_type = GL_UNSIGNED_BYTE;
+		block->color_stride = 0;
+	}
+	return TRUE;
+}
+
+//Draws a block with vertex arrays
+void GLNode::drawVertexBlock(VertexBlock *block)
+{
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(3, GL_FLOAT, block->position_stride, block->positions);
+	if(block->color_size) {
+		glEnableClientState(GL_COLOR_ARRAY);
+		glColorPointer(block->color_size, block->color_type, block->color_stride, block->colors);
+	}
+
+	glDrawArrays(block->mode, 0, block->count);
+
+	glDisableClientState(GL_VERTEX_ARRAY);
+	if(block->color_size)
+		glDisableClientState(GL_COLOR_ARRAY);
+}
+
+//13: SwapBarrier  the host finished a frame and waits for every node to draw it
+void GLNode::_SwapBarrier()
+{
+	GLuint frame;
+	BackchannelMessage ready;
+	prepareBuffer(ARGS_SwapBarrier);
+	getGLuint(&frame);
+
+	//Finish drawing now so the swap is quick once it is released
+	glFinish();
+
+	memset(&ready, 0, sizeof(ready));
+	ready.type = BACKCHANNEL_FRAME_READY;
+	ready.args[0] = frame;
+	sendMessage(&ready);
+	barrier_time = timeMicroseconds();
+}
+
+//14: Swap  every node has drawn the frame, present it
+void GLNode::_Swap()
 {
-	GLfloat red, green, blue, alpha;
-	prepareBuffer(4 * sizeof(GLfloat));
-	getGLfloat(&red);
-	getGLfloat(&green);
-	getGLfloat(&blue);
-	getGLfloat(&alpha);
-	glClearColor(red, green, blue, alpha);
+	GLuint frame;
+	prepareBuffer(ARGS_Swap);
+	getGLuint(&frame);
+
+	barrier_wait_total += timeMicroseconds() - barrier_time;
+	barrier_swaps++;
+
+	_Sync();
+}
+
+//15: ClockProbe  the host is measuring this node's clock
+void GLNode::_ClockProbe()
+{
+	GLuint probe;
+	BackchannelMessage answer;
+	prepareBuffer(ARGS_ClockProbe);
+	getGLuint(&probe);
+
+	unsigned long long now = timeMicroseconds();
+	memset(&answer, 0, sizeof(answer));
+	answer.type = BACKCHANNEL_CLOCK;
+	answer.args[0] = probe;
+	answer.args[1] = (unsigned int)now;
+	answer.args[2] = (unsigned int)(now >> 32);
+	sendMessage(&answer);
+}
+
+//16: ClockOffset  how far a node's clock is from the host's
+void GLNode::_ClockOffset()
+{
+	GLuint index, low, high;
+	prepareBuffer(ARGS_ClockOffset);
+	getGLuint(&index);
+	getGLuint(&low);
+	getGLuint(&high);
+
+	//Every node gets every offset
+	if(index == node_index) {
+		clock_offset = (long long)joinHalves(low, high);
+		clock_valid = TRUE;
+	}
 }
 
-//2: glClear  clear buffers to preset values
-void GLNode::_glClear()
+//17: PresentAt  the host finished a frame, present it at a given time
+void GLNode::_PresentAt()
 {
-	GLbitfield mask;
-	prepareBuffer(sizeof(GLbitfield));
-	getGLbitfield(&mask);
-	glClear(mask);
+	GLuint frame, low, high;
+	prepareBuffer(ARGS_PresentAt);
+	getGLuint(&frame);
+	getGLuint(&low);
+	getGLuint(&high);
+
+	//Without an offset yet the time means nothing here, present right away
+	if(clock_valid) {
+		glFinish();
+		waitUntil(joinHalves(low, high) + clock_offset);
+		present_frame = frame;
+		present_pending = TRUE;
+	}
+
+	_Sync();
 }
 
-//3: glLoadIdentity  replace the current matrix with the identity matrix
-void GLNode::_glLoadIdentity()
+//18: SkipFrame  the host dropped a frame this node was too far behind for
+void GLNode::_SkipFrame()
 {
-	glLoadIdentity();
+	frames_skipped++;
+	countSkippedFrame();
 }
 
-//4: glTranslatef  multiply the current matrix by a translation matrix
-void GLNode::_glTranslatef()
+//19: CacheStore - keeps the vertex block that follows in a geometry cache slot
+void GLNode::_CacheStore()
 {
-	GLfloat x, y, z;
-	prepareBuffer(3 * sizeof(GLfloat));
-	getGLfloat(&x);
-	getGLfloat(&y);
-	getGLfloat(&z);
-	glTranslatef(x, y, z);
+	GLuint slot;
+	VertexBlock block;
+	prepareBuffer(ARGS_CacheStore);
+	getGLuint(&slot);
+
+	//The block is a whole packed or compact run command
+	int id = readOpcode();
+	if(id < 0 || !readVertexBlock(id, &block))
+		return;
+
+	if(slot >= CACHE_MAX_SLOTS) {
+		printf("Geometry cache slot %u is out of range\n", slot);
+		return;
+	}
+
+	//Grow the slots to fit the one stored in
+	if((int)slot >= cache_capacity) {
+		int capacity = cache_capacity ? cache_capacity : 256;
+		while(capacity <= (int)slot)
+			capacity *= 2;
+		if(capacity > CACHE_MAX_SLOTS)
+			capacity = CACHE_MAX_SLOTS;
+
+		CachedBlock *grown = new CachedBlock[capacity];
+		memset(grown, 0, capacity * sizeof(CachedBlock));
+		if(cache_blocks) {
+			memcpy(grown, cache_blocks, cache_capacity * sizeof(CachedBlock));
+			delete[] cache_blocks;
+		}
+		cache_blocks = grown;
+		cache_capacity = capacity;
+	}
+
+	CachedBlock *cached = &cache_blocks[slot];
+	if(cached->size > 0) {
+		freeCachedBlock(cached);
+		cache_replaced++;
+	}
+
+	//Pack positions and then colors tightly, whatever layout they came in
+	unsigned int position_bytes = block.count * 3 * sizeof(GLfloat);
+	unsigned int color_element = block.color_size * (block.color_type == GL_FLOAT ? sizeof(GLfloat) : 1);
+	unsigned int color_bytes = block.count * color_element;
+	char *data = new char[position_bytes + color_bytes];
+
+	for(unsigned int i = 0; i < block.count; i++)
+		memcpy(&data[i * 3 * sizeof(GLfloat)], (const char*)block.positions + i * block.position_stride, 3 * sizeof(GLfloat));
+	if(color_bytes > 0) {
+		GLsizei stride = block.color_stride ? block.color_stride : color_element;
+		for(unsigned int i = 0; i < block.count; i++)
+			memcpy(&data[position_bytes + i * color_element], (const char*)block.colors + i * stride, color_element);
+	}
+
+	cached->mode = block.mode;
+	cached->count = block.count;
+	cached->size = position_bytes + color_bytes;
+	cached->color_size = block.color_size;
+	cached->color_type = block.color_type;
+
+	if(use_buffers) {
+		glGenBuffers(1, &cached->buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, cached->buffer);
+		glBufferData(GL_ARRAY_BUFFER, cached->size, data, GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		delete[] data;
+	} else {
+		cached->data = data;
+	}
+
+	cache_stores++;
+	cache_bytes += cached->size;
 }
 
-//5: glBegin  delimit the vertices of a primitive or a group of like primitives
-void GLNode::_glBegin()
+//20: CacheDraw - draws the block in a geometry cache slot
+void GLNode::_CacheDraw()
 {
-	GLenum mode;
-	prepareBuffer(sizeof(GLenum));
-	getGLenum(&mode);
-	glBegin(mode);
+	VertexBlock block;
+
+	if(!readCachedBlock(&block))
+		return;
+
+	drawVertexBlock(&block);
+	if(use_buffers)
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
-//6: glEnd  delimit the vertices of a primitive or a group of like primitives
-void GLNode::_glEnd()
+//Reads the slot of a cached draw and points a block at what the slot holds,
+//binding its buffer. Returns FALSE if the slot is empty
+BOOL GLNode::readCachedBlock(VertexBlock *block)
 {
-	glEnd();
+	GLuint slot;
+	prepareBuffer(ARGS_CacheDraw);
+	getGLuint(&slot);
+
+	if((int)slot >= cache_capacity || cache_blocks[slot].size == 0) {
+		printf("Geometry cache slot %u is empty\n", slot);
+		return FALSE;
+	}
+
+	//Pointers into a buffer object are offsets from its start
+	CachedBlock *cached = &cache_blocks[slot];
+	const char *base = cached->data;
+	if(cached->buffer)
+		glBindBuffer(GL_ARRAY_BUFFER, cached->buffer);
+
+	block->mode = cached->mode;
+	block->count = cached->count;
+	block->positions = base;
+	block->position_stride = 0;
+	block->colors = base + cached->count * 3 * sizeof(GLfloat);
+	block->color_size = cached->color_size;
+	block->color_type = cached->color_type;
+	block->color_stride = 0;
+	cache_draws++;
+	return TRUE;
 }
 
-//7: glVertex3f  Specifies a vertex
-void GLNode::_glVertex3f()
+//22: DrawInstances - draws one vertex block under the matrix of each copy
+void GLNode::_DrawInstances()
 {
-	GLfloat x, y, z;
-	prepareBuffer(3 * sizeof(GLfloat));
-	getGLfloat(&x);
-	getGLfloat(&y);
-	getGLfloat(&z);
-	glVertex3f(x, y, z);
+	GLuint count, flags;
+	VertexBlock block;
+	BOOL cached;
+	prepareBuffer(ARGS_DrawInstances);
+	getGLuint(&count);
+	getGLuint(&flags);
+
+	//Make room for the matrices
+	unsigned int floats = instanceMatrixFloats(flags);
+	if(count * floats > instance_capacity) {
+		if(instance_data)
+			delete[] instance_data;
+		instance_capacity = count * floats;
+		instance_data = new GLfloat[instance_capacity];
+	}
+
+	if(readStream((char*)instance_data, count * floats * sizeof(GLfloat)) < 0)
+		return;
+
+	//The block is a whole packed or compact run, or a draw from the cache
+	int id = readOpcode();
+	if(id < 0)
+		return;
+	cached = id == OPCODE_CacheDraw;
+	if(cached ? !readCachedBlock(&block) : !readVertexBlock(id, &block))
+		return;
+
+	//Each copy replaces the matrix, the host expects it back as it was
+	glPushMatrix();
+	for(GLuint i = 0; i < count; i++) {
+		GLfloat *elements = &instance_data[i * floats];
+		GLfloat m[16];
+
+		if(flags & INSTANCES_AFFINE) {
+			//Only the top three rows of each column were sent
+			for(int column = 0; column < 4; column++) {
+				m[column * 4] = elements[column * 3];
+				m[column * 4 + 1] = elements[column * 3 + 1];
+				m[column * 4 + 2] = elements[column * 3 + 2];
+				m[column * 4 + 3] = column == 3 ? 1.0f : 0.0f;
+			}
+			elements = m;
+		}
+
+		glLoadMatrixf(elements);
+		drawVertexBlock(&block);
+	}
+	glPopMatrix();
+
+	if(cached && use_buffers)
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	instanced_draws++;
+	instances_drawn += count;
 }
 
-//8: glColor3f  Sets the current color
-void GLNode::_glColor3f()
+//Empties a geometry cache slot
+void GLNode::freeCachedBlock(CachedBlock *cached)
 {
-	GLfloat red, green, blue;
-	prepareBuffer(3 * sizeof(GLfloat));
-	getGLfloat(&red);
-	getGLfloat(&green);
-	getGLfloat(&blue);
-	glColor3f(red, green, blue);
+	if(cached->buffer)
+		glDeleteBuffers(1, &cached->buffer);
+	if(cached->data)
+		delete[] cached->data;
+
+	cache_bytes -= cached->size;
+	cached->buffer = 0;
+	cached->data = NULL;
+	cached->size = 0;
 }
 
-//9: glRotatef  multiply the current matrix by a rotation matrix
-void GLNode::_glRotatef()
+//Waits until this node's clock reaches a time
+void GLNode::waitUntil(unsigned long long time)
 {
-	GLfloat angle, x, y, z;
-	prepareBuffer(4 * sizeof(GLfloat));
-	getGLfloat(&angle);
-	getGLfloat(&x);
-	getGLfloat(&y);
-	getGLfloat(&z);
-	glRotatef(angle, x, y, z);
+	unsigned long long now = timeMicroseconds();
+
+	//Sleep is only accurate to a scheduler tick, spin for the last part
+	while(now < time) {
+		if(time - now > PRESENT_SPIN)
+			Sleep((DWORD)((time - now - PRESENT_SPIN) / 1000) + 1);
+		now = timeMicroseconds();
+	}
 }
 
-//10: glScalef - multiply the current matrix by a general scaling matrix
-void GLNode::_glScalef()
+//Tells the host when the pending frame was presented
+void GLNode::reportPresent()
 {
-	GLfloat x, y, z;
-	prepareBuffer(3 * sizeof(GLfloat));
-	getGLfloat(&x);
-	getGLfloat(&y);
-	getGLfloat(&z);
-	glScalef(x, y, z);
+	BackchannelMessage presented;
+	unsigned long long host_time = timeMicroseconds() - clock_offset;
+
+	present_pending = FALSE;
+	memset(&presented, 0, sizeof(presented));
+	presented.type = BACKCHANNEL_PRESENTED;
+	presented.args[0] = present_frame;
+	presented.args[1] = (unsigned int)host_time;
+	presented.args[2] = (unsigned int)(host_time >> 32);
+	sendMessage(&presented);
 }
@@ -9,25 +9,153 @@
 
 #define _CRT_SECURE_NO_WARNINGS
 
-#include <winsock2.h>
-#include <windows.h>
+#include "..\HostApp\GLSocket.h"
 #include <gl\glew.h>
 #include <gl\wglew.h>
 #include <gl\gl.h>
 #include <gl\glu.h>
 #include <gl\wglext.h>
 
+#include "..\HostApp\GLProtocol.h"
+#include "..\HostApp\GLThread.h"
+#include "..\HostApp\GLDelta.h"
+#include "..\HostApp\GLSharedRing.h"
+
 //The size of the buffer to hold command and arguments
 #define BUFFER_SIZE 10485760
 
 #define PI 3.14159265f
 
+//Number of frames between statistics reports
+#define STATS_INTERVAL 1000
+
+//Number of multicast frames that can be reassembled at once
+#define MULTICAST_WINDOW 64
+
+//Milliseconds to wait for missing fragments before asking for them again
+#define MULTICAST_NACK_INTERVAL 20
+
+//Size of the receive buffer of the multicast socket
+#define MULTICAST_RECV_BUFFER 4194304
+
+//Most datagrams handled before going back to rendering
+#define MULTICAST_PUMP_LIMIT 256
+
+//Missing fragments in one frame above which the whole frame is asked for
+#define MULTICAST_NACK_LIMIT 16
+
+//Features this node accepts in the handshake
+#define NODE_FEATURES (FEATURE_COMPACT_VERTICES | FEATURE_LENGTH_PREFIX | FEATURE_SHARED_MEMORY | FEATURE_GEOMETRY_CACHE | \
+	FEATURE_DELTA_FRAMES | FEATURE_INSTANCING)
+
+//Starting size of the buffer socket reads go through, it grows to fit the
+//largest frame
+#define RECEIVE_BUFFER_SIZE 1048576
+
+//Number of received frames that can wait for the render thread
+#define NODE_FRAME_QUEUE 4
+
+//Number of receives kept posted on the socket and the bytes each one takes
+#define NODE_POSTED_RECEIVES 4
+#define NODE_POSTED_SIZE 65536
+
+//Longest a loop blocks before checking whether it should stop, in milliseconds
+#define NODE_WAIT_TIMEOUT 100
+
+//Default microseconds to spin checking for commands before blocking
+#define DEFAULT_SPIN_BUDGET 50
+
+//Default microseconds of commands run before going back to the window
+#define DEFAULT_COMMAND_BUDGET 4000
+
+//Microseconds before a scheduled present below which the node spins instead
+//of sleeping
+#define PRESENT_SPIN 2000
+
 //Declaration For WndProc
 LRESULT CALLBACK WndProc(HWND, UINT, WPARAM, LPARAM);
 
 //Function header for thread entry point
 DWORD WINAPI OffscreenRenderShell(LPVOID param);
 
+//A frame being reassembled from multicast fragments
+struct MulticastFrame {
+	//Has any fragment of this frame arrived yet
+	BOOL active;
+
+	//Sequence number of the frame
+	unsigned int frame;
+
+	//Number of fragments in the frame and how many have arrived
+	unsigned int fragments;
+	unsigned int received;
+
+	//Reassembled frame data
+	char *data;
+	unsigned int length;
+	unsigned int capacity;
+
+	//Which fragments have arrived
+	unsigned char *have;
+	unsigned int have_capacity;
+
+	//Time before which missing fragments are not asked for again
+	DWORD nack_time;
+};
+
+//A whole frame copied out by the receive thread
+struct NodeFrame {
+	char *data;
+	unsigned int length;
+	unsigned int capacity;
+};
+
+//A receive posted ahead on the socket, the stream lands in it while the node
+//renders and is taken out in the order the receives were posted
+struct PostedReceive {
+	WSAOVERLAPPED overlapped;
+	char *data;
+
+	//Bytes received once complete, 0 if the connection closed, and bytes
+	//taken out so far
+	unsigned int length;
+	unsigned int offset;
+	BOOL complete;
+};
+
+//A decoded vertex block, ready to draw with vertex arrays
+struct VertexBlock {
+	GLenum mode;
+	GLuint count;
+
+	//Positions are three floats each, stride 0 if they are tightly packed
+	const GLvoid *positions;
+	GLsizei position_stride;
+
+	//Colors, only there if color_size is not 0
+	const GLvoid *colors;
+	GLint color_size;
+	GLenum color_type;
+	GLsizei color_stride;
+};
+
+//A block kept in a geometry cache slot, positions then colors tightly packed
+struct CachedBlock {
+	GLenum mode;
+	GLuint count;
+
+	//Buffer object holding the block, 0 if data holds it instead
+	GLuint buffer;
+	char *data;
+
+	//Bytes of the block, 0 if the slot is empty
+	unsigned int size;
+
+	//Colors after the positions, color_size 0 if there are none
+	GLint color_size;
+	GLenum color_type;
+};
+
 class GLNode {
 private:
 	//Dimensions of this window
@@ -72,6 +200,145 @@ private:
 	//Socket to read commands over
 	SOCKET node_sock;
 
+	//Data read from the socket ahead of the commands that need it, unread
+	//data is between receive_start and receive_end
+	char *receive_buffer;
+	unsigned int receive_capacity;
+	unsigned int receive_start;
+	unsigned int receive_end;
+
+	//Do commands arrive in whole frames, from multicast or length prefixed
+	BOOL framed;
+
+	//The frame being executed
+	char *frame_data;
+	unsigned int frame_length;
+
+	//Length of the frame as it arrived, before a delta frame is expanded
+	unsigned int frame_received;
+
+	//Expands delta frames against the last frame, or NULL if the host sends
+	//frames as they are
+	GLDeltaDecoder *delta;
+
+	//Chunks skipped because they could not be expanded
+	unsigned int delta_skipped;
+
+	//Protocol revision agreed with the host
+	unsigned int protocol_revision;
+
+	//Should whole frames be received on their own thread
+	int receive_thread;
+
+	//Thread receiving frames while the render thread runs the current one
+	GLThread *receiver;
+
+	//Non-zero while the receive thread should keep running
+	volatile long receiving;
+
+	//Frames ready to run and empty frames for the receive thread to fill,
+	//a ring holds one less than its size
+	GLRing<NodeFrame*, NODE_FRAME_QUEUE + 1> ready_frames;
+	GLRing<NodeFrame*, NODE_FRAME_QUEUE + 1> free_frames;
+
+	//Signalled when a frame is ready and when a frame is handed back
+	GLEvent *ready_event;
+	GLEvent *space_event;
+
+	//The queued frame being run
+	NodeFrame *queued_frame;
+
+	//Microseconds to spin before blocking and to run commands per wakeup
+	int spin_budget;
+	int command_budget;
+
+	//Signalled by Winsock when the socket commands arrive on has data
+	WSAEVENT network_event;
+
+	//Ring the stream arrives through when the host is on this machine, or
+	//NULL when it comes over the socket
+	GLSharedRing *shared_ring;
+
+	//Should receives be kept posted on the socket instead of calling recv
+	int posted_receives;
+
+	//Should small sends go out right away instead of being coalesced, and the
+	//socket buffer sizes to ask for, 0 leaves them to the OS
+	int tcp_no_delay;
+	int send_buffer_size;
+	int receive_buffer_size;
+
+	//Receives posted on the socket, or NULL, and the oldest one
+	PostedReceive *posted;
+	int next_posted;
+
+	//Posts all the receives, falls back to recv if the socket won't take them
+	void startPostedReceives();
+
+	//Cancels the posted receives and frees them
+	void stopPostedReceives();
+
+	//Posts a receive again once everything in it was taken
+	int postReceive(PostedReceive *receive);
+
+	//Returns TRUE if the oldest posted receive is complete, waiting up to
+	//wait milliseconds for it
+	BOOL postedReady(unsigned int wait);
+
+	//Takes bytes out of the oldest complete receive, returns how many or -1
+	//once the connection has closed
+	int takePosted(char *data, unsigned int length);
+
+	//Signalled when the offscreen thread finishes a frame
+	HANDLE sync_event;
+
+	//Performance counter ticks per second and when the loop started
+	LARGE_INTEGER counter_frequency;
+	LARGE_INTEGER loop_start;
+
+	//Ticks spent spinning and blocked waiting for commands
+	LONGLONG spin_ticks;
+	LONGLONG block_ticks;
+
+	//Wakeups by the host, and the ticks from each until its first command ran
+	unsigned int wakeups;
+	LONGLONG wake_ticks;
+	LONGLONG wake_max_ticks;
+
+	//Did the last wait end because the host sent something, and when
+	BOOL wake_pending;
+	LARGE_INTEGER wake_time;
+
+	//When the last frame was reported ready to the swap barrier
+	unsigned long long barrier_time;
+
+	//Frames swapped by the barrier and microseconds they waited for it
+	unsigned int barrier_swaps;
+	unsigned long long barrier_wait_total;
+
+	//Keeps messages from the render and receive threads whole on the socket
+	GLLock *send_lock;
+
+	//Position of this node in the host's config
+	unsigned int node_index;
+
+	//This node's clock minus the host's, once the host has sent it
+	long long clock_offset;
+	BOOL clock_valid;
+
+	//Frame ended by PresentAt waiting to be reported once it is swapped
+	BOOL present_pending;
+	unsigned int present_frame;
+
+	//Frames the host dropped for this node because it fell behind
+	unsigned int frames_skipped;
+
+	//Waits until this node's clock reaches a time
+	void waitUntil(unsigned long long time);
+
+	//Tells the host when the pending frame was presented
+	void reportPresent();
+
 	//Syncronization flag
 	BOOL sync;
 	BOOL sync2;
@@ -99,6 +366,101 @@ private:
 	unsigned int buffer_pointer;
 	unsigned int buffer_size;
 
+	//Arguments of the current command, in the frame or copied into buffer
+	char *args;
+
+	//Vertices of the last packed block, grows to fit the largest block
+	GLfloat *vertex_data;
+	unsigned int vertex_capacity;
+
+	//Data of the last compact block before it is decoded
+	char *compact_data;
+	unsigned int compact_capacity;
+
+	//Geometry cache slots the host stores blocks in, grown to fit the
+	//highest slot used
+	CachedBlock *cache_blocks;
+	int cache_capacity;
+
+	//Should cached blocks live in buffer objects on the card
+	BOOL use_buffers;
+
+	//Blocks stored and drawn, stores over an older block, and bytes held
+	unsigned int cache_stores;
+	unsigned int cache_draws;
+	unsigned int cache_replaced;
+	unsigned int cache_bytes;
+
+	//Matrices of the copies in the last instanced draw
+	GLfloat *instance_data;
+	unsigned int instance_capacity;
+
+	//Instanced draws and the copies they drew
+	unsigned int instanced_draws;
+	unsigned int instances_drawn;
+
+	//Should commands be received from a multicast group instead of the socket
+	int multicast;
+
+	//Multicast group settings
+	char multicast_group[32];
+	int multicast_port;
+	char multicast_interface[32];
+
+	//Socket receiving multicast datagrams
+	SOCKET multicast_sock;
+
+	//Frames being reassembled, indexed by sequence number
+	MulticastFrame *multicast_frames;
+
+	//Sequence number of the frame being executed or to execute next
+	unsigned int next_frame;
+
+	//Highest frame sequence number seen so far
+	unsigned int highest_frame;
+
+	//Is the next frame being executed and the read position in it
+	BOOL frame_active;
+	unsigned int frame_pointer;
+
+	//Has the frame at next_frame been taken out of its slot
+	BOOL multicast_taken;
+
+	//Multicast statistics
+	unsigned int datagrams_received;
+	unsigned int nacks_sent;
+
+	//Number of sync packets received
+	unsigned int frames_received;
+
+	//Joins the multicast group
+	int openMulticast();
+
+	//Receives waiting datagrams, waiting up to timeout milliseconds for one
+	void pumpMulticast(unsigned int timeout);
+
+	//Stores a received fragment in its frame
+	void receiveFragment(char *datagram, int length);
+
+	//Asks the host again for fragments that have not arrived
+	void requestMissing();
+
+	//Takes the next frame if it has been reassembled
+	BOOL nextMulticastFrame(char **data, unsigned int *length);
+
+	//Finds the next whole frame that has arrived from the host
+	BOOL takeFrame(char **data, unsigned int *length);
+
+	//Frees the space of a frame found by takeFrame
+	void releaseFrame(unsigned int length);
+
+	//Starts and stops the thread that receives frames
+	void startReceiver();
+	void stopReceiver();
+
+	//Sends a message back to the host over the socket
+	int sendMessage(BackchannelMessage *message);
+
 	//Read node attributes from a config file
 	void readConfiguration();
 
@@ -115,6 +477,60 @@ public:
 	//Receives an OpenGL command and runs it
 	int receiveCommand();
 
+	//Reads the ID of the next command, returns -1 if it can't be read or is
+	//unknown
+	int readOpcode();
+
+	//Returns TRUE if a command from the host is ready to be received
+	BOOL commandReady();
+
+	//Reads bytes of the command stream from the host
+	int readStream(char *data, unsigned int length);
+
+	//Returns TRUE if data from the host can be read without blocking, waiting
+	//up to timeout milliseconds for it
+	BOOL socketReadable(unsigned int timeout);
+
+	//Reads what the socket has into the receive buffer
+	int receiveData();
+
+	//Receives from the socket, waiting for data if it is non-blocking
+	int receiveSocket(char *data, unsigned int length);
+
+	//Runs commands until none are ready, stop is set or the command budget is
+	//used, returns how many ran
+	unsigned int runCommands(BOOL *stop);
+
+	//Spins for the spin budget, then blocks until commands may be ready or,
+	//with messages, a window message arrives
+	void waitForCommands(BOOL messages);
+
+	//Returns the handle that is signalled when commands may be ready
+	HANDLE commandHandle();
+
+	//Prints how long the loop was idle and how quickly it woke up
+	void printLoopStats();
+
+	//Makes the next whole frame from the host current if it has arrived
+	BOOL nextFrame();
+
+	//Frees the current frame once all of its commands have run
+	void finishFrame();
+
+	//Turns the current frame from a delta chunk into its commands, skipping
+	//it if it can't be expanded
+	void expandFrame();
+
+	//Counts a frame that wasn't drawn as done so the host keeps pacing by
+	//this node correctly
+	void countSkippedFrame();
+
+	//Runs every command in the current frame
+	void runFrame();
+
+	//Receives frames until the node stops, runs on the receive thread
+	void receiverMain();
+
 	//Runs to render to offscreen buffer
 	void OffscreenThreadMain();
 
@@ -130,6 +546,12 @@ public:
 	//Gets a GLbitfield from the buffer
 	void getGLbitfield(GLbitfield *value);
 
+	//Gets a GLuint value from the buffer
+	void getGLuint(GLuint *value);
+
+	//Reads a revision 2 varint from the command stream
+	void readVarint(unsigned int *value);
+
 	//Creates the window
 	BOOL createWindow(char* title, int width, int height, int bits);
 
@@ -151,14 +573,21 @@ public:
 	//----------------
 	//OpenGL functions
 	//----------------
-	void _glClearColor();
-	void _glClear();
-	void _glLoadIdentity();
-	void _glTranslatef();
-	void _glBegin();
-	void _glEnd();
-	void _glVertex3f();
-	void _glColor3f();
-	void _glRotatef();
-	void _glScalef();
+	//Handler of each command, _<name>
+#define GL_COMMAND_DECLARATION(opcode, name, masks, integers, floats, flags, handler, role, state, joinable) void _##name();
+	GL_COMMANDS(GL_COMMAND_DECLARATION)
+
+	//Reads the block of a packed or compact run, returns FALSE if there is
+	//nothing to draw
+	BOOL readVertexBlock(int id, VertexBlock *block);
+
+	//Draws a block with vertex arrays
+	void drawVertexBlock(VertexBlock *block);
+
+	//Empties a geometry cache slot
+	void freeCachedBlock(CachedBlock *cached);
+
+	//Reads the slot of a cached draw and points a block at what the slot
+	//holds, binding its buffer. Returns FALSE if the slot is empty
+	BOOL readCachedBlock(VertexBlock *block);
 };